@@ -0,0 +1,575 @@
+/* boatswain-bench.c
+ *
+ * Copyright 2022 Georges Basile Stavracas Neto <georges.stavracas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/*
+ * Drives the key image pipeline (compose, render and encode, packetize and
+ * write) of every supported model against a null sink, and reports
+ * throughput and latency percentiles as JSON. HID recordings passed with
+ * --replay are played back too, to measure input handling latency.
+ */
+
+#define G_LOG_DOMAIN "Benchmark"
+
+#include <glib/gstdio.h>
+#include <gtk/gtk.h>
+#include <json-glib/json-glib.h>
+
+#include "bs-button-private.h"
+#include "bs-button-grid-region.h"
+#include "bs-device-region.h"
+#include "bs-hid-replay.h"
+#include "bs-icon.h"
+#include "bs-renderer.h"
+#include "bs-stream-deck-private.h"
+
+#define N_WARMUP_ITERATIONS 10
+#define ICON_LOAD_TIMEOUT_S 10
+
+typedef enum
+{
+  STAGE_COMPOSE,
+  STAGE_ENCODE,
+  STAGE_WRITE,
+  STAGE_TOTAL,
+  N_STAGES,
+} Stage;
+
+static const char * const stage_names[] = {
+  [STAGE_COMPOSE] = "compose",
+  [STAGE_ENCODE] = "encode",
+  [STAGE_WRITE] = "write",
+  [STAGE_TOTAL] = "total",
+};
+
+typedef enum
+{
+  ICON_MIX_SOLID_COLOR,
+  ICON_MIX_SYMBOLIC_ICON,
+  ICON_MIX_TEXT,
+  ICON_MIX_IMAGE_FILE,
+  N_ICON_MIXES,
+} IconMix;
+
+static const char * const icon_mix_names[] = {
+  [ICON_MIX_SOLID_COLOR] = "solid-color",
+  [ICON_MIX_SYMBOLIC_ICON] = "symbolic-icon",
+  [ICON_MIX_TEXT] = "text",
+  [ICON_MIX_IMAGE_FILE] = "image-file",
+};
+
+static int iterations = 500;
+static char *output_path = NULL;
+static char **replay_paths = NULL;
+static gboolean has_display = FALSE;
+
+static GOptionEntry options[] = {
+  { "iterations", 'n', 0, G_OPTION_ARG_INT, &iterations, "Number of keys to push per model and icon", "N" },
+  { "output", 'o', 0, G_OPTION_ARG_FILENAME, &output_path, "Write results to FILE instead of stdout", "FILE" },
+  { "replay", 'r', 0, G_OPTION_ARG_FILENAME_ARRAY, &replay_paths, "Play back the HID recording FILE", "FILE" },
+  { NULL },
+};
+
+
+/*
+ * Auxiliary methods
+ */
+
+static int
+compare_int64 (gconstpointer a,
+               gconstpointer b)
+{
+  int64_t x = *(const int64_t *) a;
+  int64_t y = *(const int64_t *) b;
+
+  return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile of sorted samples */
+static int64_t
+get_percentile (const int64_t *samples,
+                size_t         n_samples,
+                unsigned int   percentile)
+{
+  size_t rank;
+
+  g_assert (n_samples > 0);
+
+  rank = (percentile * n_samples + 99) / 100;
+  return samples[CLAMP (rank, 1, n_samples) - 1];
+}
+
+static GFile *
+create_image_file (const char  *directory,
+                   GError     **error)
+{
+  g_autofree char *path = NULL;
+  cairo_surface_t *surface;
+  cairo_pattern_t *pattern;
+  cairo_status_t status;
+  cairo_t *cr;
+
+  /* Much larger than any key, like the pictures users drop on them */
+  surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, 2048, 2048);
+  cr = cairo_create (surface);
+
+  pattern = cairo_pattern_create_linear (0, 0, 2048, 2048);
+  cairo_pattern_add_color_stop_rgb (pattern, 0.0, 0.11, 0.44, 0.85);
+  cairo_pattern_add_color_stop_rgb (pattern, 1.0, 0.88, 0.11, 0.14);
+  cairo_set_source (cr, pattern);
+  cairo_paint (cr);
+
+  cairo_pattern_destroy (pattern);
+  cairo_destroy (cr);
+
+  path = g_build_filename (directory, "image.png", NULL);
+  status = cairo_surface_write_to_png (surface, path);
+  cairo_surface_destroy (surface);
+
+  if (status != CAIRO_STATUS_SUCCESS)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Failed to write %s: %s", path, cairo_status_to_string (status));
+      return NULL;
+    }
+
+  return g_file_new_for_path (path);
+}
+
+static gboolean
+on_icon_load_timeout_cb (gpointer user_data)
+{
+  gboolean *timed_out = user_data;
+
+  *timed_out = TRUE;
+  g_main_context_wakeup (NULL);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+on_icon_contents_invalidated_cb (BsIcon   *icon,
+                                 gboolean *loaded)
+{
+  *loaded = TRUE;
+  g_main_context_wakeup (NULL);
+}
+
+static gboolean
+wait_for_icon_contents (BsIcon  *icon,
+                        GError **error)
+{
+  gboolean timed_out = FALSE;
+  gboolean loaded = FALSE;
+  gulong handler_id;
+  guint timeout_id;
+
+  handler_id = g_signal_connect (icon, "invalidate-contents", G_CALLBACK (on_icon_contents_invalidated_cb), &loaded);
+  timeout_id = g_timeout_add_seconds (ICON_LOAD_TIMEOUT_S, on_icon_load_timeout_cb, &timed_out);
+
+  while (!loaded && !timed_out)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_signal_handler_disconnect (icon, handler_id);
+  if (!timed_out)
+    g_source_remove (timeout_id);
+
+  if (!loaded)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+                   "Timed out loading image after %d seconds", ICON_LOAD_TIMEOUT_S);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static BsIcon *
+create_icon (IconMix   icon_mix,
+             GFile    *image_file,
+             GError  **error)
+{
+  g_autoptr (BsIcon) icon = NULL;
+  GdkRGBA background = { 0.21, 0.52, 0.89, 1.0 };
+  GdkRGBA foreground = { 1.0, 1.0, 1.0, 1.0 };
+
+  icon = bs_icon_new_empty ();
+  bs_icon_set_background_color (icon, &background);
+  bs_icon_set_color (icon, &foreground);
+
+  switch (icon_mix)
+    {
+    case ICON_MIX_SOLID_COLOR:
+      break;
+
+    case ICON_MIX_SYMBOLIC_ICON:
+      bs_icon_set_icon_name (icon, "media-playback-start-symbolic");
+      break;
+
+    case ICON_MIX_TEXT:
+      bs_icon_set_text (icon, "Scene 12");
+      break;
+
+    case ICON_MIX_IMAGE_FILE:
+      bs_icon_set_file (icon, image_file);
+
+      /* Images are loaded in a thread */
+      if (!wait_for_icon_contents (icon, error))
+        return NULL;
+      break;
+
+    case N_ICON_MIXES:
+    default:
+      g_assert_not_reached ();
+    }
+
+  return g_steal_pointer (&icon);
+}
+
+static void
+add_percentiles (JsonBuilder *builder,
+                 const char  *name,
+                 int64_t     *samples,
+                 size_t       n_samples)
+{
+  qsort (samples, n_samples, sizeof (int64_t), compare_int64);
+
+  json_builder_set_member_name (builder, name);
+  json_builder_begin_object (builder);
+  json_builder_set_member_name (builder, "p50");
+  json_builder_add_int_value (builder, get_percentile (samples, n_samples, 50));
+  json_builder_set_member_name (builder, "p99");
+  json_builder_add_int_value (builder, get_percentile (samples, n_samples, 99));
+  json_builder_set_member_name (builder, "max");
+  json_builder_add_int_value (builder, samples[n_samples - 1]);
+  json_builder_end_object (builder);
+}
+
+static gboolean
+run_benchmark (BsStreamDeck  *stream_deck,
+               IconMix        icon_mix,
+               GFile         *image_file,
+               JsonBuilder   *builder,
+               GError       **error)
+{
+  g_autofree int64_t *samples = NULL;
+  g_autoptr (GByteArray) output = NULL;
+  g_autoptr (BsIcon) icon = NULL;
+  BsStreamDeckStats stats_before;
+  BsStreamDeckStats stats_after;
+  BsDeviceRegion *region;
+  BsRenderer *renderer;
+  GListModel *buttons;
+  unsigned int n_buttons;
+  int64_t elapsed;
+  int64_t start;
+  double seconds;
+
+  region = bs_stream_deck_get_region (stream_deck, "main-button-grid");
+  renderer = bs_device_region_get_renderer (region);
+  buttons = bs_button_grid_region_get_buttons (BS_BUTTON_GRID_REGION (region));
+  n_buttons = g_list_model_get_n_items (buttons);
+
+  icon = create_icon (icon_mix, image_file, error);
+  if (!icon)
+    return FALSE;
+
+  output = g_byte_array_new ();
+
+  /* One row of samples per stage */
+  samples = g_new0 (int64_t, N_STAGES * iterations);
+  elapsed = 0;
+
+  for (int i = -N_WARMUP_ITERATIONS; i < iterations; i++)
+    {
+      g_autoptr (GskRenderNode) node = NULL;
+      g_autoptr (BsButton) button = NULL;
+      int64_t timestamps[N_STAGES];
+
+      button = g_list_model_get_item (buttons, (unsigned int) ABS (i) % n_buttons);
+
+      if (i == 0)
+        bs_stream_deck_get_stats (stream_deck, &stats_before);
+
+      start = g_get_monotonic_time ();
+
+      node = bs_renderer_snapshot_icon (renderer, icon);
+      timestamps[STAGE_COMPOSE] = g_get_monotonic_time ();
+
+      g_byte_array_set_size (output, 0);
+      if (!bs_renderer_render_node (renderer, node, output, error))
+        return FALSE;
+      timestamps[STAGE_ENCODE] = g_get_monotonic_time ();
+
+      if (!bs_stream_deck_write_button_image (stream_deck, button, output->data, output->len, error))
+        return FALSE;
+      timestamps[STAGE_WRITE] = g_get_monotonic_time ();
+
+      if (i < 0)
+        continue;
+
+      samples[STAGE_COMPOSE * iterations + i] = timestamps[STAGE_COMPOSE] - start;
+      samples[STAGE_ENCODE * iterations + i] = timestamps[STAGE_ENCODE] - timestamps[STAGE_COMPOSE];
+      samples[STAGE_WRITE * iterations + i] = timestamps[STAGE_WRITE] - timestamps[STAGE_ENCODE];
+      samples[STAGE_TOTAL * iterations + i] = timestamps[STAGE_WRITE] - start;
+
+      elapsed += timestamps[STAGE_WRITE] - start;
+    }
+
+  bs_stream_deck_get_stats (stream_deck, &stats_after);
+
+  seconds = MAX (elapsed, 1) / (double) G_USEC_PER_SEC;
+
+  json_builder_begin_object (builder);
+
+  json_builder_set_member_name (builder, "model");
+  json_builder_add_string_value (builder, bs_stream_deck_get_name (stream_deck));
+
+  json_builder_set_member_name (builder, "icon");
+  json_builder_add_string_value (builder, icon_mix_names[icon_mix]);
+
+  json_builder_set_member_name (builder, "iterations");
+  json_builder_add_int_value (builder, iterations);
+
+  json_builder_set_member_name (builder, "keys_per_second");
+  json_builder_add_double_value (builder, iterations / seconds);
+
+  json_builder_set_member_name (builder, "bytes_per_second");
+  json_builder_add_double_value (builder, (stats_after.n_bytes_written - stats_before.n_bytes_written) / seconds);
+
+  json_builder_set_member_name (builder, "latency_us");
+  json_builder_begin_object (builder);
+  for (size_t i = 0; i < N_STAGES; i++)
+    add_percentiles (builder, stage_names[i], samples + i * iterations, iterations);
+  json_builder_end_object (builder);
+
+  json_builder_end_object (builder);
+
+  return TRUE;
+}
+
+static gboolean
+run_benchmarks (JsonBuilder  *builder,
+                GFile        *image_file,
+                GError      **error)
+{
+  json_builder_begin_array (builder);
+
+  for (unsigned int model = 0; model < bs_stream_deck_get_n_models (); model++)
+    {
+      g_autoptr (BsHidTransport) transport = NULL;
+      g_autoptr (BsStreamDeck) stream_deck = NULL;
+
+      /* Skip models without displays, like the Pedal */
+      if (!bs_stream_deck_get_model_has_button_images (model))
+        continue;
+
+      transport = bs_hid_transport_new_null ();
+      stream_deck = bs_stream_deck_new_with_transport (transport,
+                                                       bs_stream_deck_get_model_product_id (model),
+                                                       error);
+      if (!stream_deck)
+        return FALSE;
+
+      for (IconMix icon_mix = 0; icon_mix < N_ICON_MIXES; icon_mix++)
+        {
+          /* Icon themes need a display */
+          if (icon_mix == ICON_MIX_SYMBOLIC_ICON && !has_display)
+            continue;
+
+          if (!run_benchmark (stream_deck, icon_mix, image_file, builder, error))
+            return FALSE;
+        }
+    }
+
+  json_builder_end_array (builder);
+
+  return TRUE;
+}
+
+static gboolean
+run_replay (const char   *path,
+            JsonBuilder  *builder,
+            GError      **error)
+{
+  g_autoptr (BsStreamDeck) stream_deck = NULL;
+  g_autoptr (BsHidTransport) replay = NULL;
+  g_autoptr (GMainLoop) main_loop = NULL;
+  g_autoptr (GFile) file = NULL;
+  BsStreamDeckStats stats;
+  int64_t start_time;
+  int64_t duration;
+
+  file = g_file_new_for_commandline_arg (path);
+  replay = bs_hid_replay_new (file, error);
+  if (!replay)
+    return FALSE;
+
+  stream_deck = bs_stream_deck_new_with_transport (replay,
+                                                   bs_hid_replay_get_product_id (BS_HID_REPLAY (replay)),
+                                                   error);
+  if (!stream_deck)
+    return FALSE;
+
+  main_loop = g_main_loop_new (NULL, FALSE);
+  g_signal_connect_swapped (replay, "finished", G_CALLBACK (g_main_loop_quit), main_loop);
+
+  start_time = g_get_monotonic_time ();
+
+  bs_stream_deck_load (stream_deck);
+  if (!bs_hid_replay_is_finished (BS_HID_REPLAY (replay)))
+    g_main_loop_run (main_loop);
+
+  duration = g_get_monotonic_time () - start_time;
+
+  bs_stream_deck_get_stats (stream_deck, &stats);
+
+  json_builder_begin_object (builder);
+
+  json_builder_set_member_name (builder, "recording");
+  json_builder_add_string_value (builder, path);
+
+  json_builder_set_member_name (builder, "model");
+  json_builder_add_string_value (builder, bs_stream_deck_get_name (stream_deck));
+
+  json_builder_set_member_name (builder, "duration_us");
+  json_builder_add_int_value (builder, duration);
+
+  json_builder_set_member_name (builder, "input_reports");
+  json_builder_add_int_value (builder, stats.n_input_reports);
+
+  json_builder_set_member_name (builder, "input_latency_us");
+  json_builder_begin_object (builder);
+  json_builder_set_member_name (builder, "mean");
+  json_builder_add_int_value (builder, stats.n_input_reports > 0 ? stats.total_input_latency_us / stats.n_input_reports : 0);
+  json_builder_set_member_name (builder, "max");
+  json_builder_add_int_value (builder, stats.max_input_latency_us);
+  json_builder_end_object (builder);
+
+  json_builder_end_object (builder);
+
+  return TRUE;
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  g_autoptr (GOptionContext) context = NULL;
+  g_autoptr (JsonGenerator) generator = NULL;
+  g_autoptr (JsonBuilder) builder = NULL;
+  g_autoptr (JsonNode) root = NULL;
+  g_autoptr (GSettings) settings = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autoptr (GFile) image_file = NULL;
+  g_autofree char *json = NULL;
+  g_autofree char *tmpdir = NULL;
+  int status = EXIT_SUCCESS;
+
+  context = g_option_context_new ("- benchmark the key image pipeline");
+  g_option_context_add_main_entries (context, options, NULL);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return EXIT_FAILURE;
+    }
+
+  if (iterations <= 0)
+    {
+      g_printerr ("Number of iterations must be positive\n");
+      return EXIT_FAILURE;
+    }
+
+  /* Never touch real settings, and measure the pipeline without the upload budget */
+  g_setenv ("GSETTINGS_BACKEND", "memory", TRUE);
+  settings = g_settings_new ("com.feaneron.Boatswain");
+  g_settings_set_uint (settings, "upload-frame-rate", 0);
+  g_settings_set_uint (settings, "upload-byte-rate", 0);
+
+  has_display = gtk_init_check ();
+  if (!has_display)
+    g_message ("No display available, skipping symbolic icons");
+
+  tmpdir = g_dir_make_tmp ("boatswain-bench-XXXXXX", &error);
+  if (!tmpdir || !(image_file = create_image_file (tmpdir, &error)))
+    {
+      g_printerr ("%s\n", error->message);
+      return EXIT_FAILURE;
+    }
+
+  builder = json_builder_new ();
+  json_builder_begin_object (builder);
+
+  json_builder_set_member_name (builder, "benchmark");
+  json_builder_add_string_value (builder, "key-image-pipeline");
+
+  json_builder_set_member_name (builder, "results");
+  if (!run_benchmarks (builder, image_file, &error))
+    {
+      g_printerr ("Benchmark failed: %s\n", error->message);
+      status = EXIT_FAILURE;
+      goto out;
+    }
+
+  if (replay_paths)
+    {
+      json_builder_set_member_name (builder, "replays");
+      json_builder_begin_array (builder);
+
+      for (size_t i = 0; replay_paths[i]; i++)
+        {
+          if (!run_replay (replay_paths[i], builder, &error))
+            {
+              g_printerr ("Replay of %s failed: %s\n", replay_paths[i], error->message);
+              status = EXIT_FAILURE;
+              goto out;
+            }
+        }
+
+      json_builder_end_array (builder);
+    }
+
+  json_builder_end_object (builder);
+
+  root = json_builder_get_root (builder);
+  generator = json_generator_new ();
+  json_generator_set_pretty (generator, TRUE);
+  json_generator_set_root (generator, root);
+
+  if (output_path)
+    {
+      if (!json_generator_to_file (generator, output_path, &error))
+        {
+          g_printerr ("Failed to write %s: %s\n", output_path, error->message);
+          status = EXIT_FAILURE;
+        }
+    }
+  else
+    {
+      json = json_generator_to_data (generator, NULL);
+      g_print ("%s\n", json);
+    }
+
+out:
+  g_file_delete (image_file, NULL, NULL);
+  g_rmdir (tmpdir);
+
+  return status;
+}
@@ -0,0 +1,404 @@
+/* bs-animation.c
+ *
+ * Copyright 2022 Georges Basile Stavracas Neto <georges.stavracas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define G_LOG_DOMAIN "Animation"
+
+#include "bs-animation.h"
+
+#include <math.h>
+#include <string.h>
+
+#define MAX_FRAMES 128
+#define MIN_FRAME_DURATION_MS 20
+#define DEFAULT_FRAME_DURATION_MS 100
+
+/*
+ * A finite animation, fully decoded into frames scaled down to key size,
+ * with the duration of each frame.
+ *
+ * GdkPixbuf does not tell how many frames a looping animation has, so two
+ * loops are decoded, and the loop is the shortest sequence of frames that
+ * then repeats. Animations longer than MAX_FRAMES are rejected, and should
+ * be streamed instead.
+ */
+
+typedef struct
+{
+  GdkPixbuf *pixbuf;
+  unsigned int duration;
+} DecodedFrame;
+
+struct _BsAnimation
+{
+  GObject parent_instance;
+
+  GPtrArray *frames; /* GdkTexture */
+  GArray *durations; /* unsigned int, in milliseconds */
+};
+
+G_DEFINE_FINAL_TYPE (BsAnimation, bs_animation, G_TYPE_OBJECT)
+
+typedef struct
+{
+  GFile *file;
+  int size;
+} LoadData;
+
+
+/*
+ * Auxiliary methods
+ */
+
+static void
+load_data_free (gpointer data)
+{
+  LoadData *load_data = data;
+
+  g_clear_object (&load_data->file);
+  g_free (load_data);
+}
+
+static void
+decoded_frame_clear (gpointer data)
+{
+  DecodedFrame *frame = data;
+
+  g_clear_object (&frame->pixbuf);
+}
+
+static GdkPixbuf *
+scale_frame (GdkPixbuf *pixbuf,
+             int        size)
+{
+  double scale;
+  int height;
+  int width;
+
+  width = gdk_pixbuf_get_width (pixbuf);
+  height = gdk_pixbuf_get_height (pixbuf);
+
+  /* Frames are owned by the iterator, and change when it advances */
+  if (width <= size && height <= size)
+    return gdk_pixbuf_copy (pixbuf);
+
+  scale = MIN ((double) size / width, (double) size / height);
+
+  return gdk_pixbuf_scale_simple (pixbuf,
+                                  MAX (1, (int) round (width * scale)),
+                                  MAX (1, (int) round (height * scale)),
+                                  GDK_INTERP_BILINEAR);
+}
+
+static gboolean
+frames_equal (const DecodedFrame *a,
+              const DecodedFrame *b)
+{
+  size_t length;
+
+  if (a->duration != b->duration)
+    return FALSE;
+
+  length = gdk_pixbuf_get_byte_length (a->pixbuf);
+
+  return length == gdk_pixbuf_get_byte_length (b->pixbuf) &&
+         gdk_pixbuf_get_rowstride (a->pixbuf) == gdk_pixbuf_get_rowstride (b->pixbuf) &&
+         memcmp (gdk_pixbuf_read_pixels (a->pixbuf), gdk_pixbuf_read_pixels (b->pixbuf), length) == 0;
+}
+
+/*
+ * Returns the length of the shortest loop that repeats until the end of
+ * @frames, if it repeats at least once, or 0.
+ */
+static unsigned int
+find_loop_length (GArray *frames)
+{
+  for (unsigned int length = 1; length <= frames->len / 2; length++)
+    {
+      gboolean repeats = TRUE;
+
+      for (unsigned int i = 0; repeats && i + length < frames->len; i++)
+        {
+          repeats = frames_equal (&g_array_index (frames, DecodedFrame, i),
+                                  &g_array_index (frames, DecodedFrame, i + length));
+        }
+
+      if (repeats)
+        return length;
+    }
+
+  return 0;
+}
+
+/*
+ * Decodes @pixbuf_animation until the shortest candidate loop repeated
+ * once, i.e. two loops were decoded, or until 2 * MAX_FRAMES frames when
+ * no loop is short enough. Returns whether the animation ended by itself,
+ * instead of looping.
+ */
+static gboolean
+decode_frames (GdkPixbufAnimation *pixbuf_animation,
+               int                 size,
+               GArray             *frames,
+               GCancellable       *cancellable)
+{
+  g_autoptr (GdkPixbufAnimationIter) iter = NULL;
+  gboolean broken_loops[MAX_FRAMES + 1] = { FALSE, };
+  GTimeVal time = { 0, 0 };
+
+  G_GNUC_BEGIN_IGNORE_DEPRECATIONS
+  iter = gdk_pixbuf_animation_get_iter (pixbuf_animation, &time);
+  G_GNUC_END_IGNORE_DEPRECATIONS
+
+  while (frames->len < 2 * MAX_FRAMES && !g_cancellable_is_cancelled (cancellable))
+    {
+      DecodedFrame frame;
+      int delay;
+
+      delay = gdk_pixbuf_animation_iter_get_delay_time (iter);
+
+      frame.pixbuf = scale_frame (gdk_pixbuf_animation_iter_get_pixbuf (iter), size);
+      frame.duration = delay < 0 ? DEFAULT_FRAME_DURATION_MS : MAX (delay, MIN_FRAME_DURATION_MS);
+      g_array_append_val (frames, frame);
+
+      if (delay < 0)
+        return TRUE;
+
+      /* Each frame rules out the loop lengths it doesn't repeat */
+      for (unsigned int length = 1; length <= MIN (frames->len - 1, MAX_FRAMES); length++)
+        {
+          if (broken_loops[length])
+            continue;
+
+          broken_loops[length] = !frames_equal (&g_array_index (frames, DecodedFrame, frames->len - 1),
+                                                &g_array_index (frames, DecodedFrame, frames->len - 1 - length));
+
+          /* Shorter lengths are broken, or would have repeated already */
+          if (!broken_loops[length] && frames->len == 2 * length)
+            return FALSE;
+        }
+
+      G_GNUC_BEGIN_IGNORE_DEPRECATIONS
+      g_time_val_add (&time, (glong) delay * 1000);
+      gdk_pixbuf_animation_iter_advance (iter, &time);
+      G_GNUC_END_IGNORE_DEPRECATIONS
+    }
+
+  return FALSE;
+}
+
+static void
+load_animation_in_thread_cb (GTask        *task,
+                             gpointer      source_object,
+                             gpointer      task_data,
+                             GCancellable *cancellable)
+{
+  g_autoptr (GdkPixbufAnimation) pixbuf_animation = NULL;
+  g_autoptr (GFileInputStream) stream = NULL;
+  g_autoptr (BsAnimation) animation = NULL;
+  g_autoptr (GArray) frames = NULL;
+  g_autoptr (GError) error = NULL;
+  LoadData *load_data;
+  unsigned int n_frames;
+  gboolean ended;
+
+  load_data = task_data;
+
+  stream = g_file_read (load_data->file, cancellable, &error);
+  if (!stream)
+    {
+      g_task_return_error (task, g_steal_pointer (&error));
+      return;
+    }
+
+  pixbuf_animation = gdk_pixbuf_animation_new_from_stream (G_INPUT_STREAM (stream), cancellable, &error);
+  if (!pixbuf_animation)
+    {
+      g_task_return_error (task, g_steal_pointer (&error));
+      return;
+    }
+
+  frames = g_array_new (FALSE, FALSE, sizeof (DecodedFrame));
+  g_array_set_clear_func (frames, decoded_frame_clear);
+
+  ended = decode_frames (pixbuf_animation, load_data->size, frames, cancellable);
+
+  if (g_task_return_error_if_cancelled (task))
+    return;
+
+  /* Animations that end are played in a loop anyway */
+  n_frames = find_loop_length (frames);
+  if (n_frames == 0 && ended)
+    n_frames = frames->len;
+
+  if (n_frames == 0 || n_frames > MAX_FRAMES)
+    {
+      g_task_return_new_error (task,
+                               G_IO_ERROR,
+                               G_IO_ERROR_NOT_SUPPORTED,
+                               "Animation is longer than %u frames",
+                               MAX_FRAMES);
+      return;
+    }
+
+  animation = g_object_new (BS_TYPE_ANIMATION, NULL);
+
+  for (unsigned int i = 0; i < n_frames; i++)
+    {
+      DecodedFrame *frame = &g_array_index (frames, DecodedFrame, i);
+
+      G_GNUC_BEGIN_IGNORE_DEPRECATIONS
+      g_ptr_array_add (animation->frames, gdk_texture_new_for_pixbuf (frame->pixbuf));
+      G_GNUC_END_IGNORE_DEPRECATIONS
+
+      g_array_append_val (animation->durations, frame->duration);
+    }
+
+  g_task_return_pointer (task, g_steal_pointer (&animation), g_object_unref);
+}
+
+
+/*
+ * GObject overrides
+ */
+
+static void
+bs_animation_finalize (GObject *object)
+{
+  BsAnimation *self = (BsAnimation *)object;
+
+  g_clear_pointer (&self->frames, g_ptr_array_unref);
+  g_clear_pointer (&self->durations, g_array_unref);
+
+  G_OBJECT_CLASS (bs_animation_parent_class)->finalize (object);
+}
+
+static void
+bs_animation_class_init (BsAnimationClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = bs_animation_finalize;
+}
+
+static void
+bs_animation_init (BsAnimation *self)
+{
+  self->frames = g_ptr_array_new_with_free_func (g_object_unref);
+  self->durations = g_array_new (FALSE, FALSE, sizeof (unsigned int));
+}
+
+
+/*
+ * Public API
+ */
+
+/**
+ * bs_animation_load_async:
+ * @file: a #GFile with an animated image
+ * @size: the largest width and height of frames, in pixels
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: callback to call when the animation is loaded
+ * @user_data: data to pass to @callback
+ *
+ * Decodes all frames of the animation in @file in a thread, scaled down
+ * to fit @size while keeping their aspect ratio. Fails with
+ * %G_IO_ERROR_NOT_SUPPORTED if the animation is too long to be kept in
+ * memory.
+ */
+void
+bs_animation_load_async (GFile               *file,
+                         int                  size,
+                         GCancellable        *cancellable,
+                         GAsyncReadyCallback  callback,
+                         gpointer             user_data)
+{
+  g_autoptr (GTask) task = NULL;
+  LoadData *load_data;
+
+  g_return_if_fail (G_IS_FILE (file));
+  g_return_if_fail (size > 0);
+  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  load_data = g_new0 (LoadData, 1);
+  load_data->file = g_object_ref (file);
+  load_data->size = size;
+
+  task = g_task_new (NULL, cancellable, callback, user_data);
+  g_task_set_static_name (task, "bs_animation_load_async");
+  g_task_set_source_tag (task, bs_animation_load_async);
+  g_task_set_task_data (task, load_data, load_data_free);
+  g_task_run_in_thread (task, load_animation_in_thread_cb);
+}
+
+/**
+ * bs_animation_load_finish:
+ * @result: a #GAsyncResult
+ * @error: (nullable): return location for a #GError
+ *
+ * Finishes an operation started with bs_animation_load_async().
+ *
+ * Returns: (transfer full) (nullable): a #BsAnimation, or %NULL
+ */
+BsAnimation *
+bs_animation_load_finish (GAsyncResult  *result,
+                          GError       **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+  g_return_val_if_fail (g_task_get_source_tag (G_TASK (result)) == bs_animation_load_async, NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+unsigned int
+bs_animation_get_n_frames (BsAnimation *self)
+{
+  g_return_val_if_fail (BS_IS_ANIMATION (self), 0);
+
+  return self->frames->len;
+}
+
+GdkTexture *
+bs_animation_get_frame (BsAnimation  *self,
+                        unsigned int  frame)
+{
+  g_return_val_if_fail (BS_IS_ANIMATION (self), NULL);
+  g_return_val_if_fail (frame < self->frames->len, NULL);
+
+  return g_ptr_array_index (self->frames, frame);
+}
+
+/**
+ * bs_animation_get_frame_duration:
+ * @self: a #BsAnimation
+ * @frame: index of the frame
+ *
+ * Retrieves how long @frame is shown before the next one.
+ *
+ * Returns: the duration of @frame, in milliseconds
+ */
+unsigned int
+bs_animation_get_frame_duration (BsAnimation  *self,
+                                 unsigned int  frame)
+{
+  g_return_val_if_fail (BS_IS_ANIMATION (self), 0);
+  g_return_val_if_fail (frame < self->durations->len, 0);
+
+  return g_array_index (self->durations, unsigned int, frame);
+}
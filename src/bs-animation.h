@@ -0,0 +1,47 @@
+/* bs-animation.h
+ *
+ * Copyright 2022 Georges Basile Stavracas Neto <georges.stavracas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+#define BS_TYPE_ANIMATION (bs_animation_get_type())
+G_DECLARE_FINAL_TYPE (BsAnimation, bs_animation, BS, ANIMATION, GObject)
+
+void bs_animation_load_async (GFile               *file,
+                              int                  size,
+                              GCancellable        *cancellable,
+                              GAsyncReadyCallback  callback,
+                              gpointer             user_data);
+
+BsAnimation * bs_animation_load_finish (GAsyncResult  *result,
+                                        GError       **error);
+
+unsigned int bs_animation_get_n_frames (BsAnimation *self);
+
+GdkTexture * bs_animation_get_frame (BsAnimation  *self,
+                                     unsigned int  frame);
+
+unsigned int bs_animation_get_frame_duration (BsAnimation  *self,
+                                              unsigned int  frame);
+
+G_END_DECLS
@@ -19,9 +19,11 @@
 #include "bs-action-factory.h"
 #include "bs-application.h"
 #include "bs-config.h"
+#include "bs-debug.h"
 #include "bs-desktop-controller-private.h"
 #include "bs-device-manager.h"
 #include "bs-log.h"
+#include "bs-stream-deck-private.h"
 #include "bs-window.h"
 
 #include <glib/gi18n.h>
@@ -39,6 +41,8 @@ struct _BsApplication
   BsDeviceManager *device_manager;
   XdpPortal *portal;
   BsDesktopController *desktop_controller;
+
+  guint metrics_registration_id;
 };
 
 static void on_request_background_called_cb (GObject      *object,
@@ -47,6 +51,20 @@ static void on_request_background_called_cb (GObject      *object,
 
 G_DEFINE_TYPE (BsApplication, bs_application, ADW_TYPE_APPLICATION)
 
+/*
+ * Histograms count durations in power-of-two buckets, whose upper limits,
+ * in microseconds, are in HistogramBucketLimits.
+ */
+static const char metrics_introspection_xml[] =
+  "<node>"
+  "  <interface name='com.feaneron.Boatswain.Metrics'>"
+  "    <method name='GetMetrics'>"
+  "      <arg type='aa{sv}' name='devices' direction='out'/>"
+  "    </method>"
+  "    <property type='at' name='HistogramBucketLimits' access='read'/>"
+  "  </interface>"
+  "</node>";
+
 static GOptionEntry bs_application_options[] = {
   {
     "debug", 0, 0,
@@ -82,6 +100,150 @@ load_plugin (PeasEngine     *engine,
   gtk_icon_theme_add_resource_path (icon_theme, icons_dir);
 }
 
+#ifdef BS_ENABLE_TRACE
+static void
+dump_trace (void)
+{
+  g_autoptr (GError) error = NULL;
+  g_autofree char *path = NULL;
+
+  path = bs_trace_get_default_path ();
+
+  if (bs_trace_dump (path, &error))
+    g_message ("Trace written to %s", path);
+  else
+    g_warning ("Error writing trace: %s", error->message);
+}
+#endif
+
+
+/*
+ * Metrics
+ */
+
+static inline void
+add_histogram (GVariantBuilder *builder,
+               const char      *key,
+               const uint64_t  *histogram)
+{
+  g_variant_builder_add (builder,
+                         "{sv}",
+                         key,
+                         g_variant_new_fixed_array (G_VARIANT_TYPE_UINT64,
+                                                    histogram,
+                                                    BS_STREAM_DECK_N_HISTOGRAM_BUCKETS,
+                                                    sizeof (uint64_t)));
+}
+
+static GVariant *
+create_stream_deck_metrics (BsStreamDeck *stream_deck)
+{
+  GVariantBuilder frame_rates;
+  GVariantBuilder builder;
+  BsStreamDeckStats stats;
+
+  bs_stream_deck_get_stats (stream_deck, &stats);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+
+  g_variant_builder_add (&builder, "{sv}", "serial-number",
+                         g_variant_new_string (bs_stream_deck_get_serial_number (stream_deck) ?: ""));
+  g_variant_builder_add (&builder, "{sv}", "model",
+                         g_variant_new_string (bs_stream_deck_get_name (stream_deck)));
+
+  /* Uploads */
+  g_variant_builder_add (&builder, "{sv}", "uploads", g_variant_new_uint64 (stats.n_uploads));
+  g_variant_builder_add (&builder, "{sv}", "failed-uploads", g_variant_new_uint64 (stats.n_failed_uploads));
+  g_variant_builder_add (&builder, "{sv}", "dropped-frames", g_variant_new_uint64 (stats.n_dropped_uploads));
+  g_variant_builder_add (&builder, "{sv}", "unchanged-images", g_variant_new_uint64 (stats.n_unchanged_images));
+  g_variant_builder_add (&builder, "{sv}", "cached-animation-frames", g_variant_new_uint64 (stats.n_cached_animation_frames));
+  g_variant_builder_add (&builder, "{sv}", "queue-depth", g_variant_new_uint32 (stats.queue_depth));
+  g_variant_builder_add (&builder, "{sv}", "max-queue-depth", g_variant_new_uint32 (stats.max_queue_depth));
+  g_variant_builder_add (&builder, "{sv}", "encode-time-us", g_variant_new_uint64 (stats.total_encode_time_us));
+  add_histogram (&builder, "encode-time-histogram", stats.encode_time_histogram);
+
+  /* Upload budget */
+  g_variant_builder_add (&builder, "{sv}", "deferred-uploads", g_variant_new_uint64 (stats.n_deferred_uploads));
+  g_variant_builder_add (&builder, "{sv}", "priority-uploads", g_variant_new_uint64 (stats.n_priority_uploads));
+
+  g_variant_builder_init (&frame_rates, G_VARIANT_TYPE ("ad"));
+  for (size_t i = 0; i < bs_stream_deck_get_n_keys (stream_deck); i++)
+    g_variant_builder_add (&frame_rates, "d", bs_stream_deck_get_key_frame_rate (stream_deck, i));
+  g_variant_builder_add (&builder, "{sv}", "key-frame-rates", g_variant_builder_end (&frame_rates));
+
+  /* I/O */
+  g_variant_builder_add (&builder, "{sv}", "bytes-written", g_variant_new_uint64 (stats.n_bytes_written));
+  g_variant_builder_add (&builder, "{sv}", "io-request-waits", g_variant_new_uint64 (stats.n_io_request_waits));
+
+  /* Input */
+  g_variant_builder_add (&builder, "{sv}", "input-reports", g_variant_new_uint64 (stats.n_input_reports));
+  g_variant_builder_add (&builder, "{sv}", "max-input-latency-us", g_variant_new_uint64 (stats.max_input_latency_us));
+  add_histogram (&builder, "input-latency-histogram", stats.input_latency_histogram);
+
+  /* Profiles */
+  g_variant_builder_add (&builder, "{sv}", "profile-saves", g_variant_new_uint64 (stats.n_profile_saves));
+  g_variant_builder_add (&builder, "{sv}", "last-profile-save-us", g_variant_new_uint64 (stats.last_profile_save_us));
+  g_variant_builder_add (&builder, "{sv}", "max-profile-save-us", g_variant_new_uint64 (stats.max_profile_save_us));
+
+  return g_variant_builder_end (&builder);
+}
+
+static void
+handle_metrics_method_call (GDBusConnection       *connection,
+                            const char            *sender,
+                            const char            *object_path,
+                            const char            *interface_name,
+                            const char            *method_name,
+                            GVariant              *parameters,
+                            GDBusMethodInvocation *invocation,
+                            gpointer               user_data)
+{
+  BsApplication *self = BS_APPLICATION (user_data);
+  GVariantBuilder builder;
+
+  g_assert (g_strcmp0 (method_name, "GetMetrics") == 0);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("aa{sv}"));
+
+  for (unsigned int i = 0; self->device_manager && i < g_list_model_get_n_items (G_LIST_MODEL (self->device_manager)); i++)
+    {
+      g_autoptr (BsStreamDeck) stream_deck = NULL;
+
+      stream_deck = g_list_model_get_item (G_LIST_MODEL (self->device_manager), i);
+      g_variant_builder_add_value (&builder, create_stream_deck_metrics (stream_deck));
+    }
+
+  g_dbus_method_invocation_return_value (invocation, g_variant_new ("(aa{sv})", &builder));
+}
+
+static GVariant *
+handle_metrics_get_property (GDBusConnection  *connection,
+                             const char       *sender,
+                             const char       *object_path,
+                             const char       *interface_name,
+                             const char       *property_name,
+                             GError          **error,
+                             gpointer          user_data)
+{
+  uint64_t limits[BS_STREAM_DECK_N_HISTOGRAM_BUCKETS];
+
+  g_assert (g_strcmp0 (property_name, "HistogramBucketLimits") == 0);
+
+  for (size_t i = 0; i < BS_STREAM_DECK_N_HISTOGRAM_BUCKETS - 1; i++)
+    limits[i] = G_GUINT64_CONSTANT (1) << i;
+  limits[BS_STREAM_DECK_N_HISTOGRAM_BUCKETS - 1] = G_MAXUINT64;
+
+  return g_variant_new_fixed_array (G_VARIANT_TYPE_UINT64,
+                                    limits,
+                                    BS_STREAM_DECK_N_HISTOGRAM_BUCKETS,
+                                    sizeof (uint64_t));
+}
+
+static const GDBusInterfaceVTable metrics_vtable = {
+  .method_call = handle_metrics_method_call,
+  .get_property = handle_metrics_get_property,
+};
+
 
 /*
  * Callbacks
@@ -133,6 +295,15 @@ on_unix_signal_cb (GApplication *application)
   return G_SOURCE_REMOVE;
 }
 
+#ifdef BS_ENABLE_TRACE
+static gboolean
+on_dump_trace_signal_cb (gpointer user_data)
+{
+  dump_trace ();
+  return G_SOURCE_CONTINUE;
+}
+#endif
+
 static void
 on_request_background_called_cb (GObject      *object,
                                  GAsyncResult *result,
@@ -258,9 +429,70 @@ bs_application_shutdown (GApplication *application)
   g_clear_object (&self->device_manager);
   g_clear_object (&self->portal);
 
+#ifdef BS_ENABLE_TRACE
+  dump_trace ();
+#endif
+
   G_APPLICATION_CLASS (bs_application_parent_class)->shutdown (application);
 }
 
+/*
+ * Metrics are exported next to the application itself, e.g.:
+ *
+ *   gdbus call --session --dest com.feaneron.Boatswain \
+ *              --object-path /com/feaneron/Boatswain \
+ *              --method com.feaneron.Boatswain.Metrics.GetMetrics
+ */
+static gboolean
+bs_application_dbus_register (GApplication     *application,
+                              GDBusConnection  *connection,
+                              const char       *object_path,
+                              GError          **error)
+{
+  BsApplication *self = BS_APPLICATION (application);
+  g_autoptr (GDBusNodeInfo) node_info = NULL;
+
+  if (!G_APPLICATION_CLASS (bs_application_parent_class)->dbus_register (application,
+                                                                         connection,
+                                                                         object_path,
+                                                                         error))
+    {
+      return FALSE;
+    }
+
+  node_info = g_dbus_node_info_new_for_xml (metrics_introspection_xml, error);
+  if (!node_info)
+    return FALSE;
+
+  self->metrics_registration_id = g_dbus_connection_register_object (connection,
+                                                                     object_path,
+                                                                     node_info->interfaces[0],
+                                                                     &metrics_vtable,
+                                                                     self,
+                                                                     NULL,
+                                                                     error);
+
+  return self->metrics_registration_id != 0;
+}
+
+static void
+bs_application_dbus_unregister (GApplication    *application,
+                                GDBusConnection *connection,
+                                const char      *object_path)
+{
+  BsApplication *self = BS_APPLICATION (application);
+
+  if (self->metrics_registration_id != 0)
+    {
+      g_dbus_connection_unregister_object (connection, self->metrics_registration_id);
+      self->metrics_registration_id = 0;
+    }
+
+  G_APPLICATION_CLASS (bs_application_parent_class)->dbus_unregister (application,
+                                                                      connection,
+                                                                      object_path);
+}
+
 static gint
 bs_application_handle_local_options (GApplication *app,
                                      GVariantDict *options)
@@ -298,6 +530,8 @@ bs_application_class_init (BsApplicationClass *klass)
   app_class->startup = bs_application_startup;
   app_class->activate = bs_application_activate;
   app_class->shutdown = bs_application_shutdown;
+  app_class->dbus_register = bs_application_dbus_register;
+  app_class->dbus_unregister = bs_application_dbus_unregister;
   app_class->handle_local_options = bs_application_handle_local_options;
 }
 
@@ -321,7 +555,11 @@ bs_application_init (BsApplication *self)
   g_unix_signal_add (SIGINT, (GSourceFunc) on_unix_signal_cb, self);
   g_unix_signal_add (SIGTERM, (GSourceFunc) on_unix_signal_cb, self);
   g_unix_signal_add (SIGUSR1, (GSourceFunc) on_unix_signal_cb, self);
+#ifdef BS_ENABLE_TRACE
+  g_unix_signal_add (SIGUSR2, on_dump_trace_signal_cb, NULL);
+#else
   g_unix_signal_add (SIGUSR2, (GSourceFunc) on_unix_signal_cb, self);
+#endif
 }
 
 BsApplication *
@@ -364,13 +364,7 @@ on_file_dialog_file_opened_cb (GObject      *source,
   else
     g_object_ref (icon);
 
-  bs_icon_set_file (icon, file, &error);
-  if (error)
-    {
-      g_warning ("Error setting custom icon: %s", error->message);
-      return;
-    }
-
+  bs_icon_set_file (icon, file);
   bs_button_set_custom_icon (self->button, icon);
 }
 
@@ -454,7 +448,7 @@ on_icons_gridview_activate_cb (GtkGridView    *grid_view,
   else
     g_object_ref (custom_icon);
 
-  bs_icon_set_file (custom_icon, NULL, NULL);
+  bs_icon_set_file (custom_icon, NULL);
   bs_icon_set_paintable (custom_icon, NULL);
   bs_icon_set_icon_name (custom_icon, gtk_string_object_get_string (string_object));
   bs_button_set_custom_icon (self->button, custom_icon);
@@ -21,6 +21,7 @@
 #include "bs-action.h"
 #include "bs-icon.h"
 #include "bs-page.h"
+#include "bs-profiler.h"
 #include "bs-stream-deck-private.h"
 #include "bs-button-private.h"
 
@@ -100,15 +101,10 @@ update_relative_icon (BsButton *self)
 static void
 upload_icon (BsButton *self)
 {
-  g_autoptr (GError) error = NULL;
-
   if (!bs_stream_deck_is_initialized (self->stream_deck))
     return;
 
-  bs_stream_deck_upload_button (self->stream_deck, self, &error);
-
-  if (error)
-    g_warning ("Error updating Stream Deck button icon: %s", error->message);
+  bs_stream_deck_queue_button_upload (self->stream_deck, self);
 }
 
 static void
@@ -341,10 +337,19 @@ bs_button_set_pressed (BsButton *self,
 
   if (self->action)
     {
+      int64_t begin = BS_PROFILER_CURRENT_TIME;
+
       if (pressed)
         bs_action_activate (self->action);
       else
         bs_action_deactivate (self->action);
+
+      BS_PROFILER_ADD_MARK (begin,
+                            pressed ? "Action activate" : "Action deactivate",
+                            "serial=%s key=%u action=%s",
+                            bs_stream_deck_get_serial_number (self->stream_deck),
+                            self->position,
+                            G_OBJECT_TYPE_NAME (self->action));
     }
 }
 
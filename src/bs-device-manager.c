@@ -26,6 +26,7 @@
 #include "bs-debug.h"
 #include "bs-device-enums.h"
 #include "bs-device-manager.h"
+#include "bs-hid-replay.h"
 #include "bs-stream-deck-private.h"
 
 struct _BsDeviceManager
@@ -34,6 +35,10 @@ struct _BsDeviceManager
 
   GUsbContext *gusb_context;
   GListStore *stream_decks;
+
+  /* Devices being opened, in the background */
+  GPtrArray *pending_devices;
+  GStrv replay_files;
   gboolean emulate_devices;
   gboolean loaded;
 };
@@ -87,35 +92,35 @@ enumerate_fake_stream_decks (BsDeviceManager *self)
 }
 
 static void
-enumerate_stream_decks (BsDeviceManager *self)
+enumerate_replayed_stream_decks (BsDeviceManager *self)
 {
-  g_autoptr (GPtrArray) devices = NULL;
-  unsigned int i;
-
-  g_usb_context_enumerate (self->gusb_context);
-
-  devices = g_usb_context_get_devices (self->gusb_context);
-  for (i = 0; devices && i < devices->len; i++)
+  for (size_t i = 0; self->replay_files[i]; i++)
     {
+      g_autoptr (BsHidTransport) replay = NULL;
       g_autoptr (BsStreamDeck) stream_deck = NULL;
       g_autoptr (GError) error = NULL;
-      GUsbDevice *usb_device;
+      g_autoptr (GFile) file = NULL;
 
-      usb_device = g_ptr_array_index (devices, i);
-      stream_deck = bs_stream_deck_new (usb_device, &error);
+      file = g_file_new_for_commandline_arg (self->replay_files[i]);
+      replay = bs_hid_replay_new (file, &error);
+
+      if (replay)
+        {
+          stream_deck = bs_stream_deck_new_with_transport (replay,
+                                                           bs_hid_replay_get_product_id (BS_HID_REPLAY (replay)),
+                                                           &error);
+        }
 
       if (error)
         {
-          if (!g_error_matches (error, BS_STREAM_DECK_ERROR, BS_STREAM_DECK_ERROR_UNRECOGNIZED))
-            g_warning ("Error opening Stream Deck device: %s", error->message);
+          g_warning ("Error replaying %s: %s", self->replay_files[i], error->message);
           continue;
         }
 
-      g_debug ("Found %s (%s) at bus %hu, port %hu",
+      g_debug ("Replaying %s as %s (%s)",
+               self->replay_files[i],
                bs_stream_deck_get_name (stream_deck),
-               bs_stream_deck_get_serial_number (stream_deck),
-               g_usb_device_get_bus (usb_device),
-               g_usb_device_get_port_number (usb_device));
+               bs_stream_deck_get_serial_number (stream_deck));
 
       bs_stream_deck_load (stream_deck);
 
@@ -124,36 +129,98 @@ enumerate_stream_decks (BsDeviceManager *self)
     }
 }
 
-
-/*
- * Callbacks
- */
-
 static void
-on_gusb_context_device_added_cb (GUsbContext     *gusb_context,
-                                 GUsbDevice      *device,
-                                 BsDeviceManager *self)
+on_stream_deck_created_cb (GObject      *source_object,
+                           GAsyncResult *result,
+                           gpointer      user_data)
 {
+  g_autoptr (BsDeviceManager) self = user_data;
   g_autoptr (BsStreamDeck) stream_deck = NULL;
   g_autoptr (GError) error = NULL;
+  GUsbDevice *usb_device;
 
   BS_ENTRY;
 
-  stream_deck = bs_stream_deck_new (device, &error);
+  stream_deck = bs_stream_deck_new_finish (result, &error);
+
+  /* The source object is the Stream Deck being initialized, even if it failed */
+  usb_device = bs_stream_deck_get_device (BS_STREAM_DECK (source_object));
 
   if (error)
     {
       if (!g_error_matches (error, BS_STREAM_DECK_ERROR, BS_STREAM_DECK_ERROR_UNRECOGNIZED))
         g_warning ("Error opening Stream Deck device: %s", error->message);
+      g_ptr_array_remove (self->pending_devices, usb_device);
       BS_RETURN ();
     }
 
-  g_list_store_append (self->stream_decks, g_object_ref (stream_deck));
+  /* Unplugged while it was being opened */
+  if (!g_ptr_array_remove (self->pending_devices, usb_device))
+    BS_RETURN ();
+
+  g_debug ("Found %s (%s) at bus %hu, port %hu",
+           bs_stream_deck_get_name (stream_deck),
+           bs_stream_deck_get_serial_number (stream_deck),
+           g_usb_device_get_bus (usb_device),
+           g_usb_device_get_port_number (usb_device));
+
+  bs_stream_deck_load (stream_deck);
+
+  g_list_store_append (self->stream_decks, stream_deck);
   g_signal_emit (self, signals[STREAM_DECK_ADDED], 0, stream_deck);
 
   BS_EXIT;
 }
 
+/*
+ * Devices are opened concurrently, and added as soon as each of them is
+ * ready, so that slow devices do not hold back the others, nor startup.
+ */
+static void
+open_stream_deck (BsDeviceManager *self,
+                  GUsbDevice      *usb_device)
+{
+  if (g_usb_device_get_vid (usb_device) != ELGATO_SYSTEMS_VENDOR_ID)
+    return;
+
+  g_ptr_array_add (self->pending_devices, g_object_ref (usb_device));
+
+  bs_stream_deck_new_async (usb_device,
+                            NULL,
+                            on_stream_deck_created_cb,
+                            g_object_ref (self));
+}
+
+static void
+enumerate_stream_decks (BsDeviceManager *self)
+{
+  g_autoptr (GPtrArray) devices = NULL;
+  unsigned int i;
+
+  g_usb_context_enumerate (self->gusb_context);
+
+  devices = g_usb_context_get_devices (self->gusb_context);
+  for (i = 0; devices && i < devices->len; i++)
+    open_stream_deck (self, g_ptr_array_index (devices, i));
+}
+
+
+/*
+ * Callbacks
+ */
+
+static void
+on_gusb_context_device_added_cb (GUsbContext     *gusb_context,
+                                 GUsbDevice      *device,
+                                 BsDeviceManager *self)
+{
+  BS_ENTRY;
+
+  open_stream_deck (self, device);
+
+  BS_EXIT;
+}
+
 static void
 on_gusb_context_device_removed_cb (GUsbContext     *gusb_context,
                                    GUsbDevice      *device,
@@ -163,6 +230,8 @@ on_gusb_context_device_removed_cb (GUsbContext     *gusb_context,
 
   BS_ENTRY;
 
+  g_ptr_array_remove (self->pending_devices, device);
+
   while (i < g_list_model_get_n_items (G_LIST_MODEL (self->stream_decks)))
     {
       g_autoptr (BsStreamDeck) stream_deck = NULL;
@@ -243,6 +312,8 @@ bs_device_manager_finalize (GObject *object)
 
   g_clear_object (&self->stream_decks);
   g_clear_object (&self->gusb_context);
+  g_clear_pointer (&self->pending_devices, g_ptr_array_unref);
+  g_clear_pointer (&self->replay_files, g_strfreev);
 
   G_OBJECT_CLASS (bs_device_manager_parent_class)->finalize (object);
 
@@ -277,12 +348,18 @@ static void
 bs_device_manager_init (BsDeviceManager *self)
 {
   const char *emulate_devices = g_getenv ("BOATSWAIN_EMULATE_DEVICES");
+  const char *replay_files = g_getenv ("BOATSWAIN_HID_REPLAY");
 
   self->emulate_devices = g_strcmp0 (PROFILE, "development") == 0 &&
                           emulate_devices != NULL &&
                           *emulate_devices == '1';
 
+  /* Recordings to play back, separated like paths in $PATH */
+  if (g_strcmp0 (PROFILE, "development") == 0 && replay_files && *replay_files)
+    self->replay_files = g_strsplit (replay_files, G_SEARCHPATH_SEPARATOR_S, -1);
+
   self->stream_decks = g_list_store_new (BS_TYPE_STREAM_DECK);
+  self->pending_devices = g_ptr_array_new_with_free_func (g_object_unref);
   g_signal_connect (self->stream_decks,
                     "items-changed",
                     G_CALLBACK (on_stream_decks_items_changed_cb),
@@ -318,6 +395,9 @@ bs_device_manager_load (BsDeviceManager  *self,
       enumerate_fake_stream_decks (self);
     }
 
+  if (self->replay_files)
+    enumerate_replayed_stream_decks (self);
+
 out:
   self->loaded = TRUE;
 
@@ -0,0 +1,272 @@
+/* bs-hid-recorder.c
+ *
+ * Copyright 2022 Georges Basile Stavracas Neto <georges.stavracas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define G_LOG_DOMAIN "HID Recorder"
+
+#include "bs-hid-recorder.h"
+
+#include <string.h>
+
+/*
+ * Wraps another transport, and records every report that goes through it.
+ * Reports are sent from the I/O thread and received in the main thread, so
+ * writing records is serialized by a lock. Asynchronous sends are recorded
+ * when submitted, and complete with the result of the wrapped transport.
+ */
+
+struct _BsHidRecorder
+{
+  BsHidTransport parent_instance;
+
+  BsHidTransport *transport;
+
+  GMutex lock;
+  GDataOutputStream *stream;
+  int64_t start_time;
+  gboolean failed;
+};
+
+G_DEFINE_FINAL_TYPE (BsHidRecorder, bs_hid_recorder, BS_TYPE_HID_TRANSPORT)
+
+
+/*
+ * Auxiliary methods
+ */
+
+static void
+write_record (BsHidRecorder   *self,
+              BsHidRecordType  type,
+              const uint8_t   *data,
+              size_t           length)
+{
+  g_autoptr (GError) error = NULL;
+  GOutputStream *stream;
+  int64_t timestamp;
+
+  timestamp = g_get_monotonic_time () - self->start_time;
+  stream = G_OUTPUT_STREAM (self->stream);
+
+  g_mutex_lock (&self->lock);
+
+  if (!self->failed &&
+      (!g_data_output_stream_put_int64 (self->stream, timestamp, NULL, &error) ||
+       !g_data_output_stream_put_byte (self->stream, type, NULL, &error) ||
+       !g_data_output_stream_put_uint32 (self->stream, length, NULL, &error) ||
+       !g_output_stream_write_all (stream, data, length, NULL, NULL, &error)))
+    {
+      g_warning ("Failed to record HID report, stopping recording: %s", error->message);
+      self->failed = TRUE;
+    }
+
+  g_mutex_unlock (&self->lock);
+}
+
+static void
+on_input_report_cb (const uint8_t *report,
+                    size_t         length,
+                    int64_t        timestamp,
+                    gpointer       user_data)
+{
+  BsHidRecorder *self = BS_HID_RECORDER (user_data);
+
+  write_record (self, BS_HID_RECORD_INPUT, report, length);
+  bs_hid_transport_push_input_report (BS_HID_TRANSPORT (self), report, length, timestamp);
+}
+
+static inline BsHidRecordType
+report_type_to_record_type (BsHidReportType type)
+{
+  return type == BS_HID_REPORT_FEATURE ? BS_HID_RECORD_SET_FEATURE : BS_HID_RECORD_OUTPUT;
+}
+
+
+/*
+ * BsHidTransport overrides
+ */
+
+static gboolean
+bs_hid_recorder_get_feature_report (BsHidTransport  *transport,
+                                    uint8_t         *data,
+                                    size_t           length,
+                                    GError         **error)
+{
+  BsHidRecorder *self = BS_HID_RECORDER (transport);
+
+  if (!bs_hid_transport_get_feature_report (self->transport, data, length, error))
+    return FALSE;
+
+  write_record (self, BS_HID_RECORD_GET_FEATURE, data, length);
+  return TRUE;
+}
+
+static gboolean
+bs_hid_recorder_send_report (BsHidTransport   *transport,
+                             BsHidReportType   type,
+                             const uint8_t    *data,
+                             size_t            length,
+                             GError          **error)
+{
+  BsHidRecorder *self = BS_HID_RECORDER (transport);
+
+  write_record (self, report_type_to_record_type (type), data, length);
+  return bs_hid_transport_send_report (self->transport, type, data, length, error);
+}
+
+static void
+bs_hid_recorder_send_report_async (BsHidTransport      *transport,
+                                   BsHidReportType      type,
+                                   const uint8_t       *data,
+                                   size_t               length,
+                                   GAsyncReadyCallback  callback,
+                                   gpointer             user_data)
+{
+  BsHidRecorder *self = BS_HID_RECORDER (transport);
+
+  write_record (self, report_type_to_record_type (type), data, length);
+  bs_hid_transport_send_report_async (self->transport, type, data, length, callback, user_data);
+}
+
+static gboolean
+bs_hid_recorder_send_report_finish (BsHidTransport   *transport,
+                                    BsHidReportType   type,
+                                    GAsyncResult     *result,
+                                    GError          **error)
+{
+  BsHidRecorder *self = BS_HID_RECORDER (transport);
+
+  return bs_hid_transport_send_report_finish (self->transport, type, result, error);
+}
+
+static void
+bs_hid_recorder_start (BsHidTransport *transport)
+{
+  BsHidRecorder *self = BS_HID_RECORDER (transport);
+
+  bs_hid_transport_set_input_func (self->transport, on_input_report_cb, self);
+  bs_hid_transport_start (self->transport);
+}
+
+static void
+bs_hid_recorder_stop (BsHidTransport *transport)
+{
+  BsHidRecorder *self = BS_HID_RECORDER (transport);
+
+  bs_hid_transport_stop (self->transport);
+  bs_hid_transport_set_input_func (self->transport, NULL, NULL);
+}
+
+
+/*
+ * GObject overrides
+ */
+
+static void
+bs_hid_recorder_finalize (GObject *object)
+{
+  g_autoptr (GError) error = NULL;
+  BsHidRecorder *self = (BsHidRecorder *)object;
+
+  bs_hid_transport_set_input_func (self->transport, NULL, NULL);
+  g_clear_object (&self->transport);
+
+  if (self->stream && !g_output_stream_close (G_OUTPUT_STREAM (self->stream), NULL, &error))
+    g_warning ("Failed to finish HID recording: %s", error->message);
+
+  g_clear_object (&self->stream);
+  g_mutex_clear (&self->lock);
+
+  G_OBJECT_CLASS (bs_hid_recorder_parent_class)->finalize (object);
+}
+
+static void
+bs_hid_recorder_class_init (BsHidRecorderClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  BsHidTransportClass *transport_class = BS_HID_TRANSPORT_CLASS (klass);
+
+  object_class->finalize = bs_hid_recorder_finalize;
+
+  transport_class->get_feature_report = bs_hid_recorder_get_feature_report;
+  transport_class->send_report = bs_hid_recorder_send_report;
+  transport_class->send_report_async = bs_hid_recorder_send_report_async;
+  transport_class->send_report_finish = bs_hid_recorder_send_report_finish;
+  transport_class->start = bs_hid_recorder_start;
+  transport_class->stop = bs_hid_recorder_stop;
+}
+
+static void
+bs_hid_recorder_init (BsHidRecorder *self)
+{
+  g_mutex_init (&self->lock);
+}
+
+/**
+ * bs_hid_recorder_new:
+ * @transport: the #BsHidTransport to record
+ * @product_id: USB product id of the device behind @transport
+ * @file: the #GFile to write the recording to
+ * @error: a location for a #GError, or %NULL
+ *
+ * Creates a transport that forwards everything to @transport, and writes
+ * all reports, in both directions, to @file. The recording can be played
+ * back with #BsHidReplay.
+ *
+ * Returns: (transfer full)(nullable): a #BsHidTransport, or %NULL
+ */
+BsHidTransport *
+bs_hid_recorder_new (BsHidTransport  *transport,
+                     uint16_t         product_id,
+                     GFile           *file,
+                     GError         **error)
+{
+  g_autoptr (GFileOutputStream) file_stream = NULL;
+  g_autoptr (GOutputStream) buffered_stream = NULL;
+  g_autoptr (BsHidRecorder) self = NULL;
+
+  g_return_val_if_fail (BS_IS_HID_TRANSPORT (transport), NULL);
+  g_return_val_if_fail (G_IS_FILE (file), NULL);
+
+  file_stream = g_file_replace (file, NULL, FALSE, G_FILE_CREATE_NONE, NULL, error);
+  if (!file_stream)
+    return NULL;
+
+  buffered_stream = g_buffered_output_stream_new (G_OUTPUT_STREAM (file_stream));
+
+  self = g_object_new (BS_TYPE_HID_RECORDER, NULL);
+  self->transport = g_object_ref (transport);
+  self->stream = g_data_output_stream_new (buffered_stream);
+  g_data_output_stream_set_byte_order (self->stream, G_DATA_STREAM_BYTE_ORDER_LITTLE_ENDIAN);
+
+  if (!g_output_stream_write_all (G_OUTPUT_STREAM (self->stream),
+                                  BS_HID_RECORDING_MAGIC,
+                                  strlen (BS_HID_RECORDING_MAGIC),
+                                  NULL,
+                                  NULL,
+                                  error) ||
+      !g_data_output_stream_put_uint16 (self->stream, BS_HID_RECORDING_VERSION, NULL, error) ||
+      !g_data_output_stream_put_uint16 (self->stream, product_id, NULL, error))
+    {
+      return NULL;
+    }
+
+  self->start_time = g_get_monotonic_time ();
+
+  return BS_HID_TRANSPORT (g_steal_pointer (&self));
+}
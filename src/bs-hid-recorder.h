@@ -0,0 +1,55 @@
+/* bs-hid-recorder.h
+ *
+ * Copyright 2022 Georges Basile Stavracas Neto <georges.stavracas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include "bs-hid-transport.h"
+
+G_BEGIN_DECLS
+
+/*
+ * Recordings start with the 8 bytes of BS_HID_RECORDING_MAGIC, followed by
+ * a 16-bit format version, and the 16-bit USB product id of the device.
+ * Each record then has a 64-bit timestamp, in microseconds since recording
+ * started, a byte with its BsHidRecordType, a 32-bit length, and the report
+ * itself. Integers are little-endian.
+ */
+#define BS_HID_RECORDING_MAGIC "BSHIDREC"
+#define BS_HID_RECORDING_VERSION 1
+#define BS_HID_RECORDING_HEADER_SIZE 12
+#define BS_HID_RECORD_HEADER_SIZE 13
+
+typedef enum
+{
+  BS_HID_RECORD_INPUT,
+  BS_HID_RECORD_OUTPUT,
+  BS_HID_RECORD_SET_FEATURE,
+  BS_HID_RECORD_GET_FEATURE,
+} BsHidRecordType;
+
+#define BS_TYPE_HID_RECORDER (bs_hid_recorder_get_type())
+G_DECLARE_FINAL_TYPE (BsHidRecorder, bs_hid_recorder, BS, HID_RECORDER, BsHidTransport)
+
+BsHidTransport * bs_hid_recorder_new (BsHidTransport  *transport,
+                                      uint16_t         product_id,
+                                      GFile           *file,
+                                      GError         **error);
+
+G_END_DECLS
@@ -0,0 +1,378 @@
+/* bs-hid-replay.c
+ *
+ * Copyright 2022 Georges Basile Stavracas Neto <georges.stavracas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define G_LOG_DOMAIN "HID Replay"
+
+#include "bs-hid-replay.h"
+
+#include "bs-hid-recorder.h"
+
+#include <string.h>
+
+/*
+ * Plays back a recording made by #BsHidRecorder. Input reports are pushed
+ * with their recorded timing, relative to when the transport was started,
+ * and feature reports are answered with the recorded ones. Everything sent
+ * to the replay is discarded, as with the null transport.
+ */
+
+typedef struct
+{
+  int64_t timestamp;
+  BsHidRecordType type;
+  const uint8_t *data;
+  size_t length;
+} Record;
+
+struct _BsHidReplay
+{
+  BsHidTransport parent_instance;
+
+  GBytes *bytes;
+  GArray *records;
+  uint16_t product_id;
+
+  GSource *source;
+  int64_t start_time;
+  size_t next_record;
+};
+
+G_DEFINE_FINAL_TYPE (BsHidReplay, bs_hid_replay, BS_TYPE_HID_TRANSPORT)
+
+enum
+{
+  FINISHED,
+  N_SIGNALS,
+};
+
+static guint signals [N_SIGNALS];
+
+
+/*
+ * Auxiliary methods
+ */
+
+static inline uint16_t
+read_uint16 (const uint8_t *data)
+{
+  uint16_t value;
+
+  memcpy (&value, data, sizeof (value));
+  return GUINT16_FROM_LE (value);
+}
+
+static inline uint32_t
+read_uint32 (const uint8_t *data)
+{
+  uint32_t value;
+
+  memcpy (&value, data, sizeof (value));
+  return GUINT32_FROM_LE (value);
+}
+
+static inline int64_t
+read_int64 (const uint8_t *data)
+{
+  int64_t value;
+
+  memcpy (&value, data, sizeof (value));
+  return GINT64_FROM_LE (value);
+}
+
+static gboolean
+parse_recording (BsHidReplay  *self,
+                 GError      **error)
+{
+  const uint8_t *data;
+  size_t offset;
+  size_t size;
+
+  data = g_bytes_get_data (self->bytes, &size);
+
+  if (size < BS_HID_RECORDING_HEADER_SIZE ||
+      memcmp (data, BS_HID_RECORDING_MAGIC, strlen (BS_HID_RECORDING_MAGIC)) != 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Not a HID recording");
+      return FALSE;
+    }
+
+  if (read_uint16 (data + 8) != BS_HID_RECORDING_VERSION)
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_NOT_SUPPORTED,
+                   "Unsupported HID recording version %u",
+                   read_uint16 (data + 8));
+      return FALSE;
+    }
+
+  self->product_id = read_uint16 (data + 10);
+
+  offset = BS_HID_RECORDING_HEADER_SIZE;
+  while (offset < size)
+    {
+      Record record;
+
+      if (size - offset < BS_HID_RECORD_HEADER_SIZE)
+        break;
+
+      record.timestamp = read_int64 (data + offset);
+      record.type = data[offset + 8];
+      record.length = read_uint32 (data + offset + 9);
+      record.data = data + offset + BS_HID_RECORD_HEADER_SIZE;
+
+      if (record.length > size - offset - BS_HID_RECORD_HEADER_SIZE)
+        break;
+
+      g_array_append_val (self->records, record);
+      offset += BS_HID_RECORD_HEADER_SIZE + record.length;
+    }
+
+  /* Recordings of crashed sessions are cut short; keep what is complete */
+  if (offset < size)
+    g_debug ("Ignoring %zu trailing bytes of truncated HID recording", size - offset);
+
+  return TRUE;
+}
+
+static void
+schedule_next_input_report (BsHidReplay *self)
+{
+  while (self->next_record < self->records->len)
+    {
+      const Record *record = &g_array_index (self->records, Record, self->next_record);
+
+      if (record->type == BS_HID_RECORD_INPUT)
+        {
+          g_source_set_ready_time (self->source, self->start_time + record->timestamp);
+          return;
+        }
+
+      self->next_record++;
+    }
+
+  g_source_set_ready_time (self->source, -1);
+  g_signal_emit (self, signals[FINISHED], 0);
+}
+
+static gboolean
+replay_source_dispatch (GSource     *source,
+                        GSourceFunc  callback,
+                        gpointer     user_data)
+{
+  return callback (user_data);
+}
+
+static GSourceFuncs replay_source_funcs = {
+  .dispatch = replay_source_dispatch,
+};
+
+static gboolean
+push_input_report_cb (gpointer user_data)
+{
+  g_autoptr (BsHidReplay) self = g_object_ref (BS_HID_REPLAY (user_data));
+  const Record *record;
+
+  record = &g_array_index (self->records, Record, self->next_record++);
+
+  /* Arrives when it was recorded, so that main loop delays count as latency */
+  bs_hid_transport_push_input_report (BS_HID_TRANSPORT (self),
+                                      record->data,
+                                      record->length,
+                                      self->start_time + record->timestamp);
+
+  /* The input function may have stopped the replay */
+  if (self->source)
+    schedule_next_input_report (self);
+
+  return G_SOURCE_CONTINUE;
+}
+
+
+/*
+ * BsHidTransport overrides
+ */
+
+static gboolean
+bs_hid_replay_get_feature_report (BsHidTransport  *transport,
+                                  uint8_t         *data,
+                                  size_t           length,
+                                  GError         **error)
+{
+  BsHidReplay *self = BS_HID_REPLAY (transport);
+
+  for (size_t i = 0; i < self->records->len; i++)
+    {
+      const Record *record = &g_array_index (self->records, Record, i);
+
+      if (record->type != BS_HID_RECORD_GET_FEATURE ||
+          record->length == 0 ||
+          record->data[0] != data[0])
+        {
+          continue;
+        }
+
+      memset (data + 1, 0, length - 1);
+      memcpy (data, record->data, MIN (length, record->length));
+      return TRUE;
+    }
+
+  return BS_HID_TRANSPORT_CLASS (bs_hid_replay_parent_class)->get_feature_report (transport,
+                                                                                  data,
+                                                                                  length,
+                                                                                  error);
+}
+
+static void
+bs_hid_replay_start (BsHidTransport *transport)
+{
+  BsHidReplay *self = BS_HID_REPLAY (transport);
+
+  g_assert (self->source == NULL);
+
+  self->start_time = g_get_monotonic_time ();
+  self->next_record = 0;
+
+  self->source = g_source_new (&replay_source_funcs, sizeof (GSource));
+  g_source_set_callback (self->source, push_input_report_cb, self, NULL);
+  g_source_set_name (self->source, "[boatswain] HID replay");
+  g_source_attach (self->source, NULL);
+
+  schedule_next_input_report (self);
+}
+
+static void
+bs_hid_replay_stop (BsHidTransport *transport)
+{
+  BsHidReplay *self = BS_HID_REPLAY (transport);
+
+  if (self->source)
+    g_source_destroy (self->source);
+  g_clear_pointer (&self->source, g_source_unref);
+}
+
+
+/*
+ * GObject overrides
+ */
+
+static void
+bs_hid_replay_finalize (GObject *object)
+{
+  BsHidReplay *self = (BsHidReplay *)object;
+
+  bs_hid_replay_stop (BS_HID_TRANSPORT (self));
+
+  g_clear_pointer (&self->records, g_array_unref);
+  g_clear_pointer (&self->bytes, g_bytes_unref);
+
+  G_OBJECT_CLASS (bs_hid_replay_parent_class)->finalize (object);
+}
+
+static void
+bs_hid_replay_class_init (BsHidReplayClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  BsHidTransportClass *transport_class = BS_HID_TRANSPORT_CLASS (klass);
+
+  object_class->finalize = bs_hid_replay_finalize;
+
+  transport_class->get_feature_report = bs_hid_replay_get_feature_report;
+  transport_class->start = bs_hid_replay_start;
+  transport_class->stop = bs_hid_replay_stop;
+
+  signals[FINISHED] = g_signal_new ("finished",
+                                    BS_TYPE_HID_REPLAY,
+                                    G_SIGNAL_RUN_LAST,
+                                    0, NULL, NULL, NULL,
+                                    G_TYPE_NONE,
+                                    0);
+}
+
+static void
+bs_hid_replay_init (BsHidReplay *self)
+{
+  self->records = g_array_new (FALSE, FALSE, sizeof (Record));
+}
+
+/**
+ * bs_hid_replay_new:
+ * @file: a #GFile with a recording
+ * @error: a location for a #GError, or %NULL
+ *
+ * Loads a recording made by #BsHidRecorder. The input reports of the
+ * recording are played back once the transport is started, and
+ * #BsHidReplay::finished is emitted after the last one.
+ *
+ * Returns: (transfer full)(nullable): a #BsHidTransport, or %NULL
+ */
+BsHidTransport *
+bs_hid_replay_new (GFile   *file,
+                   GError **error)
+{
+  g_autoptr (BsHidReplay) self = NULL;
+  g_autofree char *contents = NULL;
+  size_t length;
+
+  g_return_val_if_fail (G_IS_FILE (file), NULL);
+
+  if (!g_file_load_contents (file, NULL, &contents, &length, NULL, error))
+    return NULL;
+
+  self = g_object_new (BS_TYPE_HID_REPLAY, NULL);
+  self->bytes = g_bytes_new_take (g_steal_pointer (&contents), length);
+
+  if (!parse_recording (self, error))
+    return NULL;
+
+  return BS_HID_TRANSPORT (g_steal_pointer (&self));
+}
+
+/**
+ * bs_hid_replay_get_product_id:
+ * @self: a #BsHidReplay
+ *
+ * Retrieves the USB product id of the recorded device.
+ *
+ * Returns: the USB product id
+ */
+uint16_t
+bs_hid_replay_get_product_id (BsHidReplay *self)
+{
+  g_return_val_if_fail (BS_IS_HID_REPLAY (self), 0);
+
+  return self->product_id;
+}
+
+/**
+ * bs_hid_replay_is_finished:
+ * @self: a #BsHidReplay
+ *
+ * Retrieves whether all input reports were played back.
+ *
+ * Returns: whether the replay is finished
+ */
+gboolean
+bs_hid_replay_is_finished (BsHidReplay *self)
+{
+  g_return_val_if_fail (BS_IS_HID_REPLAY (self), FALSE);
+
+  return self->source != NULL && self->next_record >= self->records->len;
+}
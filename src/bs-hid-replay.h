@@ -0,0 +1,37 @@
+/* bs-hid-replay.h
+ *
+ * Copyright 2022 Georges Basile Stavracas Neto <georges.stavracas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include "bs-hid-transport.h"
+
+G_BEGIN_DECLS
+
+#define BS_TYPE_HID_REPLAY (bs_hid_replay_get_type())
+G_DECLARE_FINAL_TYPE (BsHidReplay, bs_hid_replay, BS, HID_REPLAY, BsHidTransport)
+
+BsHidTransport * bs_hid_replay_new (GFile   *file,
+                                    GError **error);
+
+uint16_t bs_hid_replay_get_product_id (BsHidReplay *self);
+
+gboolean bs_hid_replay_is_finished (BsHidReplay *self);
+
+G_END_DECLS
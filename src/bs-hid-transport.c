@@ -0,0 +1,315 @@
+/* bs-hid-transport.c
+ *
+ * Copyright 2022 Georges Basile Stavracas Neto <georges.stavracas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "bs-hid-transport.h"
+
+#include <string.h>
+
+/*
+ * The base transport is a null sink: reports sent to it are discarded,
+ * feature reports read from it are zeroed, and it never produces input.
+ * Backends override what they need.
+ *
+ * Reports may be sent from any thread, but only one at a time. Asynchronous
+ * sends complete in the thread-default main context of the caller, and the
+ * report data must stay valid until then. Input reports are pushed in the
+ * main thread.
+ */
+
+typedef struct
+{
+  BsHidInputFunc input_func;
+  gpointer input_func_data;
+} BsHidTransportPrivate;
+
+G_DEFINE_TYPE_WITH_PRIVATE (BsHidTransport, bs_hid_transport, G_TYPE_OBJECT)
+
+
+/*
+ * BsHidTransport overrides
+ */
+
+static gboolean
+bs_hid_transport_real_get_feature_report (BsHidTransport  *self,
+                                          uint8_t         *data,
+                                          size_t           length,
+                                          GError         **error)
+{
+  memset (data + 1, 0, length - 1);
+  return TRUE;
+}
+
+static gboolean
+bs_hid_transport_real_send_report (BsHidTransport   *self,
+                                   BsHidReportType   type,
+                                   const uint8_t    *data,
+                                   size_t            length,
+                                   GError          **error)
+{
+  return TRUE;
+}
+
+static void
+bs_hid_transport_real_send_report_async (BsHidTransport      *self,
+                                         BsHidReportType      type,
+                                         const uint8_t       *data,
+                                         size_t               length,
+                                         GAsyncReadyCallback  callback,
+                                         gpointer             user_data)
+{
+  g_autoptr (GTask) task = NULL;
+
+  task = g_task_new (self, NULL, callback, user_data);
+  g_task_set_source_tag (task, bs_hid_transport_real_send_report_async);
+  g_task_return_boolean (task, TRUE);
+}
+
+static gboolean
+bs_hid_transport_real_send_report_finish (BsHidTransport   *self,
+                                          BsHidReportType   type,
+                                          GAsyncResult     *result,
+                                          GError          **error)
+{
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+static void
+bs_hid_transport_real_start (BsHidTransport *self)
+{
+}
+
+static void
+bs_hid_transport_real_stop (BsHidTransport *self)
+{
+}
+
+
+/*
+ * GObject overrides
+ */
+
+static void
+bs_hid_transport_class_init (BsHidTransportClass *klass)
+{
+  klass->get_feature_report = bs_hid_transport_real_get_feature_report;
+  klass->send_report = bs_hid_transport_real_send_report;
+  klass->send_report_async = bs_hid_transport_real_send_report_async;
+  klass->send_report_finish = bs_hid_transport_real_send_report_finish;
+  klass->start = bs_hid_transport_real_start;
+  klass->stop = bs_hid_transport_real_stop;
+}
+
+static void
+bs_hid_transport_init (BsHidTransport *self)
+{
+}
+
+/**
+ * bs_hid_transport_new_null:
+ *
+ * Creates a transport that discards everything sent to it, and never
+ * produces input. This is meant for benchmarks.
+ *
+ * Returns: (transfer full): a #BsHidTransport
+ */
+BsHidTransport *
+bs_hid_transport_new_null (void)
+{
+  return g_object_new (BS_TYPE_HID_TRANSPORT, NULL);
+}
+
+/**
+ * bs_hid_transport_get_feature_report:
+ * @self: a #BsHidTransport
+ * @data: (inout): buffer with the report id in its first byte
+ * @length: size of @data
+ * @error: a location for a #GError, or %NULL
+ *
+ * Reads the feature report whose id is the first byte of @data into @data.
+ * This blocks until the device replies.
+ *
+ * Returns: whether the report was read
+ */
+gboolean
+bs_hid_transport_get_feature_report (BsHidTransport  *self,
+                                     uint8_t         *data,
+                                     size_t           length,
+                                     GError         **error)
+{
+  g_return_val_if_fail (BS_IS_HID_TRANSPORT (self), FALSE);
+  g_return_val_if_fail (data != NULL, FALSE);
+  g_return_val_if_fail (length > 0, FALSE);
+
+  return BS_HID_TRANSPORT_GET_CLASS (self)->get_feature_report (self, data, length, error);
+}
+
+/**
+ * bs_hid_transport_send_report:
+ * @self: a #BsHidTransport
+ * @type: %BS_HID_REPORT_OUTPUT or %BS_HID_REPORT_FEATURE
+ * @data: the report, starting with its id
+ * @length: size of @data
+ * @error: a location for a #GError, or %NULL
+ *
+ * Sends a report to the device, blocking until it is transferred.
+ *
+ * Returns: whether the report was sent
+ */
+gboolean
+bs_hid_transport_send_report (BsHidTransport   *self,
+                              BsHidReportType   type,
+                              const uint8_t    *data,
+                              size_t            length,
+                              GError          **error)
+{
+  g_return_val_if_fail (BS_IS_HID_TRANSPORT (self), FALSE);
+  g_return_val_if_fail (type != BS_HID_REPORT_INPUT, FALSE);
+  g_return_val_if_fail (data != NULL, FALSE);
+
+  return BS_HID_TRANSPORT_GET_CLASS (self)->send_report (self, type, data, length, error);
+}
+
+/**
+ * bs_hid_transport_send_report_async:
+ * @self: a #BsHidTransport
+ * @type: %BS_HID_REPORT_OUTPUT or %BS_HID_REPORT_FEATURE
+ * @data: the report, starting with its id
+ * @length: size of @data
+ * @callback: callback to call when the report is transferred
+ * @user_data: data to pass to @callback
+ *
+ * Asynchronously sends a report to the device. @data must stay valid until
+ * @callback is called. The source object passed to @callback is not
+ * necessarily @self.
+ */
+void
+bs_hid_transport_send_report_async (BsHidTransport      *self,
+                                    BsHidReportType      type,
+                                    const uint8_t       *data,
+                                    size_t               length,
+                                    GAsyncReadyCallback  callback,
+                                    gpointer             user_data)
+{
+  g_return_if_fail (BS_IS_HID_TRANSPORT (self));
+  g_return_if_fail (type != BS_HID_REPORT_INPUT);
+  g_return_if_fail (data != NULL);
+
+  BS_HID_TRANSPORT_GET_CLASS (self)->send_report_async (self, type, data, length, callback, user_data);
+}
+
+/**
+ * bs_hid_transport_send_report_finish:
+ * @self: a #BsHidTransport
+ * @type: the type passed to bs_hid_transport_send_report_async()
+ * @result: a #GAsyncResult provided to callback
+ * @error: a location for a #GError, or %NULL
+ *
+ * Finishes sending a report started with bs_hid_transport_send_report_async().
+ *
+ * Returns: whether the report was sent
+ */
+gboolean
+bs_hid_transport_send_report_finish (BsHidTransport   *self,
+                                     BsHidReportType   type,
+                                     GAsyncResult     *result,
+                                     GError          **error)
+{
+  g_return_val_if_fail (BS_IS_HID_TRANSPORT (self), FALSE);
+  g_return_val_if_fail (G_IS_ASYNC_RESULT (result), FALSE);
+
+  return BS_HID_TRANSPORT_GET_CLASS (self)->send_report_finish (self, type, result, error);
+}
+
+/**
+ * bs_hid_transport_set_input_func:
+ * @self: a #BsHidTransport
+ * @input_func: (nullable): function called with each input report
+ * @user_data: data to pass to @input_func
+ *
+ * Sets the function that receives input reports, in the main thread.
+ */
+void
+bs_hid_transport_set_input_func (BsHidTransport *self,
+                                 BsHidInputFunc  input_func,
+                                 gpointer        user_data)
+{
+  BsHidTransportPrivate *priv;
+
+  g_return_if_fail (BS_IS_HID_TRANSPORT (self));
+
+  priv = bs_hid_transport_get_instance_private (self);
+  priv->input_func = input_func;
+  priv->input_func_data = user_data;
+}
+
+/**
+ * bs_hid_transport_start:
+ * @self: a #BsHidTransport
+ *
+ * Starts reading input reports.
+ */
+void
+bs_hid_transport_start (BsHidTransport *self)
+{
+  g_return_if_fail (BS_IS_HID_TRANSPORT (self));
+
+  BS_HID_TRANSPORT_GET_CLASS (self)->start (self);
+}
+
+/**
+ * bs_hid_transport_stop:
+ * @self: a #BsHidTransport
+ *
+ * Stops reading input reports. The input function is not called anymore
+ * after this.
+ */
+void
+bs_hid_transport_stop (BsHidTransport *self)
+{
+  g_return_if_fail (BS_IS_HID_TRANSPORT (self));
+
+  BS_HID_TRANSPORT_GET_CLASS (self)->stop (self);
+}
+
+/**
+ * bs_hid_transport_push_input_report:
+ * @self: a #BsHidTransport
+ * @report: the input report
+ * @length: size of @report
+ * @timestamp: monotonic time at which @report arrived, in microseconds
+ *
+ * Hands an input report over to the input function. This is meant to be
+ * called by backends, in the main thread.
+ */
+void
+bs_hid_transport_push_input_report (BsHidTransport *self,
+                                    const uint8_t  *report,
+                                    size_t          length,
+                                    int64_t         timestamp)
+{
+  BsHidTransportPrivate *priv;
+
+  g_return_if_fail (BS_IS_HID_TRANSPORT (self));
+
+  priv = bs_hid_transport_get_instance_private (self);
+
+  if (priv->input_func)
+    priv->input_func (report, length, timestamp, priv->input_func_data);
+}
@@ -0,0 +1,114 @@
+/* bs-hid-transport.h
+ *
+ * Copyright 2022 Georges Basile Stavracas Neto <georges.stavracas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include "bs-types.h"
+
+#include <gio/gio.h>
+#include <stdint.h>
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+  BS_HID_REPORT_INPUT,
+  BS_HID_REPORT_OUTPUT,
+  BS_HID_REPORT_FEATURE,
+} BsHidReportType;
+
+typedef void (*BsHidInputFunc) (const uint8_t *report,
+                                size_t         length,
+                                int64_t        timestamp,
+                                gpointer       user_data);
+
+#define BS_TYPE_HID_TRANSPORT (bs_hid_transport_get_type())
+G_DECLARE_DERIVABLE_TYPE (BsHidTransport, bs_hid_transport, BS, HID_TRANSPORT, GObject)
+
+struct _BsHidTransportClass
+{
+  GObjectClass parent_class;
+
+  gboolean (*get_feature_report) (BsHidTransport  *self,
+                                  uint8_t         *data,
+                                  size_t           length,
+                                  GError         **error);
+
+  gboolean (*send_report) (BsHidTransport   *self,
+                           BsHidReportType   type,
+                           const uint8_t    *data,
+                           size_t            length,
+                           GError          **error);
+
+  void (*send_report_async) (BsHidTransport      *self,
+                             BsHidReportType      type,
+                             const uint8_t       *data,
+                             size_t               length,
+                             GAsyncReadyCallback  callback,
+                             gpointer             user_data);
+
+  gboolean (*send_report_finish) (BsHidTransport   *self,
+                                  BsHidReportType   type,
+                                  GAsyncResult     *result,
+                                  GError          **error);
+
+  void (*start) (BsHidTransport *self);
+  void (*stop) (BsHidTransport *self);
+};
+
+BsHidTransport * bs_hid_transport_new_null (void);
+
+gboolean bs_hid_transport_get_feature_report (BsHidTransport  *self,
+                                              uint8_t         *data,
+                                              size_t           length,
+                                              GError         **error);
+
+gboolean bs_hid_transport_send_report (BsHidTransport   *self,
+                                       BsHidReportType   type,
+                                       const uint8_t    *data,
+                                       size_t            length,
+                                       GError          **error);
+
+void bs_hid_transport_send_report_async (BsHidTransport      *self,
+                                         BsHidReportType      type,
+                                         const uint8_t       *data,
+                                         size_t               length,
+                                         GAsyncReadyCallback  callback,
+                                         gpointer             user_data);
+
+gboolean bs_hid_transport_send_report_finish (BsHidTransport   *self,
+                                              BsHidReportType   type,
+                                              GAsyncResult     *result,
+                                              GError          **error);
+
+void bs_hid_transport_set_input_func (BsHidTransport *self,
+                                      BsHidInputFunc  input_func,
+                                      gpointer        user_data);
+
+void bs_hid_transport_start (BsHidTransport *self);
+
+void bs_hid_transport_stop (BsHidTransport *self);
+
+void bs_hid_transport_push_input_report (BsHidTransport *self,
+                                         const uint8_t  *report,
+                                         size_t          length,
+                                         int64_t         timestamp);
+
+G_END_DECLS
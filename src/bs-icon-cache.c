@@ -0,0 +1,296 @@
+/* bs-icon-cache.c
+ *
+ * Copyright 2022 Georges Basile Stavracas Neto <georges.stavracas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define G_LOG_DOMAIN "Icon Cache"
+
+#include "bs-icon-cache.h"
+
+#include <math.h>
+#include <stdint.h>
+
+#define MAX_CACHED_ICONS 128
+#define MAX_CACHED_TEXTURES 256
+
+/*
+ * Actions swap between a few icons all the time (play and stop, muted and
+ * unmuted, etc), and every swap used to go through the icon theme, and then
+ * render the SVG of the symbolic icon again on every compose. Both steps are
+ * cached here: themed icons by name and size, and symbolic icons rasterized
+ * by name, size and color, so composing a key only blits a texture.
+ *
+ * Device images are composed without any transform, and orientation is
+ * applied by the encoder afterwards, so orientation is not part of the key.
+ *
+ * Both caches are bounded LRUs, and are dropped when the icon theme changes.
+ * Icons are only looked up and snapshotted on the main thread, so none of
+ * this is locked.
+ */
+
+typedef struct
+{
+  GHashTable *entries; /* key → GList link in lru */
+  GQueue lru; /* CacheEntry, most recently used first */
+  unsigned int max_entries;
+} Cache;
+
+typedef struct
+{
+  char *key;
+  gpointer object;
+} CacheEntry;
+
+static Cache icons = { NULL, G_QUEUE_INIT, MAX_CACHED_ICONS };
+static Cache textures = { NULL, G_QUEUE_INIT, MAX_CACHED_TEXTURES };
+static GtkIconTheme *icon_theme = NULL;
+
+
+/*
+ * Auxiliary methods
+ */
+
+static void
+cache_entry_free (gpointer data)
+{
+  CacheEntry *entry = data;
+
+  g_clear_pointer (&entry->key, g_free);
+  g_clear_object (&entry->object);
+  g_free (entry);
+}
+
+static gpointer
+cache_lookup (Cache      *cache,
+              const char *key)
+{
+  CacheEntry *entry;
+  GList *link;
+
+  link = g_hash_table_lookup (cache->entries, key);
+
+  if (!link)
+    return NULL;
+
+  g_queue_unlink (&cache->lru, link);
+  g_queue_push_head_link (&cache->lru, link);
+
+  entry = link->data;
+  return g_object_ref (entry->object);
+}
+
+static void
+cache_insert (Cache    *cache,
+              char     *key,
+              gpointer  object)
+{
+  CacheEntry *entry;
+
+  entry = g_new0 (CacheEntry, 1);
+  entry->key = key;
+  entry->object = g_object_ref (object);
+
+  g_queue_push_head (&cache->lru, entry);
+  g_hash_table_insert (cache->entries, entry->key, cache->lru.head);
+
+  while (g_queue_get_length (&cache->lru) > cache->max_entries)
+    {
+      entry = g_queue_pop_tail (&cache->lru);
+
+      g_hash_table_remove (cache->entries, entry->key);
+      cache_entry_free (entry);
+    }
+}
+
+static void
+cache_clear (Cache *cache)
+{
+  g_hash_table_remove_all (cache->entries);
+  g_queue_clear_full (&cache->lru, cache_entry_free);
+}
+
+static void
+on_icon_theme_changed_cb (GtkIconTheme *icon_theme,
+                          gpointer      user_data)
+{
+  g_debug ("Icon theme changed, dropping cached icons");
+
+  cache_clear (&icons);
+  cache_clear (&textures);
+}
+
+static void
+ensure_caches (void)
+{
+  if (G_LIKELY (icon_theme))
+    return;
+
+  icons.entries = g_hash_table_new (g_str_hash, g_str_equal);
+  textures.entries = g_hash_table_new (g_str_hash, g_str_equal);
+
+  icon_theme = gtk_icon_theme_get_for_display (gdk_display_get_default ());
+  g_signal_connect (icon_theme, "changed", G_CALLBACK (on_icon_theme_changed_cb), NULL);
+}
+
+static inline uint32_t
+pack_color (const GdkRGBA *color)
+{
+  return (uint32_t) lround (CLAMP (color->red, 0.0, 1.0) * 255.0) << 24 |
+         (uint32_t) lround (CLAMP (color->green, 0.0, 1.0) * 255.0) << 16 |
+         (uint32_t) lround (CLAMP (color->blue, 0.0, 1.0) * 255.0) << 8 |
+         (uint32_t) lround (CLAMP (color->alpha, 0.0, 1.0) * 255.0);
+}
+
+static GdkTexture *
+rasterize_symbolic_icon (GtkSymbolicPaintable *paintable,
+                         int                   size,
+                         const GdkRGBA        *color)
+{
+  g_autoptr (GskRenderNode) node = NULL;
+  g_autoptr (GtkSnapshot) snapshot = NULL;
+  g_autoptr (GBytes) bytes = NULL;
+  cairo_surface_t *surface;
+  int stride;
+
+  snapshot = gtk_snapshot_new ();
+  gtk_symbolic_paintable_snapshot_symbolic (paintable, snapshot, size, size, color, 1);
+  node = gtk_snapshot_free_to_node (g_steal_pointer (&snapshot));
+
+  surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, size, size);
+
+  if (node)
+    {
+      cairo_t *cr = cairo_create (surface);
+      gsk_render_node_draw (node, cr);
+      cairo_destroy (cr);
+    }
+
+  cairo_surface_flush (surface);
+
+  if (cairo_surface_status (surface) != CAIRO_STATUS_SUCCESS)
+    {
+      g_warning ("Failed to rasterize symbolic icon: %s",
+                 cairo_status_to_string (cairo_surface_status (surface)));
+      cairo_surface_destroy (surface);
+      return NULL;
+    }
+
+  /* Cairo's ARGB32 is GDK_MEMORY_DEFAULT, so the surface is used as is */
+  stride = cairo_image_surface_get_stride (surface);
+  bytes = g_bytes_new_with_free_func (cairo_image_surface_get_data (surface),
+                                      (size_t) stride * size,
+                                      (GDestroyNotify) cairo_surface_destroy,
+                                      surface);
+
+  return gdk_memory_texture_new (size, size, GDK_MEMORY_DEFAULT, bytes, stride);
+}
+
+
+/*
+ * Public API
+ */
+
+/**
+ * bs_icon_cache_lookup_icon:
+ * @icon_name: name of the icon
+ * @size: size of the icon, in pixels
+ *
+ * Looks up @icon_name in the icon theme of the default display, reusing
+ * the previous lookup if @icon_name was looked up recently.
+ *
+ * Must be called on the main thread.
+ *
+ * Returns: (transfer full): a #GtkIconPaintable
+ */
+GtkIconPaintable *
+bs_icon_cache_lookup_icon (const char *icon_name,
+                           int         size)
+{
+  g_autoptr (GtkIconPaintable) icon_paintable = NULL;
+  g_autofree char *key = NULL;
+
+  g_return_val_if_fail (icon_name != NULL, NULL);
+  g_return_val_if_fail (size > 0, NULL);
+
+  ensure_caches ();
+
+  key = g_strdup_printf ("%s\n%d", icon_name, size);
+  icon_paintable = cache_lookup (&icons, key);
+
+  if (!icon_paintable)
+    {
+      icon_paintable = gtk_icon_theme_lookup_icon (icon_theme,
+                                                   icon_name,
+                                                   NULL,
+                                                   size,
+                                                   1,
+                                                   gtk_get_locale_direction (),
+                                                   0);
+      cache_insert (&icons, g_steal_pointer (&key), icon_paintable);
+    }
+
+  return g_steal_pointer (&icon_paintable);
+}
+
+/**
+ * bs_icon_cache_get_symbolic_texture:
+ * @icon_name: name of the icon
+ * @size: size of the icon, in pixels
+ * @color: foreground color
+ *
+ * Retrieves @icon_name rendered as a symbolic icon with @color, at scale
+ * 1. The icon is only rendered if it is not in the cache already.
+ *
+ * Must be called on the main thread.
+ *
+ * Returns: (transfer full) (nullable): a #GdkTexture, or %NULL if
+ *   @icon_name is not a symbolic icon
+ */
+GdkTexture *
+bs_icon_cache_get_symbolic_texture (const char    *icon_name,
+                                    int            size,
+                                    const GdkRGBA *color)
+{
+  g_autoptr (GtkIconPaintable) icon_paintable = NULL;
+  g_autoptr (GdkTexture) texture = NULL;
+  g_autofree char *key = NULL;
+
+  g_return_val_if_fail (icon_name != NULL, NULL);
+  g_return_val_if_fail (size > 0, NULL);
+  g_return_val_if_fail (color != NULL, NULL);
+
+  ensure_caches ();
+
+  key = g_strdup_printf ("%s\n%d\n%08x", icon_name, size, pack_color (color));
+  texture = cache_lookup (&textures, key);
+
+  if (texture)
+    return g_steal_pointer (&texture);
+
+  icon_paintable = bs_icon_cache_lookup_icon (icon_name, size);
+
+  if (!GTK_IS_SYMBOLIC_PAINTABLE (icon_paintable))
+    return NULL;
+
+  texture = rasterize_symbolic_icon (GTK_SYMBOLIC_PAINTABLE (icon_paintable), size, color);
+
+  if (texture)
+    cache_insert (&textures, g_steal_pointer (&key), texture);
+
+  return g_steal_pointer (&texture);
+}
@@ -21,6 +21,10 @@
 #define G_LOG_DOMAIN "Icon"
 
 #include "bs-icon.h"
+#include "bs-icon-cache.h"
+#include "bs-label-cache.h"
+#include "bs-stream-deck-private.h"
+#include "bs-thumbnail.h"
 
 #define ICON_SIZE 32
 #define INTENSITY(c)  ((c.red) * 0.30 + (c.green) * 0.59 + (c.blue) * 0.11)
@@ -33,6 +37,7 @@ struct _BsIcon
   GdkRGBA color;
   GdkPaintable *paintable;
   PangoLayout *layout;
+  char *text;
   GFile *file;
   char *icon_name;
   double opacity;
@@ -40,6 +45,11 @@ struct _BsIcon
 
   GtkIconPaintable *icon_paintable;
   GdkTexture *file_texture;
+  GCancellable *file_cancellable;
+
+  BsAnimation *animation;
+  unsigned int animation_frame;
+  guint animation_timeout_id;
 
   GtkMediaStream *file_media_stream;
   gulong file_media_stream_content_changed_id;
@@ -51,6 +61,9 @@ struct _BsIcon
   gulong content_changed_id;
 
   gboolean foreground_color_set;
+
+  /* Changes with the contents, except when animations advance */
+  uint64_t serial;
 };
 
 static void gdk_paintable_iface_init (GdkPaintableInterface *iface);
@@ -78,14 +91,34 @@ static GParamSpec *properties [N_PROPS];
 static GdkRGBA opaque_white = { 1.0, 1.0, 1.0, 1.0 };
 static GdkRGBA transparent_black = { 0.0, 0.0, 0.0, 0.0 };
 
+/* Serials come from a single counter, so that they never repeat across icons */
+static uint64_t last_serial = 0;
+
+
 /*
  * Callbacks
  */
 
+static void
+invalidate_contents (BsIcon *self)
+{
+  self->serial = ++last_serial;
+
+  gdk_paintable_invalidate_contents (GDK_PAINTABLE (self));
+}
+
 static void
 on_paintable_contents_changed_cb (GdkPaintable *paintable,
                                   BsIcon       *self)
 {
+  invalidate_contents (self);
+}
+
+static void
+on_relative_contents_changed_cb (BsIcon *relative,
+                                 BsIcon *self)
+{
+  /* The serial of the relative icon is accounted for by bs_icon_get_serial() */
   gdk_paintable_invalidate_contents (GDK_PAINTABLE (self));
 }
 
@@ -96,6 +129,121 @@ on_paintable_size_changed_cb (GdkPaintable *paintable,
   gdk_paintable_invalidate_size (GDK_PAINTABLE (self));
 }
 
+static gboolean
+advance_animation_cb (gpointer data)
+{
+  BsIcon *self = BS_ICON (data);
+  unsigned int duration;
+
+  self->animation_frame = (self->animation_frame + 1) % bs_animation_get_n_frames (self->animation);
+
+  duration = bs_animation_get_frame_duration (self->animation, self->animation_frame);
+  self->animation_timeout_id = g_timeout_add (duration, advance_animation_cb, self);
+
+  /* Only the frame changed, so the serial stays the same */
+  gdk_paintable_invalidate_contents (GDK_PAINTABLE (self));
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+set_animation (BsIcon      *self,
+               BsAnimation *animation)
+{
+  g_clear_handle_id (&self->animation_timeout_id, g_source_remove);
+  g_set_object (&self->animation, animation);
+  self->animation_frame = 0;
+
+  if (animation && bs_animation_get_n_frames (animation) > 1)
+    {
+      self->animation_timeout_id = g_timeout_add (bs_animation_get_frame_duration (animation, 0),
+                                                  advance_animation_cb,
+                                                  self);
+    }
+}
+
+static void
+set_file_media_stream (BsIcon *self,
+                       GFile  *file)
+{
+  g_clear_signal_handler (&self->file_media_stream_content_changed_id, self->file_media_stream);
+  g_clear_object (&self->file_media_stream);
+
+  if (!file)
+    return;
+
+  self->file_media_stream = gtk_media_file_new_for_file (file);
+  gtk_media_stream_set_volume (self->file_media_stream, 0.0);
+  gtk_media_stream_set_muted (self->file_media_stream, TRUE);
+  gtk_media_stream_set_loop (self->file_media_stream, TRUE);
+  gtk_media_stream_play (self->file_media_stream);
+
+  self->file_media_stream_content_changed_id = g_signal_connect (self->file_media_stream,
+                                                                 "invalidate-contents",
+                                                                 G_CALLBACK (on_paintable_contents_changed_cb),
+                                                                 self);
+}
+
+static void
+on_file_texture_loaded_cb (GObject      *source_object,
+                           GAsyncResult *result,
+                           gpointer      user_data)
+{
+  g_autoptr (GdkTexture) texture = NULL;
+  g_autoptr (GError) error = NULL;
+  BsIcon *self;
+
+  texture = bs_thumbnail_load_finish (result, &error);
+
+  if (error)
+    {
+      if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        g_warning ("Error loading icon: %s", error->message);
+      return;
+    }
+
+  self = BS_ICON (user_data);
+
+  g_clear_object (&self->file_cancellable);
+  g_set_object (&self->file_texture, texture);
+
+  invalidate_contents (self);
+  gdk_paintable_invalidate_size (GDK_PAINTABLE (self));
+}
+
+static void
+on_file_animation_loaded_cb (GObject      *source_object,
+                             GAsyncResult *result,
+                             gpointer      user_data)
+{
+  g_autoptr (BsAnimation) animation = NULL;
+  g_autoptr (GError) error = NULL;
+  BsIcon *self;
+
+  animation = bs_animation_load_finish (result, &error);
+
+  if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    return;
+
+  self = BS_ICON (user_data);
+
+  g_clear_object (&self->file_cancellable);
+
+  /* Animations that cannot be decoded upfront are streamed */
+  if (error)
+    {
+      g_debug ("Streaming animation: %s", error->message);
+      set_file_media_stream (self, self->file);
+    }
+  else
+    {
+      set_animation (self, animation);
+    }
+
+  invalidate_contents (self);
+  gdk_paintable_invalidate_size (GDK_PAINTABLE (self));
+}
+
 static void
 premultiply_rgba (const GdkRGBA *rgba,
                   GdkRGBA       *premultiplied_rgba)
@@ -119,22 +267,31 @@ generate_foreground_color (BsIcon *self)
     return (GdkRGBA) { 1.0, 1.0, 1.0, 1.0 };
 }
 
-static gboolean
-snapshot_any_paintable (GdkSnapshot *snapshot,
-                        BsIcon      *icon,
-                        double       width,
-                        double       height)
+static GdkPaintable *
+get_paintable (BsIcon *icon)
 {
-  GdkPaintable *paintable = NULL;
-
   if (icon->paintable)
-    paintable = icon->paintable;
+    return icon->paintable;
   else if (icon->file_media_stream)
-    paintable = GDK_PAINTABLE (icon->file_media_stream);
+    return GDK_PAINTABLE (icon->file_media_stream);
+  else if (icon->animation)
+    return GDK_PAINTABLE (bs_animation_get_frame (icon->animation, icon->animation_frame));
   else if (icon->file_texture)
-    paintable = GDK_PAINTABLE (icon->file_texture);
+    return GDK_PAINTABLE (icon->file_texture);
   else if (icon->icon_paintable)
-    paintable = GDK_PAINTABLE (icon->icon_paintable);
+    return GDK_PAINTABLE (icon->icon_paintable);
+
+  return NULL;
+}
+
+static gboolean
+snapshot_any_paintable (GdkSnapshot *snapshot,
+                        BsIcon      *icon,
+                        double       width,
+                        double       height,
+                        gboolean     cached_symbolic)
+{
+  GdkPaintable *paintable = get_paintable (icon);
 
   if (!paintable)
     return FALSE;
@@ -143,6 +300,7 @@ snapshot_any_paintable (GdkSnapshot *snapshot,
     {
       float hpadding = (width - ICON_SIZE) / 2.0;
       float vpadding = (height - ICON_SIZE) / 2.0;
+      g_autoptr (GdkTexture) texture = NULL;
       GdkRGBA color;
 
       if (icon->foreground_color_set)
@@ -150,14 +308,26 @@ snapshot_any_paintable (GdkSnapshot *snapshot,
       else
         color = generate_foreground_color (icon);
 
+      if (cached_symbolic && paintable == GDK_PAINTABLE (icon->icon_paintable))
+        texture = bs_icon_cache_get_symbolic_texture (icon->icon_name, ICON_SIZE, &color);
+
       gtk_snapshot_save (snapshot);
       gtk_snapshot_translate (snapshot, &GRAPHENE_POINT_INIT (hpadding, vpadding));
-      gtk_symbolic_paintable_snapshot_symbolic (GTK_SYMBOLIC_PAINTABLE (icon->icon_paintable),
-                                                snapshot,
-                                                ICON_SIZE,
-                                                ICON_SIZE,
-                                                &color,
-                                                1);
+      if (texture)
+        {
+          gtk_snapshot_append_texture (snapshot,
+                                       texture,
+                                       &GRAPHENE_RECT_INIT (0, 0, ICON_SIZE, ICON_SIZE));
+        }
+      else
+        {
+          gtk_symbolic_paintable_snapshot_symbolic (GTK_SYMBOLIC_PAINTABLE (icon->icon_paintable),
+                                                    snapshot,
+                                                    ICON_SIZE,
+                                                    ICON_SIZE,
+                                                    &color,
+                                                    1);
+        }
       gtk_snapshot_restore (snapshot);
     }
   else
@@ -235,8 +405,12 @@ snapshot_icon (BsIcon      *self,
   if (opacity != -1.0)
     gtk_snapshot_push_opacity (snapshot, opacity);
 
-  if (!snapshot_any_paintable (snapshot, self, width, height) && self->relative)
-    snapshot_any_paintable (snapshot, self->relative, width, height);
+  /*
+   * Device images are always composed at scale 1, so they can use rasterized
+   * symbolic icons. Widgets may be scaled, and render the icons themselves.
+   */
+  if (!snapshot_any_paintable (snapshot, self, width, height, premultiply) && self->relative)
+    snapshot_any_paintable (snapshot, self->relative, width, height, premultiply);
 
   if (!snapshot_any_layout (snapshot, self, width, height) && self->relative)
     snapshot_any_layout (snapshot, self->relative, width, height);
@@ -313,6 +487,9 @@ bs_icon_finalize (GObject *object)
       self->relative = NULL;
     }
 
+  g_cancellable_cancel (self->file_cancellable);
+
+  g_clear_handle_id (&self->animation_timeout_id, g_source_remove);
   g_clear_signal_handler (&self->file_media_stream_content_changed_id, self->file_media_stream);
   g_clear_signal_handler (&self->content_changed_id, self->paintable);
   g_clear_signal_handler (&self->size_changed_id, self->paintable);
@@ -320,8 +497,12 @@ bs_icon_finalize (GObject *object)
   g_clear_object (&self->paintable);
   g_clear_object (&self->file_media_stream);
   g_clear_object (&self->file_texture);
+  g_clear_object (&self->file_cancellable);
+  g_clear_object (&self->animation);
   g_clear_object (&self->file);
+  g_clear_object (&self->icon_paintable);
   g_clear_object (&self->layout);
+  g_clear_pointer (&self->text, g_free);
 
   G_OBJECT_CLASS (bs_icon_parent_class)->finalize (object);
 }
@@ -365,7 +546,7 @@ bs_icon_get_property (GObject    *object,
       break;
 
     case PROP_TEXT:
-      g_value_set_string (value, self->layout ? pango_layout_get_text (self->layout) : NULL);
+      g_value_set_string (value, self->text);
       break;
 
     default:
@@ -392,7 +573,7 @@ bs_icon_set_property (GObject      *object,
       break;
 
     case PROP_FILE:
-      bs_icon_set_file (self, g_value_get_object (value), NULL);
+      bs_icon_set_file (self, g_value_get_object (value));
       break;
 
     case PROP_ICON_NAME:
@@ -470,6 +651,7 @@ bs_icon_init (BsIcon *self)
   self->foreground_color_set = FALSE;
   self->color = opaque_white;
   self->opacity = -1.0;
+  self->serial = ++last_serial;
 }
 
 
@@ -538,8 +720,8 @@ bs_icon_to_json (BsIcon *self)
   json_builder_add_string_value (builder, background_color);
 
   json_builder_set_member_name (builder, "text");
-  if (self->layout)
-    json_builder_add_string_value (builder, pango_layout_get_text (self->layout));
+  if (self->text)
+    json_builder_add_string_value (builder, self->text);
   else
     json_builder_add_null_value (builder);
 
@@ -594,7 +776,7 @@ bs_icon_set_background_color (BsIcon        *self,
   else
     self->background_color = transparent_black;
 
-  gdk_paintable_invalidate_contents (GDK_PAINTABLE (self));
+  invalidate_contents (self);
 
   g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_BACKGROUND_COLOR]);
 }
@@ -620,7 +802,7 @@ bs_icon_set_color (BsIcon        *self,
 
   self->foreground_color_set = color != NULL;
 
-  gdk_paintable_invalidate_contents (GDK_PAINTABLE (self));
+  invalidate_contents (self);
 
   g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_BACKGROUND_COLOR]);
 }
@@ -634,12 +816,11 @@ bs_icon_get_file (BsIcon *self)
 }
 
 void
-bs_icon_set_file (BsIcon  *self,
-                  GFile   *file,
-                  GError **error)
+bs_icon_set_file (BsIcon *self,
+                  GFile  *file)
 {
-  g_autoptr (GtkMediaStream) media_stream = NULL;
-  g_autoptr (GdkTexture) texture = NULL;
+  const char *content_type = NULL;
+  g_autoptr (GFileInfo) file_info = NULL;
 
   g_return_if_fail (BS_IS_ICON (self));
 
@@ -648,7 +829,6 @@ bs_icon_set_file (BsIcon  *self,
 
   if (file)
     {
-      g_autoptr (GFileInfo) file_info = NULL;
       g_autoptr (GError) local_error = NULL;
 
       file_info = g_file_query_info (file,
@@ -658,52 +838,49 @@ bs_icon_set_file (BsIcon  *self,
                                      &local_error);
 
       if (file_info)
-        {
-          const char * const media_stream_content_types[] = {
-            "image/gif",
-            "video/*",
-          };
-          const char *content_type;
-
-          content_type = g_file_info_get_content_type (file_info);
-          for (size_t i = 0; i < G_N_ELEMENTS (media_stream_content_types); i++)
-            {
-              if (!g_content_type_is_mime_type (content_type, media_stream_content_types[i]))
-                continue;
-
-              media_stream = gtk_media_file_new_for_file (file);
-              gtk_media_stream_set_volume (media_stream, 0.0);
-              gtk_media_stream_set_muted (media_stream, TRUE);
-              gtk_media_stream_set_loop (media_stream, TRUE);
-              gtk_media_stream_play (media_stream);
-              break;
-            }
-        }
+        content_type = g_file_info_get_content_type (file_info);
       else
-        {
-          g_warning ("Error querying file info: %s", local_error->message);
-        }
-
-      if (!media_stream)
-        {
-          texture = gdk_texture_new_from_file (file, error);
-          if (!texture)
-            return;
-        }
+        g_warning ("Error querying file info: %s", local_error->message);
     }
 
-  g_clear_signal_handler (&self->file_media_stream_content_changed_id, self->file_media_stream);
-  g_set_object (&self->file_media_stream, media_stream);
-  g_set_object (&self->file_texture, texture);
+  g_cancellable_cancel (self->file_cancellable);
+  g_clear_object (&self->file_cancellable);
+
+  set_file_media_stream (self, NULL);
+  set_animation (self, NULL);
+  g_clear_object (&self->file_texture);
   g_set_object (&self->file, file);
 
-  if (media_stream)
-    self->file_media_stream_content_changed_id = g_signal_connect (media_stream,
-                                                                   "invalidate-contents",
-                                                                   G_CALLBACK (on_paintable_contents_changed_cb),
-                                                                   self);
+  /*
+   * Images and animations are never shown larger than the largest key. They
+   * are loaded in a thread, so errors loading them are only logged.
+   * Animations are decoded upfront, so that devices can cache their frames;
+   * videos, and animations too long for that, are streamed.
+   */
+  if (file && content_type && g_content_type_is_mime_type (content_type, "video/*"))
+    {
+      set_file_media_stream (self, file);
+    }
+  else if (file && content_type && g_content_type_is_mime_type (content_type, "image/gif"))
+    {
+      self->file_cancellable = g_cancellable_new ();
+      bs_animation_load_async (file,
+                               bs_stream_deck_get_max_button_size (),
+                               self->file_cancellable,
+                               on_file_animation_loaded_cb,
+                               self);
+    }
+  else if (file)
+    {
+      self->file_cancellable = g_cancellable_new ();
+      bs_thumbnail_load_async (file,
+                               bs_stream_deck_get_max_button_size (),
+                               self->file_cancellable,
+                               on_file_texture_loaded_cb,
+                               self);
+    }
 
-  gdk_paintable_invalidate_contents (GDK_PAINTABLE (self));
+  invalidate_contents (self);
   gdk_paintable_invalidate_size (GDK_PAINTABLE (self));
 
   g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_FILE]);
@@ -721,26 +898,21 @@ void
 bs_icon_set_icon_name (BsIcon     *self,
                        const char *icon_name)
 {
-  GtkIconTheme *icon_theme;
-
   g_return_if_fail (BS_IS_ICON (self));
 
   if (g_strcmp0 (self->icon_name, icon_name) == 0)
     return;
 
   g_clear_pointer (&self->icon_name, g_free);
-  self->icon_name = g_strdup (icon_name);
+  g_clear_object (&self->icon_paintable);
 
-  icon_theme = gtk_icon_theme_get_for_display (gdk_display_get_default ());
-  self->icon_paintable = gtk_icon_theme_lookup_icon (icon_theme,
-                                                     icon_name,
-                                                     NULL,
-                                                     ICON_SIZE,
-                                                     1,
-                                                     gtk_get_locale_direction (),
-                                                     0);
+  if (icon_name)
+    {
+      self->icon_name = g_strdup (icon_name);
+      self->icon_paintable = bs_icon_cache_lookup_icon (icon_name, ICON_SIZE);
+    }
 
-  gdk_paintable_invalidate_contents (GDK_PAINTABLE (self));
+  invalidate_contents (self);
   gdk_paintable_invalidate_size (GDK_PAINTABLE (self));
 
   g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_ICON_NAME]);
@@ -779,7 +951,7 @@ bs_icon_set_paintable (BsIcon       *self,
                                             G_CALLBACK (on_paintable_size_changed_cb),
                                             self);
 
-  gdk_paintable_invalidate_contents (GDK_PAINTABLE (self));
+  invalidate_contents (self);
   gdk_paintable_invalidate_size (GDK_PAINTABLE (self));
 
   g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_PAINTABLE]);
@@ -790,7 +962,7 @@ bs_icon_get_text (BsIcon *self)
 {
   g_return_val_if_fail (BS_IS_ICON (self), NULL);
 
-  return self->layout ? pango_layout_get_text (self->layout) : NULL;
+  return self->text;
 }
 
 void
@@ -799,35 +971,21 @@ bs_icon_set_text (BsIcon     *self,
 {
   g_return_if_fail (BS_IS_ICON (self));
 
-  if (self->layout && g_strcmp0 (pango_layout_get_text (self->layout), text) == 0)
+  if (g_strcmp0 (self->text, text) == 0)
     return;
 
-  if (text)
-    {
-      if (!self->layout)
-        {
-          g_autoptr (PangoFontDescription) font_description = NULL;
-          PangoContext *pango_context;
-
-          font_description = pango_font_description_from_string ("Cantarell Bold 8");
-
-          pango_context = pango_font_map_create_context (pango_cairo_font_map_get_default ());
-          pango_context_set_language (pango_context, gtk_get_default_language ());
-          pango_context_set_font_description (pango_context, font_description);
-
-          self->layout = pango_layout_new (pango_context);
-
-          g_clear_object (&pango_context);
-        }
+  g_clear_object (&self->layout);
+  g_clear_pointer (&self->text, g_free);
 
-      pango_layout_set_text (self->layout, text, -1);
-    }
-  else
+  if (text)
     {
-      g_clear_object (&self->layout);
+      self->text = g_strdup (text);
+      self->layout = bs_label_cache_get_layout (text,
+                                                BS_LABEL_CACHE_DEFAULT_FONT,
+                                                BS_LABEL_CACHE_DEFAULT_DPI);
     }
 
-  gdk_paintable_invalidate_contents (GDK_PAINTABLE (self));
+  invalidate_contents (self);
   gdk_paintable_invalidate_size (GDK_PAINTABLE (self));
 
   g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_TEXT]);
@@ -853,7 +1011,7 @@ bs_icon_set_opacity (BsIcon *self,
 
   self->opacity = opacity;
 
-  gdk_paintable_invalidate_contents (GDK_PAINTABLE (self));
+  invalidate_contents (self);
   gdk_paintable_invalidate_size (GDK_PAINTABLE (self));
 
   g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_OPACITY]);
@@ -891,7 +1049,7 @@ bs_icon_set_relative (BsIcon *self,
     {
       self->relative_content_changed_id = g_signal_connect (relative,
                                                             "invalidate-contents",
-                                                            G_CALLBACK (on_paintable_contents_changed_cb),
+                                                            G_CALLBACK (on_relative_contents_changed_cb),
                                                             self);
 
       self->relative_size_changed_id = g_signal_connect (relative,
@@ -902,8 +1060,61 @@ bs_icon_set_relative (BsIcon *self,
       g_object_add_weak_pointer (G_OBJECT (self->relative), (gpointer) &self->relative);
     }
 
-  gdk_paintable_invalidate_contents (GDK_PAINTABLE (self));
+  invalidate_contents (self);
   gdk_paintable_invalidate_size (GDK_PAINTABLE (self));
 
   g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_RELATIVE]);
 }
+
+/**
+ * bs_icon_get_serial:
+ * @self: a #BsIcon
+ *
+ * Retrieves a number that changes whenever the contents of @self, or of
+ * its relative icon, change, except when animations advance to their next
+ * frame. Together with bs_icon_get_animation(), this tells whether an
+ * image composed from @self before is still current.
+ *
+ * Returns: the serial of @self
+ */
+uint64_t
+bs_icon_get_serial (BsIcon *self)
+{
+  g_return_val_if_fail (BS_IS_ICON (self), 0);
+
+  if (self->relative)
+    return MAX (self->serial, self->relative->serial);
+
+  return self->serial;
+}
+
+/**
+ * bs_icon_get_animation:
+ * @self: a #BsIcon
+ * @out_frame: (out) (optional): return location for the current frame
+ *
+ * Retrieves the animation shown by @self, which may come from its
+ * relative icon, and the frame currently shown.
+ *
+ * Returns: (transfer none) (nullable): a #BsAnimation, or %NULL
+ */
+BsAnimation *
+bs_icon_get_animation (BsIcon       *self,
+                       unsigned int *out_frame)
+{
+  BsIcon *icon = self;
+
+  g_return_val_if_fail (BS_IS_ICON (self), NULL);
+
+  /* Same precedence as snapshot_icon() */
+  if (!get_paintable (self) && self->relative)
+    icon = self->relative;
+
+  if (!icon->animation || icon->paintable || icon->file_media_stream)
+    return NULL;
+
+  if (out_frame)
+    *out_frame = icon->animation_frame;
+
+  return icon->animation;
+}
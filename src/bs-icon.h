@@ -22,6 +22,9 @@
 
 #include <gtk/gtk.h>
 #include <json-glib/json-glib.h>
+#include <stdint.h>
+
+#include "bs-animation.h"
 
 G_BEGIN_DECLS
 
@@ -52,9 +55,8 @@ void bs_icon_set_color (BsIcon        *self,
                         const GdkRGBA *color);
 
 GFile * bs_icon_get_file (BsIcon *self);
-void bs_icon_set_file (BsIcon  *self,
-                       GFile   *file,
-                       GError **error);
+void bs_icon_set_file (BsIcon *self,
+                       GFile  *file);
 
 const char * bs_icon_get_icon_name (BsIcon *self);
 void bs_icon_set_icon_name (BsIcon     *self,
@@ -76,4 +78,9 @@ BsIcon * bs_icon_get_relative (BsIcon *self);
 void  bs_icon_set_relative (BsIcon *self,
                             BsIcon *relative);
 
+uint64_t bs_icon_get_serial (BsIcon *self);
+
+BsAnimation * bs_icon_get_animation (BsIcon       *self,
+                                     unsigned int *out_frame);
+
 G_END_DECLS
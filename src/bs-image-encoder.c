@@ -0,0 +1,505 @@
+/* bs-image-encoder.c
+ *
+ * Copyright 2022 Georges Basile Stavracas Neto <georges.stavracas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define G_LOG_DOMAIN "Image Encoder"
+
+#include "bs-image-encoder.h"
+#include "bs-renderer.h"
+
+#include <gio/gio.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <string.h>
+#include <jpeglib.h>
+
+#if defined(__SSE2__)
+# include <emmintrin.h>
+#elif defined(__ARM_NEON)
+# include <arm_neon.h>
+#endif
+
+/*
+ * Encoders for the image formats Stream Decks accept. Pixels come in the
+ * native-endian, premultiplied ARGB layout of cairo image surfaces and
+ * GDK_MEMORY_DEFAULT, and alpha is dropped, since devices have no notion
+ * of transparency.
+ *
+ * Pixels are in logical orientation; the flip and rotation flags of the
+ * image info are applied while encoding, one output row at a time.
+ */
+
+#define BMP_HEADER_SIZE 54
+#define JPEG_QUALITY 96
+
+#if defined(JCS_EXTENSIONS)
+# if G_BYTE_ORDER == G_LITTLE_ENDIAN
+#  define JPEG_NATIVE_COLOR_SPACE JCS_EXT_BGRX
+# else
+#  define JPEG_NATIVE_COLOR_SPACE JCS_EXT_XRGB
+# endif
+#endif
+
+typedef struct
+{
+  struct jpeg_error_mgr pub;
+  jmp_buf setjmp_buffer;
+  char message[JMSG_LENGTH_MAX];
+} JpegErrorManager;
+
+typedef struct
+{
+  struct jpeg_destination_mgr pub;
+  GByteArray *output;
+} JpegDestinationManager;
+
+struct _BsImageEncoder
+{
+  BsImageInfo image_info;
+
+  /* BMP */
+  uint8_t bmp_header[BMP_HEADER_SIZE];
+  size_t bmp_row_size;
+
+  /* JPEG */
+  struct jpeg_compress_struct jpeg;
+  JpegErrorManager jpeg_error;
+  JpegDestinationManager jpeg_destination;
+  gboolean jpeg_initialized;
+
+  uint8_t *row;
+  uint32_t *oriented_row;
+};
+
+
+/*
+ * Auxiliary methods
+ */
+
+static inline void
+write_uint16 (uint8_t  *data,
+              uint16_t  value)
+{
+  data[0] = value & 0xff;
+  data[1] = (value >> 8) & 0xff;
+}
+
+static inline void
+write_uint32 (uint8_t  *data,
+              uint32_t  value)
+{
+  data[0] = value & 0xff;
+  data[1] = (value >> 8) & 0xff;
+  data[2] = (value >> 16) & 0xff;
+  data[3] = (value >> 24) & 0xff;
+}
+
+static void
+convert_row (const uint32_t *src,
+             uint8_t        *dst,
+             uint32_t        width,
+             gboolean        bgr)
+{
+  uint32_t x;
+
+  for (x = 0; x < width; x++)
+    {
+      uint32_t pixel = src[x];
+      uint8_t r = (pixel >> 16) & 0xff;
+      uint8_t g = (pixel >> 8) & 0xff;
+      uint8_t b = pixel & 0xff;
+
+      dst[0] = bgr ? b : r;
+      dst[1] = g;
+      dst[2] = bgr ? r : b;
+      dst += 3;
+    }
+}
+
+static void
+reverse_pixels (const uint32_t *src,
+                uint32_t       *dst,
+                uint32_t        width)
+{
+  uint32_t x = 0;
+
+#if defined(__SSE2__)
+  for (; x + 4 <= width; x += 4)
+    {
+      __m128i pixels = _mm_loadu_si128 ((const __m128i *) (src + width - x - 4));
+
+      pixels = _mm_shuffle_epi32 (pixels, _MM_SHUFFLE (0, 1, 2, 3));
+      _mm_storeu_si128 ((__m128i *) (dst + x), pixels);
+    }
+#elif defined(__ARM_NEON)
+  for (; x + 4 <= width; x += 4)
+    {
+      uint32x4_t pixels = vld1q_u32 (src + width - x - 4);
+
+      pixels = vrev64q_u32 (pixels);
+      pixels = vcombine_u32 (vget_high_u32 (pixels), vget_low_u32 (pixels));
+      vst1q_u32 (dst + x, pixels);
+    }
+#endif
+
+  for (; x < width; x++)
+    dst[x] = src[width - x - 1];
+}
+
+/*
+ * Returns row @y of the image as the device expects it. This is either a
+ * row of @pixels itself, or one assembled in the scratch row.
+ */
+static const uint32_t *
+get_oriented_row (BsImageEncoder *self,
+                  const uint8_t  *pixels,
+                  size_t          stride,
+                  uint32_t        y)
+{
+  BsRendererFlags flags = self->image_info.flags;
+  uint32_t height = self->image_info.height;
+  uint32_t width = self->image_info.width;
+  const uint32_t *src;
+  uint32_t x;
+
+  if (flags & BS_RENDERER_FLAG_ROTATE_90)
+    {
+      uint32_t src_x;
+
+      /*
+       * Only square images are rotated. Output row y is column y of the
+       * logical image, read bottom to top (or top to bottom if flipped).
+       */
+      g_assert (width == height);
+
+      src_x = (flags & BS_RENDERER_FLAG_FLIP_X) ? width - y - 1 : y;
+
+      for (x = 0; x < width; x++)
+        {
+          uint32_t src_y = (flags & BS_RENDERER_FLAG_FLIP_Y) ? x : width - x - 1;
+
+          src = (const uint32_t *) (pixels + src_y * stride);
+          self->oriented_row[x] = src[src_x];
+        }
+
+      return self->oriented_row;
+    }
+
+  if (flags & BS_RENDERER_FLAG_FLIP_Y)
+    y = height - y - 1;
+
+  src = (const uint32_t *) (pixels + y * stride);
+
+  if (!(flags & BS_RENDERER_FLAG_FLIP_X))
+    return src;
+
+  reverse_pixels (src, self->oriented_row, width);
+
+  return self->oriented_row;
+}
+
+
+/*
+ * BMP
+ */
+
+static void
+init_bmp (BsImageEncoder *self)
+{
+  uint8_t *header = self->bmp_header;
+  size_t image_size;
+
+  /* Rows are padded to 4 bytes */
+  self->bmp_row_size = (self->image_info.width * 3 + 3) & ~3;
+  image_size = self->bmp_row_size * self->image_info.height;
+
+  /* Same layout as gdk-pixbuf produces, which is what devices were tested with */
+  memset (header, 0, BMP_HEADER_SIZE);
+  header[0] = 'B';
+  header[1] = 'M';
+  write_uint32 (header + 2, BMP_HEADER_SIZE + image_size);
+  write_uint32 (header + 10, BMP_HEADER_SIZE);
+  write_uint32 (header + 14, 40);
+  write_uint32 (header + 18, self->image_info.width);
+  write_uint32 (header + 22, self->image_info.height);
+  write_uint16 (header + 26, 1);
+  write_uint16 (header + 28, 24);
+  write_uint32 (header + 34, image_size);
+}
+
+static gboolean
+encode_bmp (BsImageEncoder  *self,
+            const uint8_t   *pixels,
+            size_t           stride,
+            GByteArray      *output)
+{
+  uint32_t height = self->image_info.height;
+  uint32_t width = self->image_info.width;
+  uint8_t *dst;
+  uint32_t y;
+
+  g_byte_array_set_size (output, BMP_HEADER_SIZE + self->bmp_row_size * height);
+
+  memcpy (output->data, self->bmp_header, BMP_HEADER_SIZE);
+
+  /* Bottom-up rows */
+  dst = output->data + BMP_HEADER_SIZE;
+  for (y = 0; y < height; y++)
+    {
+      const uint32_t *src = get_oriented_row (self, pixels, stride, height - y - 1);
+      size_t padding = self->bmp_row_size - width * 3;
+
+      convert_row (src, dst, width, TRUE);
+
+      if (padding > 0)
+        memset (dst + width * 3, 0, padding);
+
+      dst += self->bmp_row_size;
+    }
+
+  return TRUE;
+}
+
+
+/*
+ * JPEG
+ */
+
+static void
+jpeg_error_exit_cb (j_common_ptr cinfo)
+{
+  JpegErrorManager *error_manager = (JpegErrorManager *) cinfo->err;
+
+  error_manager->pub.format_message (cinfo, error_manager->message);
+  longjmp (error_manager->setjmp_buffer, 1);
+}
+
+static void
+jpeg_output_message_cb (j_common_ptr cinfo)
+{
+  /* Warnings are not interesting for in-memory encoding */
+}
+
+static void
+jpeg_init_destination_cb (j_compress_ptr cinfo)
+{
+  JpegDestinationManager *destination = (JpegDestinationManager *) cinfo->dest;
+  GByteArray *output = destination->output;
+
+  /* Raw pixel data is a generous upper bound at this quality */
+  g_byte_array_set_size (output, cinfo->image_width * cinfo->image_height * 3);
+
+  destination->pub.next_output_byte = output->data;
+  destination->pub.free_in_buffer = output->len;
+}
+
+static boolean
+jpeg_empty_output_buffer_cb (j_compress_ptr cinfo)
+{
+  JpegDestinationManager *destination = (JpegDestinationManager *) cinfo->dest;
+  GByteArray *output = destination->output;
+  size_t used = output->len;
+
+  /* Per libjpeg contract, the whole buffer is full when this is called */
+  g_byte_array_set_size (output, used * 2);
+
+  destination->pub.next_output_byte = output->data + used;
+  destination->pub.free_in_buffer = output->len - used;
+
+  return TRUE;
+}
+
+static void
+jpeg_term_destination_cb (j_compress_ptr cinfo)
+{
+  JpegDestinationManager *destination = (JpegDestinationManager *) cinfo->dest;
+  GByteArray *output = destination->output;
+
+  g_byte_array_set_size (output, output->len - destination->pub.free_in_buffer);
+}
+
+static void
+init_jpeg (BsImageEncoder *self)
+{
+  self->jpeg.err = jpeg_std_error (&self->jpeg_error.pub);
+  self->jpeg_error.pub.error_exit = jpeg_error_exit_cb;
+  self->jpeg_error.pub.output_message = jpeg_output_message_cb;
+
+  jpeg_create_compress (&self->jpeg);
+  self->jpeg_initialized = TRUE;
+
+  self->jpeg_destination.pub.init_destination = jpeg_init_destination_cb;
+  self->jpeg_destination.pub.empty_output_buffer = jpeg_empty_output_buffer_cb;
+  self->jpeg_destination.pub.term_destination = jpeg_term_destination_cb;
+  self->jpeg.dest = &self->jpeg_destination.pub;
+
+  self->jpeg.image_width = self->image_info.width;
+  self->jpeg.image_height = self->image_info.height;
+#ifdef JPEG_NATIVE_COLOR_SPACE
+  self->jpeg.input_components = 4;
+  self->jpeg.in_color_space = JPEG_NATIVE_COLOR_SPACE;
+#else
+  self->jpeg.input_components = 3;
+  self->jpeg.in_color_space = JCS_RGB;
+#endif
+
+  jpeg_set_defaults (&self->jpeg);
+  jpeg_set_quality (&self->jpeg, JPEG_QUALITY, TRUE);
+}
+
+static gboolean
+encode_jpeg (BsImageEncoder  *self,
+             const uint8_t   *pixels,
+             size_t           stride,
+             GByteArray      *output,
+             GError         **error)
+{
+  self->jpeg_destination.output = output;
+
+  if (setjmp (self->jpeg_error.setjmp_buffer))
+    {
+      /* Leaves the compressor ready to be reused */
+      jpeg_abort_compress (&self->jpeg);
+      g_byte_array_set_size (output, 0);
+
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_FAILED,
+                   "Failed to encode JPEG: %s",
+                   self->jpeg_error.message);
+      return FALSE;
+    }
+
+  jpeg_start_compress (&self->jpeg, TRUE);
+
+  while (self->jpeg.next_scanline < self->jpeg.image_height)
+    {
+      const uint32_t *src = get_oriented_row (self, pixels, stride, self->jpeg.next_scanline);
+      JSAMPROW row;
+
+#ifdef JPEG_NATIVE_COLOR_SPACE
+      row = (JSAMPROW) src;
+#else
+      convert_row (src, self->row, self->image_info.width, FALSE);
+      row = self->row;
+#endif
+
+      jpeg_write_scanlines (&self->jpeg, &row, 1);
+    }
+
+  jpeg_finish_compress (&self->jpeg);
+
+  return TRUE;
+}
+
+
+/*
+ * Public API
+ */
+
+/**
+ * bs_image_encoder_new:
+ * @image_info: the image info of the device
+ *
+ * Creates a new #BsImageEncoder for images described by @image_info.
+ * The encoder keeps its state across calls, and is not thread-safe.
+ *
+ * Returns: (transfer full): a #BsImageEncoder
+ */
+BsImageEncoder *
+bs_image_encoder_new (const BsImageInfo *image_info)
+{
+  BsImageEncoder *self;
+
+  g_return_val_if_fail (image_info != NULL, NULL);
+
+  self = g_new0 (BsImageEncoder, 1);
+  self->image_info = *image_info;
+  self->row = g_malloc (image_info->width * 3);
+  self->oriented_row = g_new (uint32_t, image_info->width);
+
+  switch (image_info->format)
+    {
+    case BS_IMAGE_FORMAT_BMP:
+      init_bmp (self);
+      break;
+
+    case BS_IMAGE_FORMAT_JPEG:
+      init_jpeg (self);
+      break;
+
+    default:
+      g_assert_not_reached ();
+    }
+
+  return self;
+}
+
+void
+bs_image_encoder_free (BsImageEncoder *self)
+{
+  g_return_if_fail (self != NULL);
+
+  if (self->jpeg_initialized)
+    jpeg_destroy_compress (&self->jpeg);
+
+  g_clear_pointer (&self->row, g_free);
+  g_clear_pointer (&self->oriented_row, g_free);
+  g_free (self);
+}
+
+/**
+ * bs_image_encoder_encode:
+ * @self: a #BsImageEncoder
+ * @pixels: premultiplied pixels in the native-endian cairo ARGB32 layout,
+ *   in logical orientation
+ * @stride: the stride of @pixels
+ * @output: the array to write the encoded image into
+ * @error: (nullable): return location for a #GError
+ *
+ * Encodes @pixels into @output, replacing its previous contents. The
+ * dimensions of @pixels must match the image info of @self, and its
+ * flip and rotation flags are applied to the encoded image.
+ *
+ * Returns: whether the image was encoded
+ */
+gboolean
+bs_image_encoder_encode (BsImageEncoder  *self,
+                         const uint8_t   *pixels,
+                         size_t           stride,
+                         GByteArray      *output,
+                         GError         **error)
+{
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (pixels != NULL, FALSE);
+  g_return_val_if_fail (stride >= self->image_info.width * 4, FALSE);
+  g_return_val_if_fail (output != NULL, FALSE);
+
+  switch (self->image_info.format)
+    {
+    case BS_IMAGE_FORMAT_BMP:
+      return encode_bmp (self, pixels, stride, output);
+
+    case BS_IMAGE_FORMAT_JPEG:
+      return encode_jpeg (self, pixels, stride, output, error);
+
+    default:
+      g_assert_not_reached ();
+    }
+}
@@ -0,0 +1,42 @@
+/* bs-image-encoder.h
+ *
+ * Copyright 2022 Georges Basile Stavracas Neto <georges.stavracas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <glib.h>
+#include <stdint.h>
+
+#include "bs-types.h"
+
+G_BEGIN_DECLS
+
+BsImageEncoder * bs_image_encoder_new (const BsImageInfo *image_info);
+
+void bs_image_encoder_free (BsImageEncoder *self);
+
+gboolean bs_image_encoder_encode (BsImageEncoder  *self,
+                                  const uint8_t   *pixels,
+                                  size_t           stride,
+                                  GByteArray      *output,
+                                  GError         **error);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (BsImageEncoder, bs_image_encoder_free)
+
+G_END_DECLS
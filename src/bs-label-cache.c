@@ -0,0 +1,205 @@
+/* bs-label-cache.c
+ *
+ * Copyright 2022 Georges Basile Stavracas Neto <georges.stavracas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define G_LOG_DOMAIN "Label Cache"
+
+#include "bs-label-cache.h"
+
+#include <gtk/gtk.h>
+#include <math.h>
+#include <pango/pangocairo.h>
+
+#define MAX_CACHED_LAYOUTS 512
+
+/*
+ * Icon labels are short, and come from a handful of fonts, but they are
+ * set on every icon of every page, and some actions cycle through the same
+ * few labels many times per second. All labels share one Pango context per
+ * resolution, so fonts are loaded once and Pango and cairo can keep their
+ * own glyph caches warm across icons. On top of that, shaped layouts are
+ * kept in an LRU, so setting a label that was shown recently is a lookup.
+ *
+ * Layouts handed out are shared between icons, and must not be modified.
+ * Evicting a layout only drops the cache's reference to it.
+ *
+ * Labels are only ever set and snapshotted on the main thread, so none of
+ * this is locked.
+ */
+
+typedef struct
+{
+  char *key;
+  PangoLayout *layout;
+} CachedLayout;
+
+/* resolution → PangoContext */
+static GHashTable *contexts = NULL;
+
+/* font string → PangoFontDescription */
+static GHashTable *font_descriptions = NULL;
+
+/* key → GList link in layouts_lru */
+static GHashTable *layouts = NULL;
+
+/* Most recently used first */
+static GQueue layouts_lru = G_QUEUE_INIT;
+
+
+/*
+ * Auxiliary methods
+ */
+
+static void
+cached_layout_free (gpointer data)
+{
+  CachedLayout *cached_layout = data;
+
+  g_clear_pointer (&cached_layout->key, g_free);
+  g_clear_object (&cached_layout->layout);
+  g_free (cached_layout);
+}
+
+static void
+ensure_caches (void)
+{
+  if (G_LIKELY (contexts))
+    return;
+
+  contexts = g_hash_table_new_full (NULL, NULL, NULL, g_object_unref);
+  font_descriptions = g_hash_table_new_full (g_str_hash,
+                                             g_str_equal,
+                                             g_free,
+                                             (GDestroyNotify) pango_font_description_free);
+  layouts = g_hash_table_new (g_str_hash, g_str_equal);
+}
+
+static PangoContext *
+get_context (double dpi)
+{
+  PangoContext *pango_context;
+  gpointer key;
+
+  key = GUINT_TO_POINTER ((unsigned int) lround (dpi * 100.0));
+  pango_context = g_hash_table_lookup (contexts, key);
+
+  if (!pango_context)
+    {
+      pango_context = pango_font_map_create_context (pango_cairo_font_map_get_default ());
+      pango_context_set_language (pango_context, gtk_get_default_language ());
+      pango_cairo_context_set_resolution (pango_context, dpi);
+
+      g_hash_table_insert (contexts, key, pango_context);
+    }
+
+  return pango_context;
+}
+
+static const PangoFontDescription *
+get_font_description (const char *font)
+{
+  PangoFontDescription *font_description;
+
+  font_description = g_hash_table_lookup (font_descriptions, font);
+
+  if (!font_description)
+    {
+      font_description = pango_font_description_from_string (font);
+      g_hash_table_insert (font_descriptions, g_strdup (font), font_description);
+    }
+
+  return font_description;
+}
+
+static void
+evict_layouts (void)
+{
+  while (g_queue_get_length (&layouts_lru) > MAX_CACHED_LAYOUTS)
+    {
+      CachedLayout *cached_layout = g_queue_pop_tail (&layouts_lru);
+
+      g_hash_table_remove (layouts, cached_layout->key);
+      cached_layout_free (cached_layout);
+    }
+}
+
+
+/*
+ * Public API
+ */
+
+/**
+ * bs_label_cache_get_layout:
+ * @text: text of the label
+ * @font: a font description string, as in pango_font_description_from_string()
+ * @dpi: resolution of the device
+ *
+ * Retrieves a shaped layout for @text, reusing a cached one if @text was
+ * laid out with the same @font and @dpi recently.
+ *
+ * The returned layout is shared, and must not be modified.
+ *
+ * Must be called on the main thread.
+ *
+ * Returns: (transfer full): a #PangoLayout
+ */
+PangoLayout *
+bs_label_cache_get_layout (const char *text,
+                           const char *font,
+                           double      dpi)
+{
+  g_autofree char *key = NULL;
+  CachedLayout *cached_layout;
+  GList *link;
+
+  g_return_val_if_fail (text != NULL, NULL);
+  g_return_val_if_fail (font != NULL, NULL);
+  g_return_val_if_fail (dpi > 0.0, NULL);
+
+  ensure_caches ();
+
+  /* Font and resolution go first, since they cannot contain newlines */
+  key = g_strdup_printf ("%s\n%g\n%s", font, dpi, text);
+  link = g_hash_table_lookup (layouts, key);
+
+  if (link)
+    {
+      g_queue_unlink (&layouts_lru, link);
+      g_queue_push_head_link (&layouts_lru, link);
+
+      cached_layout = link->data;
+      return g_object_ref (cached_layout->layout);
+    }
+
+  cached_layout = g_new0 (CachedLayout, 1);
+  cached_layout->key = g_steal_pointer (&key);
+  cached_layout->layout = pango_layout_new (get_context (dpi));
+  pango_layout_set_font_description (cached_layout->layout, get_font_description (font));
+  pango_layout_set_text (cached_layout->layout, text, -1);
+
+  /* Shape now, instead of on the first snapshot */
+  pango_layout_get_pixel_size (cached_layout->layout, NULL, NULL);
+
+  g_queue_push_head (&layouts_lru, cached_layout);
+  g_hash_table_insert (layouts, cached_layout->key, layouts_lru.head);
+
+  evict_layouts ();
+
+  return g_object_ref (cached_layout->layout);
+}
@@ -0,0 +1,74 @@
+/* bs-profiler.h
+ *
+ * Copyright 2022 Georges Basile Stavracas Neto <georges.stavracas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include "bs-config.h"
+
+#include <glib.h>
+
+/*
+ * Marks for Sysprof captures, when built with -Dprofiler=true. Marks are
+ * only formatted while Sysprof is recording. Timestamps are in nanoseconds,
+ * as returned by BS_PROFILER_CURRENT_TIME.
+ */
+
+#ifdef HAVE_SYSPROF
+
+# include <sysprof-capture.h>
+
+# define BS_PROFILER_CURRENT_TIME SYSPROF_CAPTURE_CURRENT_TIME
+
+/**
+ * BS_PROFILER_ADD_MARK:
+ * @_begin: when the marked operation started
+ * @_name: name of the mark
+ * @...: printf-like format of the mark message, and its arguments
+ *
+ * Adds a mark spanning from @_begin until now.
+ */
+# define BS_PROFILER_ADD_MARK(_begin, _name, ...)                             \
+   G_STMT_START {                                                               \
+      if (sysprof_collector_is_active ())                                       \
+        sysprof_collector_mark_printf ((_begin),                                \
+                                       SYSPROF_CAPTURE_CURRENT_TIME - (_begin), \
+                                       "Boatswain",                             \
+                                       (_name),                                 \
+                                       __VA_ARGS__);                            \
+   } G_STMT_END
+
+#else
+
+# define BS_PROFILER_CURRENT_TIME 0
+
+/**
+ * BS_PROFILER_ADD_MARK:
+ * @_begin: when the marked operation started
+ * @_name: name of the mark
+ * @...: printf-like format of the mark message, and its arguments
+ *
+ * Adds a mark spanning from @_begin until now.
+ */
+# define BS_PROFILER_ADD_MARK(_begin, _name, ...)                             \
+   G_STMT_START {                                                               \
+      (void) (_begin);                                                          \
+   } G_STMT_END
+
+#endif
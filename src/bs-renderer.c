@@ -19,24 +19,104 @@
  */
 
 #include "bs-icon.h"
+#include "bs-image-encoder.h"
 #include "bs-renderer.h"
 
+/*
+ * Render nodes are drawn with cairo straight into image surfaces that are
+ * kept around, and the encoder reads from them. This avoids realizing a
+ * GskRenderer and creating a GdkTexture per image.
+ *
+ * Snapshotting must happen on the main thread, but rendering nodes can
+ * happen on any thread. Each concurrent render takes its own target from
+ * a pool, so the pool grows up to the number of threads rendering.
+ */
+
+typedef struct
+{
+  cairo_surface_t *surface;
+  cairo_t *cr;
+  BsImageEncoder *encoder;
+} RenderTarget;
+
 struct _BsRenderer
 {
   GObject parent_instance;
 
   BsImageInfo image_info;
-  GskRenderer *renderer;
+
+  GMutex mutex;
+  GPtrArray *idle_targets;
 };
 
 G_DEFINE_FINAL_TYPE (BsRenderer, bs_renderer, G_TYPE_OBJECT)
 
+
+/*
+ * Auxiliary methods
+ */
+
+static RenderTarget *
+render_target_new (const BsImageInfo *image_info)
+{
+  RenderTarget *target;
+
+  target = g_new0 (RenderTarget, 1);
+  target->encoder = bs_image_encoder_new (image_info);
+  target->surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                                image_info->width,
+                                                image_info->height);
+  target->cr = cairo_create (target->surface);
+
+  return target;
+}
+
+static void
+render_target_free (RenderTarget *target)
+{
+  g_clear_pointer (&target->cr, cairo_destroy);
+  g_clear_pointer (&target->surface, cairo_surface_destroy);
+  g_clear_pointer (&target->encoder, bs_image_encoder_free);
+  g_free (target);
+}
+
+static RenderTarget *
+acquire_render_target (BsRenderer *self)
+{
+  RenderTarget *target = NULL;
+
+  g_mutex_lock (&self->mutex);
+  if (self->idle_targets->len > 0)
+    target = g_ptr_array_steal_index_fast (self->idle_targets, self->idle_targets->len - 1);
+  g_mutex_unlock (&self->mutex);
+
+  if (!target)
+    target = render_target_new (&self->image_info);
+
+  return target;
+}
+
+static void
+release_render_target (BsRenderer   *self,
+                       RenderTarget *target)
+{
+  g_mutex_lock (&self->mutex);
+  g_ptr_array_add (self->idle_targets, target);
+  g_mutex_unlock (&self->mutex);
+}
+
+
+/*
+ * GObject overrides
+ */
+
 static void
 bs_renderer_finalize (GObject *object)
 {
   BsRenderer *self = (BsRenderer *)object;
 
-  g_clear_object (&self->renderer);
+  g_clear_pointer (&self->idle_targets, g_ptr_array_unref);
+  g_mutex_clear (&self->mutex);
 
   G_OBJECT_CLASS (bs_renderer_parent_class)->finalize (object);
 }
@@ -52,7 +132,8 @@ bs_renderer_class_init (BsRendererClass *klass)
 static void
 bs_renderer_init (BsRenderer *self)
 {
-  self->renderer = gsk_cairo_renderer_new ();
+  g_mutex_init (&self->mutex);
+  self->idle_targets = g_ptr_array_new_with_free_func ((GDestroyNotify) render_target_free);
 }
 
 BsRenderer *
@@ -63,52 +144,28 @@ bs_renderer_new (const BsImageInfo *image_info)
   self = g_object_new (BS_TYPE_RENDERER, NULL);
   self->image_info = *image_info;
 
+  /* Most of the time, a single target is enough */
+  g_ptr_array_add (self->idle_targets, render_target_new (image_info));
+
   return self;
 }
 
-GdkTexture *
-bs_renderer_compose_icon (BsRenderer  *self,
-                          BsIcon      *icon,
-                          GError     **error)
+GskRenderNode *
+bs_renderer_snapshot_icon (BsRenderer *self,
+                           BsIcon     *icon)
 {
   g_autoptr (GtkSnapshot) snapshot = NULL;
-  g_autoptr (GskRenderNode) node = NULL;
-  g_autoptr (GdkTexture) texture = NULL;
-  gboolean flip_x;
-  gboolean flip_y;
   double height;
   double width;
 
   g_return_val_if_fail (BS_IS_RENDERER (self), NULL);
 
-  if (!gsk_renderer_realize (self->renderer, NULL, error))
-    return NULL;
-
   snapshot = gtk_snapshot_new ();
 
-  flip_x = self->image_info.flags & BS_RENDERER_FLAG_FLIP_X;
-  flip_y = self->image_info.flags & BS_RENDERER_FLAG_FLIP_Y;
-
   width = (double) self->image_info.width;
   height = (double) self->image_info.height;
 
-  if (self->image_info.flags & BS_RENDERER_FLAG_ROTATE_90)
-    {
-      gtk_snapshot_translate (snapshot,
-                              &GRAPHENE_POINT_INIT (width / 2.0, height / 2.0));
-      gtk_snapshot_rotate (snapshot, 90.0);
-      gtk_snapshot_translate (snapshot,
-                              &GRAPHENE_POINT_INIT (-width / 2.0, -height / 2.0));
-    }
-
-  gtk_snapshot_translate (snapshot,
-                          &GRAPHENE_POINT_INIT (flip_x ? width : 0.0,
-                                                flip_y ? height : 0.0));
-
-  gtk_snapshot_scale (snapshot,
-                      flip_x ? -1.0 : 1.0,
-                      flip_y ? -1.0 : 1.0);
-
+  /* Device orientation is applied by the encoder */
   if (icon)
     {
       bs_icon_snapshot_premultiplied (icon, snapshot, width, height);
@@ -120,109 +177,94 @@ bs_renderer_compose_icon (BsRenderer  *self,
                                  &GRAPHENE_RECT_INIT (0, 0, width, height));
     }
 
-  node = gtk_snapshot_free_to_node (g_steal_pointer (&snapshot));
-
-  texture = gsk_renderer_render_texture (self->renderer,
-                                         node,
-                                         &GRAPHENE_RECT_INIT (0, 0, width, height));
-  gsk_renderer_unrealize (self->renderer);
-
-  return g_steal_pointer (&texture);
+  return gtk_snapshot_free_to_node (g_steal_pointer (&snapshot));
 }
 
-GdkTexture *
-bs_renderer_compose_touchscreen_content (BsRenderer            *self,
-                                         BsTouchscreenContent  *content,
-                                         GError               **error)
+GskRenderNode *
+bs_renderer_snapshot_touchscreen_content (BsRenderer           *self,
+                                          BsTouchscreenContent *content)
 {
-  g_autoptr (GskRenderNode) node = NULL;
   g_autoptr (GtkSnapshot) snapshot = NULL;
-  g_autoptr (GdkTexture) texture = NULL;
-  gboolean flip_x;
-  gboolean flip_y;
   double height;
   double width;
 
   g_return_val_if_fail (BS_IS_RENDERER (self), NULL);
 
-  if (!gsk_renderer_realize (self->renderer, NULL, error))
-    return NULL;
-
-  flip_x = self->image_info.flags & BS_RENDERER_FLAG_FLIP_X;
-  flip_y = self->image_info.flags & BS_RENDERER_FLAG_FLIP_Y;
-
   width = (double) self->image_info.width;
   height = (double) self->image_info.height;
 
   snapshot = gtk_snapshot_new ();
 
-  if (self->image_info.flags & BS_RENDERER_FLAG_ROTATE_90)
-    {
-      gtk_snapshot_translate (snapshot,
-                              &GRAPHENE_POINT_INIT (width / 2.0, height / 2.0));
-      gtk_snapshot_rotate (snapshot, 90.0);
-      gtk_snapshot_translate (snapshot,
-                              &GRAPHENE_POINT_INIT (-width / 2.0, -height / 2.0));
-    }
-
-  gtk_snapshot_translate (snapshot,
-                          &GRAPHENE_POINT_INIT (flip_x ? width : 0.0,
-                                                flip_y ? height : 0.0));
-
-  gtk_snapshot_scale (snapshot,
-                      flip_x ? -1.0 : 1.0,
-                      flip_y ? -1.0 : 1.0);
-
   gdk_paintable_snapshot (GDK_PAINTABLE (content), snapshot, width, height);
 
-  node = gtk_snapshot_free_to_node (g_steal_pointer (&snapshot));
-
-  texture = gsk_renderer_render_texture (self->renderer,
-                                         node,
-                                         &GRAPHENE_RECT_INIT (0, 0, width, height));
-  gsk_renderer_unrealize (self->renderer);
-
-  return g_steal_pointer (&texture);
+  return gtk_snapshot_free_to_node (g_steal_pointer (&snapshot));
 }
 
+/**
+ * bs_renderer_render_node:
+ * @self: a #BsRenderer
+ * @node: (nullable): a #GskRenderNode
+ * @output: the array to write the encoded image into
+ * @error: (nullable): return location for a #GError
+ *
+ * Draws @node and encodes the result into @output, in the format the
+ * device expects. A %NULL @node results in a transparent image.
+ *
+ * This function is thread-safe.
+ *
+ * Returns: whether the image was rendered and encoded
+ */
 gboolean
-bs_renderer_convert_texture (BsRenderer  *self,
-                             GdkTexture  *texture,
-                             char       **buffer,
-                             size_t      *buffer_len,
-                             GError     **error)
+bs_renderer_render_node (BsRenderer     *self,
+                         GskRenderNode  *node,
+                         GByteArray     *output,
+                         GError        **error)
 {
-  g_autoptr (GdkPixbuf) pixbuf = NULL;
+  RenderTarget *target;
+  gboolean success;
+  cairo_t *cr;
 
   g_return_val_if_fail (BS_IS_RENDERER (self), FALSE);
-  g_return_val_if_fail (GDK_IS_TEXTURE (texture), FALSE);
-  g_return_val_if_fail (buffer != NULL, FALSE);
-  g_return_val_if_fail (buffer_len != NULL, FALSE);
+  g_return_val_if_fail (output != NULL, FALSE);
 
-G_GNUC_BEGIN_IGNORE_DEPRECATIONS
-  pixbuf = gdk_pixbuf_get_from_texture (texture);
-G_GNUC_END_IGNORE_DEPRECATIONS
+  target = acquire_render_target (self);
+  cr = target->cr;
 
-  switch (self->image_info.format)
+  cairo_save (cr);
+  cairo_set_operator (cr, CAIRO_OPERATOR_CLEAR);
+  cairo_paint (cr);
+  cairo_restore (cr);
+
+  if (node)
     {
-    case BS_IMAGE_FORMAT_BMP:
-      return gdk_pixbuf_save_to_buffer (pixbuf,
-                                        buffer,
-                                        buffer_len,
-                                        "bmp",
-                                        error,
-                                        NULL);
-
-    case BS_IMAGE_FORMAT_JPEG:
-      return gdk_pixbuf_save_to_buffer (pixbuf,
-                                        buffer,
-                                        buffer_len,
-                                        "jpeg",
-                                        error,
-                                        "quality", "96",
-                                        NULL);
-
-    default:
-      g_assert_not_reached ();
+      cairo_save (cr);
+      gsk_render_node_draw (node, cr);
+      cairo_restore (cr);
     }
+
+  cairo_surface_flush (target->surface);
+
+  if (cairo_status (cr) == CAIRO_STATUS_SUCCESS)
+    {
+      success = bs_image_encoder_encode (target->encoder,
+                                         cairo_image_surface_get_data (target->surface),
+                                         cairo_image_surface_get_stride (target->surface),
+                                         output,
+                                         error);
+      release_render_target (self, target);
+    }
+  else
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_FAILED,
+                   "Failed to render image: %s",
+                   cairo_status_to_string (cairo_status (cr)));
+
+      /* Cairo contexts in error states are unusable */
+      render_target_free (target);
+      success = FALSE;
+    }
+
+  return success;
 }
@@ -54,18 +54,15 @@ G_DECLARE_FINAL_TYPE (BsRenderer, bs_renderer, BS, RENDERER, GObject)
 
 BsRenderer * bs_renderer_new (const BsImageInfo *layout);
 
-GdkTexture * bs_renderer_compose_icon (BsRenderer  *self,
-                                       BsIcon      *icon,
-                                       GError     **error);
+GskRenderNode * bs_renderer_snapshot_icon (BsRenderer *self,
+                                           BsIcon     *icon);
 
-GdkTexture * bs_renderer_compose_touchscreen_content (BsRenderer            *self,
-                                                      BsTouchscreenContent  *content,
-                                                      GError               **error);
+GskRenderNode * bs_renderer_snapshot_touchscreen_content (BsRenderer           *self,
+                                                          BsTouchscreenContent *content);
 
-gboolean bs_renderer_convert_texture (BsRenderer  *self,
-                                      GdkTexture  *texture,
-                                      char       **buffer,
-                                      size_t      *buffer_len,
-                                      GError     **error);
+gboolean bs_renderer_render_node (BsRenderer     *self,
+                                  GskRenderNode  *node,
+                                  GByteArray     *output,
+                                  GError        **error);
 
 G_END_DECLS
@@ -20,17 +20,84 @@
 
 #pragma once
 
+#include "bs-hid-transport.h"
 #include "bs-stream-deck.h"
 
 #include <gusb.h>
 
 G_BEGIN_DECLS
 
+/*
+ * Durations are counted in power-of-two buckets: bucket 0 counts durations
+ * under 1 µs, bucket i counts durations from 2^(i-1) µs up to 2^i µs, and
+ * the last bucket counts everything longer.
+ */
+#define BS_STREAM_DECK_N_HISTOGRAM_BUCKETS 20
+
+typedef struct
+{
+  /* Upload queue */
+  uint64_t n_upload_requests;
+  uint64_t n_dropped_uploads;
+  uint64_t n_uploads;
+  uint64_t n_failed_uploads;
+  uint32_t queue_depth;
+  uint32_t max_queue_depth;
+
+  /* Upload budget */
+  uint64_t n_deferred_uploads;
+  uint64_t n_priority_uploads;
+
+  /* Encoded image cache */
+  uint64_t n_unchanged_images;
+  uint64_t n_changed_images;
+  uint64_t n_cached_animation_frames;
+
+  /* Rendering and encoding */
+  uint64_t total_encode_time_us;
+  uint64_t encode_time_histogram[BS_STREAM_DECK_N_HISTOGRAM_BUCKETS];
+
+  /* I/O */
+  uint64_t n_io_request_waits;
+  uint64_t n_bytes_written;
+
+  /* Input */
+  uint64_t n_input_reports;
+  uint64_t total_input_latency_us;
+  uint64_t max_input_latency_us;
+  uint64_t input_latency_histogram[BS_STREAM_DECK_N_HISTOGRAM_BUCKETS];
+
+  /* Profiles */
+  uint64_t n_profile_saves;
+  uint64_t last_profile_save_us;
+  uint64_t max_profile_save_us;
+} BsStreamDeckStats;
+
 BsStreamDeck * bs_stream_deck_new (GUsbDevice  *gusb_device,
                                    GError     **error);
 
+void bs_stream_deck_new_async (GUsbDevice          *gusb_device,
+                               GCancellable        *cancellable,
+                               GAsyncReadyCallback  callback,
+                               gpointer             user_data);
+
+BsStreamDeck * bs_stream_deck_new_finish (GAsyncResult  *result,
+                                          GError       **error);
+
 BsStreamDeck * bs_stream_deck_new_fake (GError **error);
 
+unsigned int bs_stream_deck_get_n_models (void);
+
+uint16_t bs_stream_deck_get_model_product_id (unsigned int model_index);
+
+gboolean bs_stream_deck_get_model_has_button_images (unsigned int model_index);
+
+uint32_t bs_stream_deck_get_max_button_size (void);
+
+BsStreamDeck * bs_stream_deck_new_with_transport (BsHidTransport  *transport,
+                                                  uint16_t         product_id,
+                                                  GError         **error);
+
 GUsbDevice * bs_stream_deck_get_device (BsStreamDeck *self);
 
 GListModel * bs_stream_deck_get_regions (BsStreamDeck *self);
@@ -40,12 +107,24 @@ BsDeviceRegion * bs_stream_deck_get_region (BsStreamDeck *self,
 
 gboolean bs_stream_deck_is_initialized (BsStreamDeck *self);
 
-gboolean bs_stream_deck_upload_button (BsStreamDeck  *self,
-                                       BsButton      *button,
-                                       GError       **error);
+void bs_stream_deck_queue_button_upload (BsStreamDeck *self,
+                                         BsButton     *button);
+
+void bs_stream_deck_queue_touchscreen_upload (BsStreamDeck  *self,
+                                              BsTouchscreen *touchscreen);
+
+void bs_stream_deck_get_stats (BsStreamDeck      *self,
+                               BsStreamDeckStats *stats);
+
+size_t bs_stream_deck_get_n_keys (BsStreamDeck *self);
+
+double bs_stream_deck_get_key_frame_rate (BsStreamDeck *self,
+                                          size_t        key);
 
-gboolean bs_stream_deck_upload_touchscreen (BsStreamDeck   *self,
-                                            BsTouchscreen  *touchscreen,
+gboolean bs_stream_deck_write_button_image (BsStreamDeck   *self,
+                                            BsButton       *button,
+                                            const uint8_t  *image,
+                                            size_t          image_size,
                                             GError        **error);
 
 void bs_stream_deck_load (BsStreamDeck *self);
@@ -28,18 +28,31 @@
 #include "bs-device-region.h"
 #include "bs-dial-private.h"
 #include "bs-dial-grid-region.h"
+#include "bs-hid-recorder.h"
+#include "bs-hid-transport.h"
 #include "bs-icon.h"
 #include "bs-page.h"
 #include "bs-profile.h"
+#include "bs-profiler.h"
 #include "bs-renderer.h"
 #include "bs-stream-deck-private.h"
 #include "bs-touchscreen-private.h"
 #include "bs-touchscreen-region.h"
+#include "bs-usb-transport.h"
 
 #include <glib/gi18n.h>
-#include <hidapi.h>
 
-#define POLL_RATE_MS 16
+#define IO_REQUESTS_PER_KEY 4
+#define MAX_TRANSFERS_IN_FLIGHT 8
+#define FEATURE_REPORT_MAX_LENGTH 32
+#define MAX_UPLOAD_THREADS 4
+
+#define BRIGHTNESS_DIM_FADE_US (2 * G_USEC_PER_SEC)
+#define BRIGHTNESS_WAKE_FADE_US (150 * G_TIME_SPAN_MILLISECOND)
+
+#define UPLOAD_BURST_US G_USEC_PER_SEC
+#define INPUT_PRIORITY_US (500 * G_TIME_SPAN_MILLISECOND)
+#define FRAME_RATE_WINDOW_US G_USEC_PER_SEC
 
 G_STATIC_ASSERT (sizeof (unsigned char) == sizeof (uint8_t));
 
@@ -48,6 +61,7 @@ typedef enum
   BS_STREAM_DECK_FEATURE_BUTTONS = 1 << 0,
   BS_STREAM_DECK_FEATURE_TOUCHSCREEN = 1 << 1,
   BS_STREAM_DECK_FEATURE_DIALS = 1 << 2,
+  BS_STREAM_DECK_FEATURE_BUTTON_IMAGES = 1 << 3,
 } BsStreamDeckFeatureFlags;
 
 typedef struct
@@ -78,29 +92,132 @@ typedef struct
   BsButtonLayout button_layout;
   BsDialLayout dial_layout;
   BsTouchscreenLayout touchscreen_layout;
+  size_t output_report_size;
 
   void (*reset) (BsStreamDeck *self);
-  void (*set_brightness) (BsStreamDeck *self,
-                          double        brightness);
+  size_t (*build_brightness_report) (BsStreamDeck *self,
+                                     double        brightness,
+                                     uint8_t      *report);
 
   char * (*get_serial_number) (BsStreamDeck *self);
   char * (*get_firmware_version) (BsStreamDeck *self);
-  gboolean (*set_button_texture) (BsStreamDeck  *self,
-                                  BsButton      *button,
-                                  GdkTexture    *texture,
-                                  GError       **error);
-  gboolean (*set_touchscreen_texture) (BsStreamDeck   *self,
-                                       BsTouchscreen  *touchscreen,
-                                       GdkTexture     *texture,
-                                       GError        **error);
-  gboolean (*read_button_states) (BsStreamDeck *self);
+  gboolean (*set_button_image) (BsStreamDeck   *self,
+                                BsButton       *button,
+                                const uint8_t  *image,
+                                size_t          image_size,
+                                GError        **error);
+  gboolean (*set_touchscreen_image) (BsStreamDeck   *self,
+                                     BsTouchscreen  *touchscreen,
+                                     const uint8_t  *image,
+                                     size_t          image_size,
+                                     GError        **error);
+  void (*handle_input_report) (BsStreamDeck  *self,
+                               const uint8_t *report,
+                               size_t         length);
 } StreamDeckModelInfo;
 
+typedef struct _IoRequest IoRequest;
+
+/* Keys of the images requests are part of, so failures can be retried */
+#define NO_IMAGE_KEY G_MAXSIZE
+
+struct _IoRequest
+{
+  IoRequest *next;
+  BsStreamDeck *stream_deck;
+  BsHidReportType type;
+  size_t key;
+  size_t length;
+  uint8_t data[];
+};
+
+typedef enum
+{
+  IO_STATE_SYNCHRONOUS, /* Before the I/O thread starts */
+  IO_STATE_RUNNING,
+  IO_STATE_STOPPING,
+} IoState;
+
+/* Intrusive, so that queueing never allocates */
+typedef struct
+{
+  IoRequest *head;
+  IoRequest *tail;
+} IoRequestList;
+
 typedef struct
 {
   GSource source;
   BsStreamDeck *stream_deck;
-} StreamDeckSource;
+} BrightnessSource;
+
+typedef struct
+{
+  double from;
+  double to;
+  int64_t start_time;
+  int64_t duration;
+} BrightnessFade;
+
+typedef struct
+{
+  uint64_t hash;
+  size_t length; /* 0 if nothing was uploaded yet */
+
+  /* Renders finish out of order, and older images must not win */
+  uint64_t queued_generation;
+  uint64_t written_generation;
+
+  /* Images written in the current window, and the rate of the last one. Protected by budget_lock */
+  int64_t window_start;
+  unsigned int n_window_frames;
+  double frame_rate;
+
+  /* Only touched by the main thread */
+  int64_t last_input_time;
+} KeyImage;
+
+/*
+ * Encoded frames of the animation shown by a button, indexed by frame.
+ * They stay valid while the button shows the same icon with the same
+ * serial, so animations are only rendered and encoded during their first
+ * loop. The icon is only compared, never dereferenced.
+ */
+typedef struct
+{
+  BsIcon *icon;
+  uint64_t serial;
+  GBytes **frames;
+  unsigned int n_frames;
+} AnimationCache;
+
+typedef struct
+{
+  BsStreamDeck *stream_deck;
+  GPtrArray *tasks;
+  int n_pending;
+} UploadBatch;
+
+/* Batches and tasks are recycled in the main thread */
+
+typedef struct
+{
+  UploadBatch *batch;
+  gpointer target; /* BsButton or BsTouchscreen */
+  BsRenderer *renderer;
+  GskRenderNode *node;
+  size_t key;
+  uint64_t generation;
+
+  /* Already encoded, only written */
+  GBytes *payload;
+
+  /* Where to cache the encoded image, if it is an animation frame */
+  gboolean cache_frame;
+  BsIcon *animation_icon;
+  uint64_t animation_serial;
+  unsigned int animation_frame;
+} UploadTask;
 
 struct _BsStreamDeck
 {
@@ -112,24 +229,143 @@ struct _BsStreamDeck
   GQueue *active_pages;
   guint save_timeout_id;
 
+  /* Buttons and touchscreens waiting to be uploaded, newest state wins */
+  GPtrArray *pending_uploads;
+  GPtrArray *flushing_uploads;
+  guint flush_uploads_id;
+  GPtrArray *idle_upload_batches;
+  GPtrArray *idle_upload_tasks;
+  BsStreamDeckStats stats;
+
+  /*
+   * Images are rendered and encoded in a thread pool, and written from
+   * there. Each device has its own pool, since writes block until the
+   * device takes the image, and a stalled device must not hold up the
+   * uploads of others. The last image sent to each button, followed by the touchscreen,
+   * is tracked in key_images to skip writing images the device already
+   * shows. upload_lock protects key_images and the upload statistics,
+   * except queued_generation, which only the main thread touches.
+   *
+   * The encoded frames of animated buttons are cached in animation_caches,
+   * which animation_lock protects, along with the count of cached frames
+   * sent. It is only held to look up or store a frame, since the main
+   * thread takes it on every frame of an animation.
+   */
+  GThreadPool *upload_thread_pool;
+  GMutex upload_lock;
+  KeyImage *key_images;
+  size_t n_key_images;
+  GMutex animation_lock;
+  AnimationCache *animation_caches;
+
+  /*
+   * Uploads are paced by two token buckets, refilled at the configured
+   * frames and bytes per second, and holding up to UPLOAD_BURST_US worth
+   * of them. Flushes take one frame token per image, and writes take byte
+   * tokens. While either bucket is empty, uploads stay pending, and newer
+   * states of the same key replace them, so animations drop frames rather
+   * than queueing. Keys that received input in the last INPUT_PRIORITY_US
+   * are uploaded regardless. A rate of 0 disables the bucket.
+   *
+   * budget_lock protects the byte bucket and rate, and the frame rate
+   * windows of key_images. It is only held for a few instructions, and
+   * never across I/O, since the main thread takes it on every flush. The
+   * rest belongs to the main thread.
+   */
+  GMutex budget_lock;
+  unsigned int max_upload_frame_rate;
+  unsigned int max_upload_byte_rate;
+  double upload_frame_tokens;
+  double upload_byte_tokens;
+  int64_t upload_budget_time;
+  gboolean flush_uploads_deferred;
+
+  /*
+   * Held by upload threads while writing an image, which may wait for the
+   * device to free I/O requests, so that the packets of each image are
+   * contiguous in the I/O queue. The main thread never takes it.
+   */
+  GMutex write_lock;
+
   const StreamDeckModelInfo *model_info;
   GUsbDevice *device;
-  hid_device *handle;
+  BsHidTransport *transport;
 
   double brightness;
   char *serial_number;
   char *firmware_version;
   GIcon *icon;
-  GSource *poll_source;
+
+  /*
+   * Writes and feature reports are queued in io_requests, and submitted as
+   * asynchronous transfers by a dedicated I/O thread, which runs io_context
+   * and keeps up to MAX_TRANSFERS_IN_FLIGHT of them in flight. Feature
+   * reports are barriers: they wait for all previous transfers, and hold
+   * back the following ones, so that e.g. a reset is never overtaken.
+   *
+   * Requests come from free_io_requests, which is preallocated from the
+   * model info and never grows; when it runs out, producers wait on io_cond
+   * until transfers complete. Both lists, and io_state, are protected by
+   * io_lock. n_transfers_in_flight and io_barrier are only touched by the
+   * I/O thread.
+   *
+   * Input reports are pushed by the transport in the main thread.
+   */
+  GThread *io_thread;
+  GMainContext *io_context;
+  GMutex io_lock;
+  GCond io_cond;
+  IoRequestList io_requests;
+  IoRequestList free_io_requests;
+  size_t io_request_capacity;
+  IoState io_state;
+  unsigned int n_transfers_in_flight;
+  gboolean io_barrier;
+
+  /*
+   * Brightness changes only update brightness_fade, and are sent by
+   * brightness_source, in the I/O thread, at most once per
+   * brightness_update_interval. Bursts thus coalesce into the latest value,
+   * and fades are interpolated without involving the main thread. Both are
+   * protected by io_lock; the other brightness fields belong to the I/O
+   * thread.
+   */
+  GSource *brightness_source;
+  BrightnessFade brightness_fade;
+  int64_t brightness_update_interval;
+  int64_t last_brightness_update;
+  int device_brightness_percent;
+
+  /* Dimming on idle, and waking up on input */
+  GSettings *settings;
+  guint idle_dim_timeout_id;
+  int64_t last_activity_time;
+  gboolean dimmed;
+
+  /*
+   * Input dispatch tables, built once regions exist. input_buttons maps the
+   * order of key states in input reports to buttons, and input_dials does
+   * the same for dials. Pointers are borrowed from the regions, which live
+   * as long as the device. The last seen states are kept alongside, so that
+   * only changes are dispatched.
+   */
+  BsButton **input_buttons;
+  uint8_t *button_states;
+  BsDial **input_dials;
+  uint8_t *dial_states;
+
   gboolean initialized;
   gboolean loaded;
   gboolean fake;
+  gboolean ephemeral;
 };
 
 static void g_initable_iface_init (GInitableIface *iface);
+static void g_async_initable_iface_init (GAsyncInitableIface *iface);
 
 G_DEFINE_FINAL_TYPE_WITH_CODE (BsStreamDeck, bs_stream_deck, G_TYPE_OBJECT,
-                               G_IMPLEMENT_INTERFACE (G_TYPE_INITABLE, g_initable_iface_init))
+                               G_IMPLEMENT_INTERFACE (G_TYPE_INITABLE, g_initable_iface_init)
+                               G_IMPLEMENT_INTERFACE (G_TYPE_ASYNC_INITABLE, g_async_initable_iface_init))
 
 G_DEFINE_QUARK (BsStreamDeck, bs_stream_deck_error);
 
@@ -154,6 +390,15 @@ static GParamSpec *properties[N_PROPS];
  * Auxiliary methods
  */
 
+static inline void
+add_to_histogram (uint64_t *histogram,
+                  int64_t   duration_us)
+{
+  unsigned int bucket = duration_us > 0 ? g_bit_storage (duration_us) : 0;
+
+  histogram[MIN (bucket, BS_STREAM_DECK_N_HISTOGRAM_BUCKETS - 1)]++;
+}
+
 static char *
 get_profile_path (BsStreamDeck *self)
 {
@@ -181,6 +426,80 @@ find_button_at_region (BsStreamDeck *self,
   return button;
 }
 
+static inline uint8_t
+swap_button_index_original (BsStreamDeck *self,
+                            uint8_t       button_index)
+{
+  int column = button_index % self->model_info->button_layout.columns;
+  int actual_index = ((int) button_index - column) + ((int) self->model_info->button_layout.columns - 1 - column);
+  return (uint8_t) actual_index;
+}
+
+static void
+build_input_dispatch_tables (BsStreamDeck *self,
+                             gboolean      swap_button_indexes)
+{
+  uint8_t n_buttons = self->model_info->button_layout.n_buttons;
+  uint8_t n_dials = self->model_info->dial_layout.n_dials;
+
+  self->input_buttons = g_new0 (BsButton *, n_buttons);
+  self->button_states = g_new0 (uint8_t, n_buttons);
+
+  for (uint8_t i = 0; i < n_buttons; i++)
+    {
+      uint8_t position = swap_button_indexes ? swap_button_index_original (self, i) : i;
+
+      self->input_buttons[i] = find_button_at_region (self, "main-button-grid", position);
+    }
+
+  if (self->model_info->features & BS_STREAM_DECK_FEATURE_DIALS)
+    {
+      BsDialGridRegion *dial_grid;
+      GListModel *dials;
+
+      dial_grid = BS_DIAL_GRID_REGION (bs_stream_deck_get_region (self, "dial-grid"));
+      dials = bs_dial_grid_region_get_dials (dial_grid);
+
+      g_assert (g_list_model_get_n_items (dials) == n_dials);
+
+      self->input_dials = g_new0 (BsDial *, n_dials);
+      self->dial_states = g_new0 (uint8_t, n_dials);
+
+      for (uint8_t i = 0; i < n_dials; i++)
+        {
+          g_autoptr (BsDial) dial = g_list_model_get_item (dials, i);
+          self->input_dials[i] = dial;
+        }
+    }
+}
+
+/*
+ * Dispatches button states, one byte per button in report order, that
+ * changed since the last report.
+ */
+static inline void
+dispatch_button_states (BsStreamDeck  *self,
+                        const uint8_t *states)
+{
+  uint8_t n_buttons = self->model_info->button_layout.n_buttons;
+
+  if (memcmp (self->button_states, states, n_buttons) == 0)
+    return;
+
+  for (uint8_t i = 0; i < n_buttons; i++)
+    {
+      if (self->button_states[i] == states[i])
+        continue;
+
+      self->button_states[i] = states[i];
+
+      /* Before updating the button, so that its new image is prioritized */
+      self->key_images[bs_button_get_position (self->input_buttons[i])].last_input_time = g_get_monotonic_time ();
+
+      bs_button_set_pressed (self->input_buttons[i], (gboolean) states[i]);
+    }
+}
+
 static void
 update_pages (BsStreamDeck *self)
 {
@@ -211,168 +530,1489 @@ save_profiles (BsStreamDeck *self)
   g_autoptr (GError) error = NULL;
   g_autofree char *profile_path = NULL;
   g_autofree char *json_str = NULL;
+  int64_t start_time;
+  int64_t duration;
+  int64_t begin;
 
   BS_ENTRY;
 
-  if (self->fake)
+  if (self->fake || self->ephemeral)
     BS_RETURN ();
 
-  /* Update the active profile */
-  bs_profile_set_brightness (self->active_profile, self->brightness);
-  update_pages (self);
+  begin = BS_PROFILER_CURRENT_TIME;
+  start_time = g_get_monotonic_time ();
+
+  /* Update the active profile */
+  bs_profile_set_brightness (self->active_profile, self->brightness);
+  update_pages (self);
+
+  builder = json_builder_new ();
+
+  json_builder_begin_object (builder);
+
+  json_builder_set_member_name (builder, "active-profile");
+  json_builder_add_string_value (builder, bs_profile_get_id (self->active_profile));
+
+  json_builder_set_member_name (builder, "profiles");
+  json_builder_begin_array (builder);
+  for (size_t i = 0; i < g_list_model_get_n_items (G_LIST_MODEL (self->profiles)); i++)
+    {
+      g_autoptr (BsProfile) profile = NULL;
+
+      profile = g_list_model_get_item (G_LIST_MODEL (self->profiles), i);
+      json_builder_add_value (builder, bs_profile_to_json (profile));
+    }
+  json_builder_end_array (builder);
+
+  json_builder_end_object (builder);
+
+  root = json_builder_get_root (builder);
+
+  generator = json_generator_new ();
+  json_generator_set_pretty (generator, TRUE);
+  json_generator_set_root (generator, root);
+  json_str = json_generator_to_data (generator, NULL);
+
+  profile_path = get_profile_path (self);
+  g_file_set_contents (profile_path, json_str, -1, &error);
+
+  if (error)
+    g_warning ("Error saving profiles: %s", error->message);
+
+  duration = g_get_monotonic_time () - start_time;
+  self->stats.n_profile_saves++;
+  self->stats.last_profile_save_us = duration;
+  self->stats.max_profile_save_us = MAX (self->stats.max_profile_save_us, duration);
+
+  BS_PROFILER_ADD_MARK (begin, "Save profiles", "serial=%s", self->serial_number);
+
+  BS_EXIT;
+}
+
+static void
+load_profiles (BsStreamDeck  *self)
+{
+  g_autoptr (JsonParser) parser = NULL;
+  g_autoptr (BsProfile) active_profile = NULL;
+  g_autoptr (GError) local_error = NULL;
+  g_autofree char *profile_path = NULL;
+  const char *active_profile_id;
+  JsonObject *object;
+  JsonArray *profiles_array;
+  JsonNode *root;
+
+  BS_ENTRY;
+
+  profile_path = get_profile_path (self);
+
+  g_debug ("Loading %s", profile_path);
+
+  parser = json_parser_new ();
+
+  json_parser_load_from_file (parser, profile_path, &local_error);
+  if (local_error)
+    {
+      g_debug ("Error loading profile for device %s: %s",
+               self->serial_number,
+               local_error->message);
+      BS_GOTO (out);
+    }
+
+  root = json_parser_get_root (parser);
+  object = json_node_get_object (root);
+
+  active_profile = NULL;
+  active_profile_id = json_object_get_string_member (object, "active-profile");
+
+  profiles_array = json_object_get_array_member (object, "profiles");
+  for (size_t i = 0; i < json_array_get_length (profiles_array); i++)
+    {
+      g_autoptr (BsProfile) profile = NULL;
+      JsonNode *profile_node;
+
+      profile_node = json_array_get_element (profiles_array, i);
+
+      if (!profile_node)
+        continue;
+
+      profile = bs_profile_new_from_json (self, profile_node);
+      g_list_store_append (self->profiles, profile);
+
+      if (g_strcmp0 (active_profile_id, bs_profile_get_id (profile)) == 0)
+        active_profile = g_object_ref (profile);
+    }
+
+  if (!active_profile)
+    active_profile = g_list_model_get_item (G_LIST_MODEL (self->profiles), 0);
+
+out:
+  if (!active_profile)
+    {
+      active_profile = bs_profile_new_empty (self);
+      bs_profile_set_name (active_profile, _("Default"));
+      g_list_store_append (self->profiles, active_profile);
+    }
+
+  bs_stream_deck_load_profile (self, active_profile);
+
+  BS_EXIT;
+}
+
+static void
+load_active_page (BsStreamDeck *self)
+{
+  BsPage *active_page;
+
+  BS_ENTRY;
+
+  active_page = bs_stream_deck_get_active_page (self);
+
+  for (uint8_t i = 0; i < self->model_info->button_layout.n_buttons; i++)
+    {
+      BsButton *button;
+      g_autoptr (BsAction) action = NULL;
+      g_autoptr (BsIcon) custom_icon = NULL;
+      g_autoptr (GError) error = NULL;
+
+      button = find_button_at_region (self, "main-button-grid", i);
+
+      bs_page_realize (active_page, button, &custom_icon, &action, &error);
+
+      if (error)
+        {
+          g_warning ("Failed to construct action and icon from page: %s", error->message);
+          continue;
+        }
+
+      bs_button_inhibit_page_updates (button);
+
+      bs_button_set_action (button, action);
+      bs_button_set_custom_icon (button, custom_icon);
+
+      bs_button_uninhibit_page_updates (button);
+    }
+
+  BS_EXIT;
+}
+
+static uint64_t
+hash_image (const uint8_t *data,
+            size_t         length)
+{
+  const uint64_t prime = G_GUINT64_CONSTANT (0x100000001b3);
+  uint64_t hash = G_GUINT64_CONSTANT (0xcbf29ce484222325) ^ length;
+  size_t i = 0;
+
+  /* FNV-1a over 64-bit words, with an extra shift to mix high bits down */
+  for (; i + sizeof (uint64_t) <= length; i += sizeof (uint64_t))
+    {
+      uint64_t word;
+
+      memcpy (&word, data + i, sizeof (uint64_t));
+
+      hash = (hash ^ word) * prime;
+      hash ^= hash >> 29;
+    }
+
+  for (; i < length; i++)
+    hash = (hash ^ data[i]) * prime;
+
+  return hash;
+}
+
+static inline size_t
+get_touchscreen_image_key (BsStreamDeck *self)
+{
+  return self->model_info->button_layout.n_buttons;
+}
+
+/*
+ * Returns whether @data differs from the last image uploaded to @key, and
+ * remembers it as the current one. Must be called with upload_lock held.
+ */
+static gboolean
+check_image_changed (BsStreamDeck  *self,
+                     size_t         key,
+                     const uint8_t *data,
+                     size_t         length)
+{
+  KeyImage *key_image;
+  uint64_t hash;
+
+  g_assert (key < self->n_key_images);
+
+  key_image = &self->key_images[key];
+  hash = hash_image (data, length);
+
+  if (key_image->length == length && key_image->hash == hash)
+    {
+      self->stats.n_unchanged_images++;
+      return FALSE;
+    }
+
+  key_image->hash = hash;
+  key_image->length = length;
+
+  self->stats.n_changed_images++;
+  return TRUE;
+}
+
+static void
+forget_uploaded_image (BsStreamDeck *self,
+                       size_t        key)
+{
+  g_assert (key < self->n_key_images);
+
+  self->key_images[key].length = 0;
+}
+
+static void
+forget_uploaded_images (BsStreamDeck *self)
+{
+  g_autoptr (GMutexLocker) locker = g_mutex_locker_new (&self->upload_lock);
+
+  for (size_t i = 0; i < self->n_key_images; i++)
+    forget_uploaded_image (self, i);
+}
+
+static void
+animation_cache_clear (AnimationCache *cache)
+{
+  for (unsigned int i = 0; i < cache->n_frames; i++)
+    g_clear_pointer (&cache->frames[i], g_bytes_unref);
+
+  g_clear_pointer (&cache->frames, g_free);
+  cache->n_frames = 0;
+  cache->icon = NULL;
+  cache->serial = 0;
+}
+
+/*
+ * Returns the encoded image of @frame of @animation, shown by @icon on the
+ * button at @key, if it was encoded already. A different icon, or a change
+ * to it, discards the cached frames. Must be called with animation_lock held.
+ */
+static GBytes *
+lookup_animation_frame (BsStreamDeck *self,
+                        size_t        key,
+                        BsIcon       *icon,
+                        BsAnimation  *animation,
+                        unsigned int  frame)
+{
+  AnimationCache *cache;
+  uint64_t serial;
+
+  g_assert (key < self->model_info->button_layout.n_buttons);
+
+  cache = &self->animation_caches[key];
+  serial = bs_icon_get_serial (icon);
+
+  if (cache->icon != icon || cache->serial != serial)
+    {
+      animation_cache_clear (cache);
+
+      cache->icon = icon;
+      cache->serial = serial;
+      cache->n_frames = bs_animation_get_n_frames (animation);
+      cache->frames = g_new0 (GBytes *, cache->n_frames);
+    }
+
+  if (frame >= cache->n_frames || !cache->frames[frame])
+    return NULL;
+
+  self->stats.n_cached_animation_frames++;
+
+  return g_bytes_ref (cache->frames[frame]);
+}
+
+/*
+ * Caches @image as the frame that @task rendered, unless the button moved
+ * on to another icon meanwhile. Must be called with animation_lock held.
+ */
+static void
+store_animation_frame (BsStreamDeck  *self,
+                       UploadTask    *task,
+                       const uint8_t *image,
+                       size_t         length)
+{
+  AnimationCache *cache;
+
+  g_assert (task->cache_frame);
+
+  cache = &self->animation_caches[task->key];
+
+  if (cache->icon != task->animation_icon ||
+      cache->serial != task->animation_serial ||
+      task->animation_frame >= cache->n_frames ||
+      cache->frames[task->animation_frame])
+    {
+      return;
+    }
+
+  cache->frames[task->animation_frame] = g_bytes_new (image, length);
+}
+
+static void
+io_request_list_push (IoRequestList *list,
+                      IoRequest     *request)
+{
+  request->next = NULL;
+
+  if (list->tail)
+    list->tail->next = request;
+  else
+    list->head = request;
+
+  list->tail = request;
+}
+
+static IoRequest *
+io_request_list_pop (IoRequestList *list)
+{
+  IoRequest *request = list->head;
+
+  if (request)
+    {
+      list->head = request->next;
+      if (!list->head)
+        list->tail = NULL;
+      request->next = NULL;
+    }
+
+  return request;
+}
+
+static void
+io_request_list_clear (IoRequestList *list)
+{
+  IoRequest *request;
+
+  while ((request = io_request_list_pop (list)) != NULL)
+    g_free (request);
+}
+
+static inline IoRequest *
+io_request_alloc (BsStreamDeck *self)
+{
+  IoRequest *request;
+
+  request = g_malloc (sizeof (IoRequest) + self->io_request_capacity * sizeof (uint8_t));
+  request->stream_deck = self;
+
+  return request;
+}
+
+static void
+preallocate_io_requests (BsStreamDeck *self)
+{
+  size_t n_requests;
+
+  self->io_request_capacity = MAX (self->model_info->output_report_size,
+                                   FEATURE_REPORT_MAX_LENGTH);
+
+  n_requests = self->n_key_images * IO_REQUESTS_PER_KEY;
+  for (size_t i = 0; i < n_requests; i++)
+    io_request_list_push (&self->free_io_requests, io_request_alloc (self));
+}
+
+static IoRequest *
+acquire_io_request (BsStreamDeck    *self,
+                    BsHidReportType  type,
+                    size_t           length)
+{
+  IoRequest *request;
+
+  g_assert (length <= self->io_request_capacity);
+
+  g_mutex_lock (&self->io_lock);
+
+  /* Back-pressure: wait for the device to catch up */
+  if (!self->free_io_requests.head)
+    self->stats.n_io_request_waits++;
+
+  while ((request = io_request_list_pop (&self->free_io_requests)) == NULL)
+    g_cond_wait (&self->io_cond, &self->io_lock);
+
+  g_mutex_unlock (&self->io_lock);
+
+  request->type = type;
+  request->key = NO_IMAGE_KEY;
+  request->length = length;
+
+  return request;
+}
+
+/*
+ * Makes the next upload of the image @request was part of write it again,
+ * instead of leaving a partial or stale image on the device.
+ */
+static void
+forget_failed_image (BsStreamDeck *self,
+                     IoRequest    *request)
+{
+  if (request->key == NO_IMAGE_KEY)
+    return;
+
+  g_mutex_lock (&self->upload_lock);
+
+  /* Counts each image once, not each of its failed packets */
+  if (self->key_images[request->key].length > 0)
+    self->stats.n_failed_uploads++;
+
+  forget_uploaded_image (self, request->key);
+
+  g_mutex_unlock (&self->upload_lock);
+}
+
+static void
+finish_io_request (BsStreamDeck *self,
+                   IoRequest    *request,
+                   gboolean      success)
+{
+  if (!success)
+    forget_failed_image (self, request);
+
+  g_mutex_lock (&self->io_lock);
+  if (success)
+    self->stats.n_bytes_written += request->length;
+  io_request_list_push (&self->free_io_requests, request);
+  g_cond_signal (&self->io_cond);
+  g_mutex_unlock (&self->io_lock);
+}
+
+static gboolean
+run_io_request (BsStreamDeck *self,
+                IoRequest    *request)
+{
+  g_autoptr (GError) error = NULL;
+
+  if (!bs_hid_transport_send_report (self->transport,
+                                     request->type,
+                                     request->data,
+                                     request->length,
+                                     &error))
+    {
+      g_debug ("Failed to write to Stream Deck: %s", error->message);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/*
+ * Takes ownership of @request. Requests are executed in order by the I/O
+ * thread; before the thread is running, they are executed right away, and
+ * once it is stopping, they are dropped.
+ */
+static void
+submit_io_request (BsStreamDeck *self,
+                   IoRequest    *request)
+{
+  IoState io_state;
+
+  g_mutex_lock (&self->io_lock);
+
+  io_state = self->io_state;
+
+  /* Under the lock, so that the thread can't exit and free the context first */
+  if (io_state == IO_STATE_RUNNING)
+    {
+      io_request_list_push (&self->io_requests, request);
+      g_main_context_wakeup (self->io_context);
+    }
+
+  g_mutex_unlock (&self->io_lock);
+
+  switch (io_state)
+    {
+    case IO_STATE_SYNCHRONOUS:
+      finish_io_request (self, request, run_io_request (self, request));
+      break;
+
+    case IO_STATE_RUNNING:
+      break;
+
+    case IO_STATE_STOPPING:
+      g_debug ("Dropping request submitted after the I/O thread stopped");
+      finish_io_request (self, request, FALSE);
+      break;
+    }
+}
+
+static void
+send_feature_report (BsStreamDeck  *self,
+                     const uint8_t *data,
+                     size_t         length)
+{
+  IoRequest *request;
+
+  request = acquire_io_request (self, BS_HID_REPORT_FEATURE, length);
+  memcpy (request->data, data, length);
+
+  submit_io_request (self, request);
+}
+
+static void
+on_io_transfer_finished_cb (GObject      *source_object,
+                            GAsyncResult *result,
+                            gpointer      user_data)
+{
+  g_autoptr (GError) error = NULL;
+  IoRequest *request = user_data;
+  BsStreamDeck *self = request->stream_deck;
+
+  if (!bs_hid_transport_send_report_finish (self->transport, request->type, result, &error))
+    g_debug ("Failed to write to Stream Deck: %s", error->message);
+
+  if (request->type == BS_HID_REPORT_FEATURE)
+    self->io_barrier = FALSE;
+
+  self->n_transfers_in_flight--;
+  finish_io_request (self, request, error == NULL);
+}
+
+static void
+start_io_transfer (BsStreamDeck *self,
+                   IoRequest    *request)
+{
+  self->n_transfers_in_flight++;
+
+  if (request->type == BS_HID_REPORT_FEATURE)
+    self->io_barrier = TRUE;
+
+  bs_hid_transport_send_report_async (self->transport,
+                                      request->type,
+                                      request->data,
+                                      request->length,
+                                      on_io_transfer_finished_cb,
+                                      request);
+}
+
+/* Called with io_lock held */
+static IoRequest *
+pop_startable_io_request (BsStreamDeck *self)
+{
+  IoRequest *request = self->io_requests.head;
+
+  if (!request || self->io_barrier)
+    return NULL;
+
+  if (self->n_transfers_in_flight >= MAX_TRANSFERS_IN_FLIGHT)
+    return NULL;
+
+  if (request->type == BS_HID_REPORT_FEATURE && self->n_transfers_in_flight > 0)
+    return NULL;
+
+  return io_request_list_pop (&self->io_requests);
+}
+
+static gpointer
+io_thread_func (gpointer data)
+{
+  BsStreamDeck *self = BS_STREAM_DECK (data);
+
+  /* Transfers started here complete here */
+  g_main_context_push_thread_default (self->io_context);
+
+  g_mutex_lock (&self->io_lock);
+
+  for (;;)
+    {
+      IoRequest *request;
+
+      while ((request = pop_startable_io_request (self)) != NULL)
+        {
+          g_mutex_unlock (&self->io_lock);
+          start_io_transfer (self, request);
+          g_mutex_lock (&self->io_lock);
+        }
+
+      /* Pending requests, e.g. the reset issued when finalizing, are flushed first */
+      if (self->io_state != IO_STATE_RUNNING && !self->io_requests.head && self->n_transfers_in_flight == 0)
+        break;
+
+      g_mutex_unlock (&self->io_lock);
+      g_main_context_iteration (self->io_context, TRUE);
+      g_mutex_lock (&self->io_lock);
+    }
+
+  g_mutex_unlock (&self->io_lock);
+
+  g_main_context_pop_thread_default (self->io_context);
+
+  return NULL;
+}
+
+static void
+start_io_thread (BsStreamDeck *self)
+{
+  g_assert (self->io_thread == NULL);
+
+  self->io_context = g_main_context_new ();
+
+  /* Requests queued from now on wait for the thread */
+  g_mutex_lock (&self->io_lock);
+  self->io_state = IO_STATE_RUNNING;
+  g_mutex_unlock (&self->io_lock);
+
+  self->io_thread = g_thread_new ("Stream Deck I/O", io_thread_func, self);
+}
+
+static void
+stop_io_thread (BsStreamDeck *self)
+{
+  if (!self->io_thread)
+    return;
+
+  g_mutex_lock (&self->io_lock);
+  self->io_state = IO_STATE_STOPPING;
+  g_mutex_unlock (&self->io_lock);
+
+  g_main_context_wakeup (self->io_context);
+
+  g_clear_pointer (&self->io_thread, g_thread_join);
+  g_clear_pointer (&self->io_context, g_main_context_unref);
+}
+
+static void
+get_feature_report (BsStreamDeck *self,
+                    uint8_t      *data,
+                    size_t        length)
+{
+  g_autoptr (GError) error = NULL;
+
+  if (!bs_hid_transport_get_feature_report (self->transport, data, length, &error))
+    {
+      g_warning ("Failed to read feature report 0x%02x: %s", data[0], error->message);
+      memset (data + 1, 0, length - 1);
+    }
+}
+
+
+/*
+ * Brightness
+ */
+
+static inline uint8_t
+brightness_to_percent (double brightness)
+{
+  return CLAMP (brightness * 100, 0, 100);
+}
+
+static double
+brightness_fade_get_value (const BrightnessFade *fade,
+                           int64_t               time)
+{
+  double t;
+
+  if (time >= fade->start_time + fade->duration)
+    return fade->to;
+
+  /* Smoothstep, so that fades neither start nor end abruptly */
+  t = (double) (time - fade->start_time) / fade->duration;
+  t = t * t * (3.0 - 2.0 * t);
+
+  return fade->from + (fade->to - fade->from) * t;
+}
+
+static gboolean
+brightness_source_dispatch (GSource     *source,
+                            GSourceFunc  callback,
+                            gpointer     user_data)
+{
+  BrightnessSource *brightness_source = (BrightnessSource *)source;
+  BsStreamDeck *self = brightness_source->stream_deck;
+  IoRequest *request;
+  gboolean fading;
+  int64_t interval;
+  int64_t now;
+  double brightness;
+
+  /* Reset first, so that requests made in the meantime wake up the source again */
+  g_source_set_ready_time (source, -1);
+
+  now = g_get_monotonic_time ();
+
+  g_mutex_lock (&self->io_lock);
+  brightness = brightness_fade_get_value (&self->brightness_fade, now);
+  fading = now < self->brightness_fade.start_time + self->brightness_fade.duration;
+  interval = self->brightness_update_interval;
+  g_mutex_unlock (&self->io_lock);
+
+  if (now < self->last_brightness_update + interval)
+    {
+      g_source_set_ready_time (source, self->last_brightness_update + interval);
+      return G_SOURCE_CONTINUE;
+    }
+
+  if (brightness_to_percent (brightness) != self->device_brightness_percent)
+    {
+      g_mutex_lock (&self->io_lock);
+
+      /* Never wait for requests here, only this thread gives them back */
+      request = io_request_list_pop (&self->free_io_requests);
+
+      if (!request)
+        {
+          g_mutex_unlock (&self->io_lock);
+          g_source_set_ready_time (source, now + interval);
+          return G_SOURCE_CONTINUE;
+        }
+
+      request->type = BS_HID_REPORT_FEATURE;
+      request->length = self->model_info->build_brightness_report (self, brightness, request->data);
+
+      g_assert (request->length <= self->io_request_capacity);
+
+      if (request->length > 0)
+        io_request_list_push (&self->io_requests, request);
+      else
+        io_request_list_push (&self->free_io_requests, request);
+
+      g_mutex_unlock (&self->io_lock);
+
+      self->device_brightness_percent = brightness_to_percent (brightness);
+      self->last_brightness_update = now;
+    }
+
+  if (fading)
+    g_source_set_ready_time (source, now + interval);
+
+  return G_SOURCE_CONTINUE;
+}
+
+GSourceFuncs brightness_source_funcs =
+{
+  NULL, /* prepare */
+  NULL, /* check */
+  brightness_source_dispatch,
+  NULL, NULL, NULL,
+};
+
+static void
+update_brightness_rate (BsStreamDeck *self)
+{
+  unsigned int rate = g_settings_get_uint (self->settings, "brightness-update-rate");
+
+  g_mutex_lock (&self->io_lock);
+  self->brightness_update_interval = G_USEC_PER_SEC / MAX (rate, 1);
+  g_mutex_unlock (&self->io_lock);
+}
+
+static void
+update_upload_budget (BsStreamDeck *self)
+{
+  int64_t now = g_get_monotonic_time ();
+  double burst_seconds = (double) UPLOAD_BURST_US / G_USEC_PER_SEC;
+
+  /* Start over with a full burst, so that no debt carries over */
+  self->max_upload_frame_rate = g_settings_get_uint (self->settings, "upload-frame-rate");
+  self->upload_frame_tokens = burst_seconds * self->max_upload_frame_rate;
+  self->upload_budget_time = now;
+
+  g_mutex_lock (&self->budget_lock);
+  self->max_upload_byte_rate = g_settings_get_uint (self->settings, "upload-byte-rate");
+  self->upload_byte_tokens = burst_seconds * self->max_upload_byte_rate;
+  g_mutex_unlock (&self->budget_lock);
+}
+
+static void
+start_brightness_updates (BsStreamDeck *self)
+{
+  BrightnessSource *brightness_source;
+  GSource *source;
+
+  g_assert (self->io_context != NULL);
+  g_assert (self->brightness_source == NULL);
+
+  self->brightness_fade = (BrightnessFade) {
+    .from = self->brightness,
+    .to = self->brightness,
+  };
+  self->device_brightness_percent = -1;
+
+  source = g_source_new (&brightness_source_funcs, sizeof (BrightnessSource));
+  brightness_source = (BrightnessSource *)source;
+  brightness_source->stream_deck = self;
+
+  g_source_set_name (source, "Stream Deck brightness");
+  g_source_attach (source, self->io_context);
+
+  self->brightness_source = source;
+}
+
+static void
+stop_brightness_updates (BsStreamDeck *self)
+{
+  if (!self->brightness_source)
+    return;
+
+  g_source_destroy (self->brightness_source);
+  g_clear_pointer (&self->brightness_source, g_source_unref);
+}
+
+/*
+ * Fades the brightness of the device to @brightness over @duration
+ * microseconds, starting from wherever the current fade is. This does not
+ * change the brightness property, and returns immediately.
+ */
+static void
+fade_device_brightness (BsStreamDeck *self,
+                        double        brightness,
+                        int64_t       duration)
+{
+  int64_t now;
+
+  if (!self->brightness_source)
+    {
+      uint8_t data[FEATURE_REPORT_MAX_LENGTH];
+      size_t length;
+
+      /* Nothing to interpolate with before the I/O thread runs */
+      length = self->model_info->build_brightness_report (self, brightness, data);
+      if (length > 0)
+        send_feature_report (self, data, length);
+      return;
+    }
+
+  now = g_get_monotonic_time ();
+
+  g_mutex_lock (&self->io_lock);
+  self->brightness_fade = (BrightnessFade) {
+    .from = brightness_fade_get_value (&self->brightness_fade, now),
+    .to = brightness,
+    .start_time = now,
+    .duration = duration,
+  };
+  g_mutex_unlock (&self->io_lock);
+
+  g_source_set_ready_time (self->brightness_source, 0);
+}
+
+static gboolean
+idle_dim_timeout_cb (gpointer data)
+{
+  BsStreamDeck *self = BS_STREAM_DECK (data);
+  int64_t timeout;
+  int64_t elapsed;
+  double dim_brightness;
+
+  self->idle_dim_timeout_id = 0;
+
+  timeout = g_settings_get_uint (self->settings, "idle-dim-timeout") * G_USEC_PER_SEC;
+  if (timeout == 0)
+    return G_SOURCE_REMOVE;
+
+  /* Input doesn't restart the timeout, it only moves the deadline */
+  elapsed = g_get_monotonic_time () - self->last_activity_time;
+  if (elapsed < timeout)
+    {
+      self->idle_dim_timeout_id = g_timeout_add ((timeout - elapsed) / G_TIME_SPAN_MILLISECOND + 1,
+                                                 idle_dim_timeout_cb,
+                                                 self);
+      return G_SOURCE_REMOVE;
+    }
+
+  dim_brightness = MIN (g_settings_get_double (self->settings, "idle-dim-brightness"),
+                        self->brightness);
+
+  self->dimmed = TRUE;
+  fade_device_brightness (self, dim_brightness, BRIGHTNESS_DIM_FADE_US);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+schedule_idle_dim (BsStreamDeck *self)
+{
+  unsigned int timeout;
+
+  g_clear_handle_id (&self->idle_dim_timeout_id, g_source_remove);
+
+  timeout = g_settings_get_uint (self->settings, "idle-dim-timeout");
+  if (timeout > 0 && !self->dimmed)
+    self->idle_dim_timeout_id = g_timeout_add_seconds (timeout, idle_dim_timeout_cb, self);
+}
+
+static void
+notify_activity (BsStreamDeck *self)
+{
+  self->last_activity_time = g_get_monotonic_time ();
+
+  if (self->dimmed)
+    {
+      self->dimmed = FALSE;
+      fade_device_brightness (self, self->brightness, BRIGHTNESS_WAKE_FADE_US);
+    }
+
+  if (self->idle_dim_timeout_id == 0)
+    schedule_idle_dim (self);
+}
+
+
+static GByteArray *
+get_thread_image_buffer (void)
+{
+  static GPrivate image_buffer = G_PRIVATE_INIT ((GDestroyNotify) g_byte_array_unref);
+  GByteArray *buffer;
+
+  buffer = g_private_get (&image_buffer);
+  if (!buffer)
+    {
+      buffer = g_byte_array_new ();
+      g_private_set (&image_buffer, buffer);
+    }
+
+  return buffer;
+}
+
+static UploadTask *
+upload_task_new (BsStreamDeck  *self,
+                 UploadBatch   *batch,
+                 gpointer       target,
+                 BsRenderer    *renderer,
+                 GskRenderNode *node,
+                 size_t         key)
+{
+  UploadTask *task;
+
+  g_assert (key < self->n_key_images);
+
+  if (self->idle_upload_tasks->len > 0)
+    task = g_ptr_array_steal_index_fast (self->idle_upload_tasks, self->idle_upload_tasks->len - 1);
+  else
+    task = g_new (UploadTask, 1);
+
+  *task = (UploadTask) {
+    .batch = batch,
+    .target = g_object_ref (target),
+    .renderer = g_object_ref (renderer),
+    .node = node ? gsk_render_node_ref (node) : NULL,
+    .key = key,
+    .generation = ++self->key_images[key].queued_generation,
+  };
+
+  return task;
+}
+
+static void
+add_upload_tasks (BsStreamDeck *self,
+                  UploadBatch  *batch,
+                  gpointer      target)
+{
+  g_autoptr (GskRenderNode) node = NULL;
+  BsDeviceRegion *region;
+  BsRenderer *renderer;
+  int64_t begin;
+
+  begin = BS_PROFILER_CURRENT_TIME;
+
+  if (BS_IS_BUTTON (target))
+    {
+      g_autoptr (GBytes) payload = NULL;
+      BsAnimation *animation = NULL;
+      unsigned int frame = 0;
+      UploadTask *task;
+      BsIcon *icon;
+      size_t key;
+
+      g_assert (self->model_info->set_button_image != NULL);
+
+      region = bs_button_get_region (target);
+      renderer = bs_device_region_get_renderer (region);
+      icon = bs_button_get_icon (target);
+      key = bs_button_get_position (target);
+
+      if (icon)
+        animation = bs_icon_get_animation (icon, &frame);
+
+      if (animation)
+        {
+          g_mutex_lock (&self->animation_lock);
+          payload = lookup_animation_frame (self, key, icon, animation, frame);
+          g_mutex_unlock (&self->animation_lock);
+        }
+
+      /* Frames of animations are only composed during their first loop */
+      if (payload)
+        {
+          task = upload_task_new (self, batch, target, renderer, NULL, key);
+          task->payload = g_steal_pointer (&payload);
+
+          BS_PROFILER_ADD_MARK (begin,
+                                "Cached frame",
+                                "serial=%s key=%zu frame=%u",
+                                self->serial_number,
+                                key,
+                                frame);
+        }
+      else
+        {
+          node = bs_renderer_snapshot_icon (renderer, icon);
+
+          BS_PROFILER_ADD_MARK (begin,
+                                "Compose",
+                                "serial=%s key=%zu",
+                                self->serial_number,
+                                key);
+
+          task = upload_task_new (self, batch, target, renderer, node, key);
+
+          if (animation)
+            {
+              task->cache_frame = TRUE;
+              task->animation_icon = icon;
+              task->animation_serial = bs_icon_get_serial (icon);
+              task->animation_frame = frame;
+            }
+        }
+
+      g_ptr_array_add (batch->tasks, task);
+    }
+  else
+    {
+      BsTouchscreenContent *content;
+
+      g_assert (self->model_info->set_touchscreen_image != NULL);
+
+      region = bs_touchscreen_get_region (target);
+      renderer = bs_device_region_get_renderer (region);
+      content = bs_touchscreen_get_content (target);
+      node = bs_renderer_snapshot_touchscreen_content (renderer, content);
+
+      BS_PROFILER_ADD_MARK (begin,
+                            "Compose",
+                            "serial=%s touchscreen",
+                            self->serial_number);
+
+      g_ptr_array_add (batch->tasks,
+                       upload_task_new (self,
+                                        batch,
+                                        target,
+                                        renderer,
+                                        node,
+                                        get_touchscreen_image_key (self)));
+    }
+}
+
+static void
+recycle_upload_task (BsStreamDeck *self,
+                     UploadTask   *task)
+{
+  g_clear_object (&task->target);
+  g_clear_object (&task->renderer);
+  g_clear_pointer (&task->node, gsk_render_node_unref);
+  g_clear_pointer (&task->payload, g_bytes_unref);
+
+  g_ptr_array_add (self->idle_upload_tasks, task);
+}
+
+static UploadBatch *
+upload_batch_new (BsStreamDeck *self)
+{
+  UploadBatch *batch;
+
+  if (self->idle_upload_batches->len > 0)
+    {
+      batch = g_ptr_array_steal_index_fast (self->idle_upload_batches,
+                                            self->idle_upload_batches->len - 1);
+    }
+  else
+    {
+      batch = g_new0 (UploadBatch, 1);
+      batch->tasks = g_ptr_array_new ();
+    }
+
+  batch->stream_deck = g_object_ref (self);
+  batch->n_pending = 0;
+
+  return batch;
+}
+
+static void
+upload_batch_free (UploadBatch *batch)
+{
+  g_assert (batch->stream_deck == NULL);
+
+  g_clear_pointer (&batch->tasks, g_ptr_array_unref);
+  g_free (batch);
+}
+
+static gboolean
+release_upload_batch_cb (gpointer data)
+{
+  UploadBatch *batch = data;
+  BsStreamDeck *self;
+
+  /* Targets and the Stream Deck itself must be released in the main thread */
+  self = g_steal_pointer (&batch->stream_deck);
+
+  for (unsigned int i = 0; i < batch->tasks->len; i++)
+    recycle_upload_task (self, g_ptr_array_index (batch->tasks, i));
+  g_ptr_array_set_size (batch->tasks, 0);
+
+  g_ptr_array_add (self->idle_upload_batches, batch);
+
+  /* May finalize the Stream Deck, which frees idle batches */
+  g_object_unref (self);
+
+  return G_SOURCE_REMOVE;
+}
+
+/*
+ * Counts a frame written to @key_image, and updates its frame rate when the
+ * current window is over. Must be called with budget_lock held.
+ */
+static void
+count_key_frame (KeyImage *key_image,
+                 int64_t   now)
+{
+  int64_t elapsed = now - key_image->window_start;
+
+  if (elapsed >= FRAME_RATE_WINDOW_US)
+    {
+      /* Keys that were idle for a while start over */
+      if (elapsed < 2 * FRAME_RATE_WINDOW_US)
+        key_image->frame_rate = key_image->n_window_frames * (double) G_USEC_PER_SEC / elapsed;
+      else
+        key_image->frame_rate = 0.0;
+
+      key_image->window_start = now;
+      key_image->n_window_frames = 0;
+    }
+
+  key_image->n_window_frames++;
+}
+
+static gboolean
+write_image (BsStreamDeck   *self,
+             UploadTask     *task,
+             const uint8_t  *image,
+             size_t          image_size,
+             GError        **error)
+{
+  g_autoptr (GMutexLocker) write_locker = NULL;
+  gboolean changed = TRUE;
+  gboolean success;
+  int64_t begin;
+
+  /* Checking and writing as one step orders images of the same key */
+  write_locker = g_mutex_locker_new (&self->write_lock);
+
+  g_mutex_lock (&self->upload_lock);
+
+  changed = task->generation >= self->key_images[task->key].written_generation;
+
+  if (changed)
+    {
+      self->key_images[task->key].written_generation = task->generation;
+      changed = check_image_changed (self, task->key, image, image_size);
+    }
+
+  g_mutex_unlock (&self->upload_lock);
+
+  if (!changed)
+    return TRUE;
+
+  begin = BS_PROFILER_CURRENT_TIME;
+
+  if (BS_IS_BUTTON (task->target))
+    success = self->model_info->set_button_image (self, task->target, image, image_size, error);
+  else
+    success = self->model_info->set_touchscreen_image (self, task->target, image, image_size, error);
+
+  BS_PROFILER_ADD_MARK (begin,
+                        "HID write",
+                        "serial=%s key=%zu bytes=%zu",
+                        self->serial_number,
+                        task->key,
+                        image_size);
+
+  g_mutex_lock (&self->upload_lock);
+
+  if (!success)
+    forget_uploaded_image (self, task->key);
+  g_mutex_unlock (&self->upload_lock);
+
+  if (success)
+    {
+      g_mutex_lock (&self->budget_lock);
+      if (self->max_upload_byte_rate > 0)
+        self->upload_byte_tokens -= image_size;
+      count_key_frame (&self->key_images[task->key], g_get_monotonic_time ());
+      g_mutex_unlock (&self->budget_lock);
+    }
+
+  return success;
+}
+
+static void
+render_and_write_image (BsStreamDeck  *self,
+                        UploadTask    *task,
+                        GError       **error)
+{
+  GByteArray *image;
+  gboolean rendered;
+  int64_t encode_time;
+  int64_t start_time;
+  int64_t begin;
+
+  image = get_thread_image_buffer ();
+
+  /* Rasterizes and encodes */
+  begin = BS_PROFILER_CURRENT_TIME;
+  start_time = g_get_monotonic_time ();
+  rendered = bs_renderer_render_node (task->renderer,
+                                      task->node,
+                                      image,
+                                      error);
+  encode_time = g_get_monotonic_time () - start_time;
+  BS_PROFILER_ADD_MARK (begin, "Encode", "serial=%s key=%zu", self->serial_number, task->key);
+
+  if (rendered)
+    write_image (self, task, image->data, image->len, error);
+
+  if (rendered && task->cache_frame)
+    {
+      g_mutex_lock (&self->animation_lock);
+      store_animation_frame (self, task, image->data, image->len);
+      g_mutex_unlock (&self->animation_lock);
+    }
+
+  g_mutex_lock (&self->upload_lock);
+  self->stats.total_encode_time_us += encode_time;
+  add_to_histogram (self->stats.encode_time_histogram, encode_time);
+  g_mutex_unlock (&self->upload_lock);
+}
+
+static void
+run_upload_task_func (gpointer data,
+                      gpointer user_data)
+{
+  g_autoptr (GError) error = NULL;
+  UploadTask *task = data;
+  UploadBatch *batch = task->batch;
+  BsStreamDeck *self = batch->stream_deck;
+
+  if (task->payload)
+    {
+      const uint8_t *payload;
+      size_t payload_size;
+
+      /* Cached animation frames are written as they are */
+      payload = g_bytes_get_data (task->payload, &payload_size);
+      write_image (self, task, payload, payload_size, &error);
+    }
+  else
+    {
+      render_and_write_image (self, task, &error);
+    }
+
+  g_mutex_lock (&self->upload_lock);
+  if (error)
+    self->stats.n_failed_uploads++;
+  else
+    self->stats.n_uploads++;
+  g_mutex_unlock (&self->upload_lock);
+
+  if (error)
+    g_warning ("Error uploading image to Stream Deck: %s", error->message);
+
+  if (g_atomic_int_dec_and_test (&batch->n_pending))
+    g_main_context_invoke (NULL, release_upload_batch_cb, batch);
+}
 
-  builder = json_builder_new ();
+/* Adds the budget accumulated since the last refill. Must run in the main thread. */
+static void
+refill_upload_budget (BsStreamDeck *self)
+{
+  double burst_seconds;
+  double elapsed;
+  int64_t now;
+
+  now = g_get_monotonic_time ();
+  elapsed = (double) (now - self->upload_budget_time) / G_USEC_PER_SEC;
+  burst_seconds = (double) UPLOAD_BURST_US / G_USEC_PER_SEC;
+  self->upload_budget_time = now;
+
+  self->upload_frame_tokens = MIN (self->upload_frame_tokens + elapsed * self->max_upload_frame_rate,
+                                   burst_seconds * self->max_upload_frame_rate);
+
+  g_mutex_lock (&self->budget_lock);
+  self->upload_byte_tokens = MIN (self->upload_byte_tokens + elapsed * self->max_upload_byte_rate,
+                                  burst_seconds * self->max_upload_byte_rate);
+  g_mutex_unlock (&self->budget_lock);
+}
 
-  json_builder_begin_object (builder);
+/*
+ * Returns how long until there is budget for another image, in milliseconds,
+ * or 0 if there is budget already.
+ */
+static unsigned int
+get_upload_budget_delay (BsStreamDeck *self)
+{
+  unsigned int byte_rate;
+  double byte_tokens;
+  double delay = 0.0;
 
-  json_builder_set_member_name (builder, "active-profile");
-  json_builder_add_string_value (builder, bs_profile_get_id (self->active_profile));
+  g_mutex_lock (&self->budget_lock);
+  byte_rate = self->max_upload_byte_rate;
+  byte_tokens = self->upload_byte_tokens;
+  g_mutex_unlock (&self->budget_lock);
 
-  json_builder_set_member_name (builder, "profiles");
-  json_builder_begin_array (builder);
-  for (size_t i = 0; i < g_list_model_get_n_items (G_LIST_MODEL (self->profiles)); i++)
-    {
-      g_autoptr (BsProfile) profile = NULL;
+  if (self->max_upload_frame_rate > 0 && self->upload_frame_tokens < 1.0)
+    delay = MAX (delay, (1.0 - self->upload_frame_tokens) / self->max_upload_frame_rate);
 
-      profile = g_list_model_get_item (G_LIST_MODEL (self->profiles), i);
-      json_builder_add_value (builder, bs_profile_to_json (profile));
-    }
-  json_builder_end_array (builder);
+  /* Images are written whole, so the byte bucket only has to be positive */
+  if (byte_rate > 0 && byte_tokens <= 0.0)
+    delay = MAX (delay, (1.0 - byte_tokens) / byte_rate);
 
-  json_builder_end_object (builder);
+  if (delay == 0.0)
+    return 0;
 
-  root = json_builder_get_root (builder);
+  /* Rounds up, so that the budget is there when the timeout fires */
+  return (unsigned int) (delay * 1000.0) + 1;
+}
 
-  generator = json_generator_new ();
-  json_generator_set_pretty (generator, TRUE);
-  json_generator_set_root (generator, root);
-  json_str = json_generator_to_data (generator, NULL);
+static gboolean
+is_priority_upload (BsStreamDeck *self,
+                    gpointer      target,
+                    int64_t       now)
+{
+  KeyImage *key_image;
 
-  profile_path = get_profile_path (self);
-  g_file_set_contents (profile_path, json_str, -1, &error);
+  if (!BS_IS_BUTTON (target))
+    return FALSE;
 
-  if (error)
-    g_warning ("Error saving profiles: %s", error->message);
+  key_image = &self->key_images[bs_button_get_position (target)];
 
-  BS_EXIT;
+  return key_image->last_input_time > 0 && now - key_image->last_input_time < INPUT_PRIORITY_US;
 }
 
-static void
-load_profiles (BsStreamDeck  *self)
+static gboolean
+flush_uploads_cb (gpointer data)
 {
-  g_autoptr (JsonParser) parser = NULL;
-  g_autoptr (BsProfile) active_profile = NULL;
-  g_autoptr (GError) local_error = NULL;
-  g_autofree char *profile_path = NULL;
-  const char *active_profile_id;
-  JsonObject *object;
-  JsonArray *profiles_array;
-  JsonNode *root;
+  BsStreamDeck *self = BS_STREAM_DECK (data);
+  GPtrArray *pending_uploads;
+  UploadBatch *batch;
+  unsigned int delay;
+  int64_t now;
 
   BS_ENTRY;
 
-  profile_path = get_profile_path (self);
+  /* Uploading may queue new uploads, which will be handled in the next flush */
+  pending_uploads = self->pending_uploads;
+  self->pending_uploads = self->flushing_uploads;
+  self->flushing_uploads = pending_uploads;
+  self->flush_uploads_id = 0;
+  self->flush_uploads_deferred = FALSE;
 
-  g_debug ("Loading %s", profile_path);
+  BS_TRACE_MARK ("queue-depth", pending_uploads->len);
 
-  parser = json_parser_new ();
+  refill_upload_budget (self);
+  now = g_get_monotonic_time ();
 
-  json_parser_load_from_file (parser, profile_path, &local_error);
-  if (local_error)
+  /*
+   * Snapshot everything here, since widgets and paintables belong to the
+   * main thread, and let the thread pool rasterize and encode the nodes.
+   * Each image is written as soon as it is ready.
+   */
+  batch = upload_batch_new (self);
+
+  for (unsigned int i = 0; i < pending_uploads->len; i++)
     {
-      g_debug ("Error loading profile for device %s: %s",
-               self->serial_number,
-               local_error->message);
-      BS_GOTO (out);
-    }
+      gpointer target = g_ptr_array_index (pending_uploads, i);
+      unsigned int n_tasks = batch->tasks->len;
 
-  root = json_parser_get_root (parser);
-  object = json_node_get_object (root);
+      if (is_priority_upload (self, target, now))
+        {
+          self->stats.n_priority_uploads++;
+        }
+      else if (get_upload_budget_delay (self) > 0)
+        {
+          /* Stays pending, and the latest state is rendered once there is budget */
+          if (!g_ptr_array_find (self->pending_uploads, target, NULL))
+            g_ptr_array_add (self->pending_uploads, g_object_ref (target));
 
-  active_profile = NULL;
-  active_profile_id = json_object_get_string_member (object, "active-profile");
+          self->stats.n_deferred_uploads++;
+          continue;
+        }
 
-  profiles_array = json_object_get_array_member (object, "profiles");
-  for (size_t i = 0; i < json_array_get_length (profiles_array); i++)
-    {
-      g_autoptr (BsProfile) profile = NULL;
-      JsonNode *profile_node;
+      add_upload_tasks (self, batch, target);
 
-      profile_node = json_array_get_element (profiles_array, i);
+      /* Keys with input may overdraw, and delay everything else */
+      if (self->max_upload_frame_rate > 0)
+        self->upload_frame_tokens -= batch->tasks->len - n_tasks;
+    }
 
-      if (!profile_node)
-        continue;
+  g_ptr_array_set_size (pending_uploads, 0);
 
-      profile = bs_profile_new_from_json (self, profile_node);
-      g_list_store_append (self->profiles, profile);
+  self->stats.queue_depth = self->pending_uploads->len;
 
-      if (g_strcmp0 (active_profile_id, bs_profile_get_id (profile)) == 0)
-        active_profile = g_object_ref (profile);
+  BS_TRACE_MARK ("deferred-uploads", self->pending_uploads->len);
+
+  /* Deferred uploads are flushed when there is budget again */
+  if (self->pending_uploads->len > 0 && self->flush_uploads_id == 0)
+    {
+      delay = get_upload_budget_delay (self);
+
+      self->flush_uploads_deferred = TRUE;
+      self->flush_uploads_id = g_timeout_add_full (G_PRIORITY_HIGH_IDLE,
+                                                   MAX (delay, 1),
+                                                   flush_uploads_cb,
+                                                   self,
+                                                   NULL);
     }
 
-  if (!active_profile)
-    active_profile = g_list_model_get_item (G_LIST_MODEL (self->profiles), 0);
+  batch->n_pending = batch->tasks->len;
 
-out:
-  if (!active_profile)
+  if (batch->n_pending == 0)
     {
-      active_profile = bs_profile_new_empty (self);
-      bs_profile_set_name (active_profile, _("Default"));
-      g_list_store_append (self->profiles, active_profile);
+      release_upload_batch_cb (batch);
+      BS_RETURN (G_SOURCE_REMOVE);
     }
 
-  bs_stream_deck_load_profile (self, active_profile);
+  for (unsigned int i = 0; i < batch->tasks->len; i++)
+    g_thread_pool_push (self->upload_thread_pool, g_ptr_array_index (batch->tasks, i), NULL);
 
-  BS_EXIT;
+  BS_RETURN (G_SOURCE_REMOVE);
 }
 
 static void
-load_active_page (BsStreamDeck *self)
+queue_upload (BsStreamDeck *self,
+              gpointer      target)
 {
-  BsPage *active_page;
-
-  BS_ENTRY;
-
-  active_page = bs_stream_deck_get_active_page (self);
+  self->stats.n_upload_requests++;
 
-  for (uint8_t i = 0; i < self->model_info->button_layout.n_buttons; i++)
+  /* Already pending: the flush renders the latest state anyway */
+  if (g_ptr_array_find (self->pending_uploads, target, NULL))
     {
-      BsButton *button;
-      g_autoptr (BsAction) action = NULL;
-      g_autoptr (BsIcon) custom_icon = NULL;
-      g_autoptr (GError) error = NULL;
-
-      button = find_button_at_region (self, "main-button-grid", i);
-
-      bs_page_realize (active_page, button, &custom_icon, &action, &error);
-
-      if (error)
-        {
-          g_warning ("Failed to construct action and icon from page: %s", error->message);
-          continue;
-        }
-
-      bs_button_inhibit_page_updates (button);
-
-      bs_button_set_action (button, action);
-      bs_button_set_custom_icon (button, custom_icon);
+      self->stats.n_dropped_uploads++;
+    }
+  else
+    {
+      g_ptr_array_add (self->pending_uploads, g_object_ref (target));
 
-      bs_button_uninhibit_page_updates (button);
+      self->stats.queue_depth = self->pending_uploads->len;
+      self->stats.max_queue_depth = MAX (self->stats.max_queue_depth, self->stats.queue_depth);
     }
 
-  BS_EXIT;
-}
+  /* Keys that just received input do not wait for the budget */
+  if (self->flush_uploads_deferred && is_priority_upload (self, target, g_get_monotonic_time ()))
+    {
+      g_clear_handle_id (&self->flush_uploads_id, g_source_remove);
+      self->flush_uploads_deferred = FALSE;
+    }
 
-static inline uint8_t
-swap_button_index_original (BsStreamDeck *self,
-                            uint8_t       button_index)
-{
-  int column = button_index % self->model_info->button_layout.columns;
-  int actual_index = ((int) button_index - column) + ((int) self->model_info->button_layout.columns - 1 - column);
-  return (uint8_t) actual_index;
+  if (self->flush_uploads_id == 0)
+    {
+      self->flush_uploads_id = g_idle_add_full (G_PRIORITY_HIGH_IDLE,
+                                                flush_uploads_cb,
+                                                self,
+                                                NULL);
+    }
 }
 
-
 /*
  * Callbacks
  */
@@ -398,68 +2038,50 @@ save_after_timeout_cb (gpointer data)
 /* Mini & Original (gen 1) */
 
 static gboolean
-set_button_texture_mini (BsStreamDeck  *self,
-                         BsButton      *button,
-                         GdkTexture    *texture,
-                         GError       **error)
+set_button_image_mini (BsStreamDeck   *self,
+                       BsButton       *button,
+                       const uint8_t  *image,
+                       size_t          image_size,
+                       GError        **error)
 {
-  g_autofree uint8_t *payload = NULL;
-  g_autofree uint8_t *buffer = NULL;
-  BsDeviceRegion *region;
-  BsRenderer *renderer;
-  const size_t package_size = 1024;
+  const size_t package_size = self->model_info->output_report_size;
   const size_t header_size = 16;
   uint8_t page;
   size_t bytes_remaining;
-  size_t buffer_size;
 
   BS_ENTRY;
 
-  region = bs_button_get_region (button);
-  renderer = bs_device_region_get_renderer (region);
-
-  if (!bs_renderer_convert_texture (renderer, texture, (char **) &buffer, &buffer_size, error))
-    BS_RETURN (FALSE);
-
-  payload = g_malloc (sizeof (uint8_t) * package_size);
-  payload[0] = 0x02;
-  payload[1] = 0x01;
-  /* payload[2] set in loop */
-  payload[3] = 0;
-  /* payload[4] set in loop */
-  payload[5] = bs_button_get_position (button) + 1;
-  payload[6] = 0;
-  payload[7] = 0;
-  payload[8] = 0;
-  payload[9] = 0;
-  payload[10] = 0;
-  payload[11] = 0;
-  payload[12] = 0;
-  payload[13] = 0;
-  payload[14] = 0;
-  payload[15] = 0;
-
   page = 0;
-  bytes_remaining = buffer_size;
+  bytes_remaining = image_size;
   while (bytes_remaining > 0)
     {
+      IoRequest *request;
+      uint8_t *payload;
       size_t padding_size;
       size_t chunk_size;
       size_t bytes_sent;
 
       chunk_size = MIN (bytes_remaining, package_size - header_size);
 
+      request = acquire_io_request (self, BS_HID_REPORT_OUTPUT, package_size);
+      request->key = bs_button_get_position (button);
+      payload = request->data;
+      payload[0] = 0x02;
+      payload[1] = 0x01;
       payload[2] = page;
+      payload[3] = 0;
       payload[4] = chunk_size == bytes_remaining ? 1 : 0;
+      payload[5] = bs_button_get_position (button) + 1;
+      memset (payload + 6, 0, header_size - 6);
 
       bytes_sent = page * (package_size - header_size);
-      memcpy (payload + header_size, buffer + bytes_sent, chunk_size);
+      memcpy (payload + header_size, image + bytes_sent, chunk_size);
 
       padding_size = package_size - header_size - chunk_size;
       if (padding_size > 0)
         memset (payload + header_size + chunk_size, 0, padding_size);
 
-      hid_write (self->handle, payload, package_size);
+      submit_io_request (self, request);
 
       bytes_remaining -= chunk_size;
       page++;
@@ -468,32 +2090,19 @@ set_button_texture_mini (BsStreamDeck  *self,
   BS_RETURN (TRUE);
 }
 
-static gboolean
-read_button_states_mini (BsStreamDeck *self)
+static void
+handle_input_report_mini (BsStreamDeck  *self,
+                          const uint8_t *report,
+                          size_t         length)
 {
   const BsButtonLayout *layout;
-  uint8_t *states;
-  size_t states_length;
-  int result;
 
   layout = &self->model_info->button_layout;
-  states_length = layout->n_buttons + 1;
-
-  g_assert (states_length < 8192);
-  states = g_alloca (sizeof (uint8_t) * states_length);
-
-  result = hid_read (self->handle, states, states_length);
 
-  if (result == 0)
-    return TRUE;
-
-  for (uint8_t i = 0; i < layout->n_buttons; i++)
-    {
-      BsButton *button = find_button_at_region (self, "main-button-grid", i);
-      bs_button_set_pressed (button, (gboolean) states[i + 1]);
-    }
+  if (length < (size_t) layout->n_buttons + 1)
+    return;
 
-  return TRUE;
+  dispatch_button_states (self, report + 1);
 }
 
 static void
@@ -507,7 +2116,7 @@ reset_mini_original (BsStreamDeck *self)
 
   BS_ENTRY;
 
-  hid_send_feature_report (self->handle, reset_command, sizeof (reset_command));
+  send_feature_report (self, reset_command, sizeof (reset_command));
 
   BS_EXIT;
 }
@@ -522,7 +2131,7 @@ get_serial_number_mini_original (BsStreamDeck *self)
 
   data[0] = 0x03;
 
-  hid_get_feature_report (self->handle, data, sizeof (data));
+  get_feature_report (self, data, sizeof (data));
 
   serial = g_malloc0 (sizeof (char) * 13);
   memcpy (serial, &data[5], 12);
@@ -540,7 +2149,7 @@ get_firmware_version_mini_original (BsStreamDeck *self)
 
   data[0] = 0x04;
 
-  hid_get_feature_report (self->handle, data, sizeof (data));
+  get_feature_report (self, data, sizeof (data));
 
   firmware_version = g_malloc0 (sizeof (char) * 13);
   memcpy (firmware_version, &data[5], 12);
@@ -548,100 +2157,81 @@ get_firmware_version_mini_original (BsStreamDeck *self)
   BS_RETURN (g_steal_pointer (&firmware_version));
 }
 
-static void
-set_brightness_mini_original (BsStreamDeck *self,
-                              gdouble       brightness)
+static size_t
+build_brightness_report_mini_original (BsStreamDeck *self,
+                                       double        brightness,
+                                       uint8_t      *report)
 {
-  const uint8_t b = CLAMP (brightness * 100, 0, 100);
+  const uint8_t b = brightness_to_percent (brightness);
   const uint8_t data[] = {
     0x05,
     0x55, 0xaa, 0xd1, 0x01, b   , 0x00, 0x00, 0x00,
     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
   };
 
-  BS_ENTRY;
-
-  hid_send_feature_report (self->handle, data, sizeof (data));
+  memcpy (report, data, sizeof (data));
 
-  BS_EXIT;
+  return sizeof (data);
 }
 
 static gboolean
-set_button_texture_original (BsStreamDeck  *self,
-                             BsButton      *button,
-                             GdkTexture    *texture,
-                             GError       **error)
+set_button_image_original (BsStreamDeck   *self,
+                           BsButton       *button,
+                           const uint8_t  *image,
+                           size_t          image_size,
+                           GError        **error)
 {
-  g_autofree uint8_t *payload = NULL;
-  g_autofree uint8_t *buffer = NULL;
-  BsDeviceRegion *region;
-  BsRenderer *renderer;
-  const size_t package_size = 8191;
+  const size_t package_size = self->model_info->output_report_size;
   const size_t header_size = 16;
   uint8_t button_index;
   uint8_t page;
   size_t bytes_remaining;
   size_t report_size;
-  size_t buffer_size;
 
   BS_ENTRY;
 
-  region = bs_button_get_region (button);
-  renderer = bs_device_region_get_renderer (region);
-
-  if (!bs_renderer_convert_texture (renderer, texture, (char **) &buffer, &buffer_size, error))
-    BS_RETURN (FALSE);
-
-  report_size = buffer_size / 2;
+  report_size = image_size / 2;
 
   /*
    * BMP images have fixed byte sizes for a given width and height, and
    * in this case, a 72x72 BMP image should have exactly 15606 bytes.
    */
-  g_assert (buffer_size == 15606);
+  g_assert (image_size == 15606);
   g_assert (package_size - header_size >= report_size);
 
   button_index = bs_button_get_position (button);
 
-  payload = g_malloc (sizeof (uint8_t) * package_size);
-  payload[0] = 0x02;
-  payload[1] = 0x01;
-  /* payload[2] set in loop */
-  payload[3] = 0;
-  /* payload[4] set in loop */
-  payload[5] = swap_button_index_original (self, button_index) + 1;
-  payload[6] = 0;
-  payload[7] = 0;
-  payload[8] = 0;
-  payload[9] = 0;
-  payload[10] = 0;
-  payload[11] = 0;
-  payload[12] = 0;
-  payload[13] = 0;
-  payload[14] = 0;
-  payload[15] = 0;
-
   page = 0;
-  bytes_remaining = buffer_size;
+  bytes_remaining = image_size;
   while (bytes_remaining > 0)
     {
+      IoRequest *request;
+      uint8_t *payload;
       size_t padding_size;
       size_t chunk_size;
       size_t bytes_sent;
 
       chunk_size = MIN (bytes_remaining, report_size);
 
+      request = acquire_io_request (self, BS_HID_REPORT_OUTPUT, package_size);
+      request->key = bs_button_get_position (button);
+      payload = request->data;
+      payload[0] = 0x02;
+      payload[1] = 0x01;
       payload[2] = page + 1;
+      payload[3] = 0;
       payload[4] = chunk_size == bytes_remaining ? 1 : 0;
+      payload[5] = swap_button_index_original (self, button_index) + 1;
+      memset (payload + 6, 0, header_size - 6);
 
       bytes_sent = page * report_size;
-      memcpy (payload + header_size, buffer + bytes_sent, chunk_size);
+      memcpy (payload + header_size, image + bytes_sent, chunk_size);
 
       padding_size = package_size - header_size - chunk_size;
       if (padding_size > 0)
         memset (payload + header_size + chunk_size, 0, padding_size);
 
-      hid_write (self->handle, payload, package_size);
+      submit_io_request (self, request);
 
       bytes_remaining -= chunk_size;
       page++;
@@ -650,34 +2240,20 @@ set_button_texture_original (BsStreamDeck  *self,
   BS_RETURN (TRUE);
 }
 
-static gboolean
-read_button_states_original (BsStreamDeck *self)
+static void
+handle_input_report_original (BsStreamDeck  *self,
+                              const uint8_t *report,
+                              size_t         length)
 {
   const BsButtonLayout *layout;
-  uint8_t *states;
-  size_t states_length;
-  int result;
 
   layout = &self->model_info->button_layout;
-  states_length = layout->n_buttons + 1;
-
-  g_assert (states_length < 8192);
-  states = g_alloca (sizeof (uint8_t) * states_length);
-
-  result = hid_read (self->handle, states, states_length);
-
-  if (result == 0)
-    return TRUE;
-
-  for (uint8_t i = 0; i < layout->n_buttons; i++)
-    {
-      uint8_t position = swap_button_index_original (self, i);
-      BsButton *button = find_button_at_region (self, "main-button-grid", position);
 
-      bs_button_set_pressed (button, (gboolean) states[i + 1]);
-    }
+  if (length < (size_t) layout->n_buttons + 1)
+    return;
 
-  return TRUE;
+  /* The dispatch table takes care of the swapped button order */
+  dispatch_button_states (self, report + 1);
 }
 
 /* 2nd generation */
@@ -695,7 +2271,7 @@ reset_gen2 (BsStreamDeck *self)
 
   BS_ENTRY;
 
-  hid_send_feature_report (self->handle, reset_command, sizeof (reset_command));
+  send_feature_report (self, reset_command, sizeof (reset_command));
 
   BS_EXIT;
 }
@@ -710,7 +2286,7 @@ get_serial_number_gen2 (BsStreamDeck *self)
 
   data[0] = 0x06;
 
-  hid_get_feature_report (self->handle, data, sizeof (data));
+  get_feature_report (self, data, sizeof (data));
 
   serial = g_malloc0 (sizeof (char) * 31);
   memcpy (serial, &data[2], 30);
@@ -728,7 +2304,7 @@ get_firmware_version_gen2 (BsStreamDeck *self)
 
   data[0] = 0x05;
 
-  hid_get_feature_report (self->handle, data, sizeof (data));
+  get_feature_report (self, data, sizeof (data));
 
   serial = g_malloc0 (sizeof (char) * 27);
   memcpy (serial, &data[6], 26);
@@ -736,11 +2312,12 @@ get_firmware_version_gen2 (BsStreamDeck *self)
   BS_RETURN (serial);
 }
 
-static void
-set_brightness_gen2 (BsStreamDeck *self,
-                     gdouble       brightness)
+static size_t
+build_brightness_report_gen2 (BsStreamDeck *self,
+                              double        brightness,
+                              uint8_t      *report)
 {
-  const uint8_t b = CLAMP (brightness * 100, 0, 100);
+  const uint8_t b = brightness_to_percent (brightness);
   const uint8_t data[] = {
     0x03,
     0x08, b   , 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
@@ -749,52 +2326,43 @@ set_brightness_gen2 (BsStreamDeck *self,
     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
   };
 
-  BS_ENTRY;
-
-  hid_send_feature_report (self->handle, data, sizeof (data));
+  memcpy (report, data, sizeof (data));
 
-  BS_EXIT;
+  return sizeof (data);
 }
 
 static gboolean
-set_button_texture_gen2 (BsStreamDeck  *self,
-                         BsButton      *button,
-                         GdkTexture    *texture,
-                         GError       **error)
+set_button_image_gen2 (BsStreamDeck   *self,
+                       BsButton       *button,
+                       const uint8_t  *image,
+                       size_t          image_size,
+                       GError        **error)
 {
-  g_autofree uint8_t *payload = NULL;
-  g_autofree uint8_t *buffer = NULL;
-  BsDeviceRegion *region;
-  BsRenderer *renderer;
-  const size_t package_size = 1024;
+  const size_t package_size = self->model_info->output_report_size;
   const size_t header_size = 8;
   uint8_t page;
   size_t bytes_remaining;
-  size_t buffer_size;
 
   BS_ENTRY;
 
-  region = bs_button_get_region (button);
-  renderer = bs_device_region_get_renderer (region);
-
-  if (!bs_renderer_convert_texture (renderer, texture, (char **) &buffer, &buffer_size, error))
-    BS_RETURN (FALSE);
-
-  payload = g_malloc (package_size * sizeof (uint8_t));
-  payload[0] = 0x02;
-  payload[1] = 0x07;
-  payload[2] = bs_button_get_position (button);
-
   page = 0;
-  bytes_remaining = buffer_size;
+  bytes_remaining = image_size;
   while (bytes_remaining > 0)
     {
+      IoRequest *request;
+      uint8_t *payload;
       size_t padding_size;
       size_t chunk_size;
       size_t bytes_sent;
 
       chunk_size = MIN (bytes_remaining, package_size - header_size);
 
+      request = acquire_io_request (self, BS_HID_REPORT_OUTPUT, package_size);
+      request->key = bs_button_get_position (button);
+      payload = request->data;
+      payload[0] = 0x02;
+      payload[1] = 0x07;
+      payload[2] = bs_button_get_position (button);
       payload[3] = chunk_size == bytes_remaining ? 1 : 0;
       payload[4] = chunk_size & 0xff;
       payload[5] = chunk_size >> 8;
@@ -802,13 +2370,13 @@ set_button_texture_gen2 (BsStreamDeck  *self,
       payload[7] = page >> 8;
 
       bytes_sent = page * (package_size - header_size);
-      memcpy (payload + header_size, buffer + bytes_sent, chunk_size);
+      memcpy (payload + header_size, image + bytes_sent, chunk_size);
 
       padding_size = package_size - header_size - chunk_size;
       if (padding_size > 0)
         memset (payload + header_size + chunk_size, 0, padding_size);
 
-      hid_write (self->handle, payload, package_size * sizeof (uint8_t));
+      submit_io_request (self, request);
 
       bytes_remaining -= chunk_size;
       page++;
@@ -817,49 +2385,37 @@ set_button_texture_gen2 (BsStreamDeck  *self,
   BS_RETURN (TRUE);
 }
 
-static gboolean
-read_button_states_gen2 (BsStreamDeck *self)
+static void
+handle_input_report_gen2 (BsStreamDeck  *self,
+                          const uint8_t *report,
+                          size_t         length)
 {
   const BsButtonLayout *layout;
-  uint8_t *states;
-  size_t states_length;
-  int result;
 
   layout = &self->model_info->button_layout;
-  states_length = layout->n_buttons + 4;
 
-  g_assert (states_length < 8192);
-  states = g_alloca (sizeof (uint8_t) * states_length);
-
-  result = hid_read (self->handle, states, states_length);
-
-  if (result == 0)
-    return TRUE;
-
-  for (uint8_t i = 0; i < layout->n_buttons; i++)
-    {
-      BsButton *button = find_button_at_region (self, "main-button-grid", i);
-      bs_button_set_pressed (button, (gboolean) states[i + 4]);
-    }
+  if (length < (size_t) layout->n_buttons + 4)
+    return;
 
-  return TRUE;
+  dispatch_button_states (self, report + 4);
 }
 
 /* noops for devices without visual feedback */
 
-static void
-set_brightness_pedal (BsStreamDeck *self,
-                      double        brightness)
+static size_t
+build_brightness_report_pedal (BsStreamDeck *self,
+                               double        brightness,
+                               uint8_t      *report)
 {
-  BS_ENTRY;
-  BS_EXIT;
+  return 0;
 }
 
 static gboolean
-set_button_texture_pedal (BsStreamDeck  *self,
-                          BsButton      *button,
-                          GdkTexture    *texture,
-                          GError       **error)
+set_button_image_pedal (BsStreamDeck   *self,
+                        BsButton       *button,
+                        const uint8_t  *image,
+                        size_t          image_size,
+                        GError        **error)
 {
   BS_ENTRY;
   BS_RETURN (TRUE);
@@ -883,38 +2439,29 @@ convert_dial_value (uint8_t value)
     return -(0x100 - (int) value);
 }
 
-static gboolean
-read_button_states_plus (BsStreamDeck *self)
+static void
+handle_input_report_plus (BsStreamDeck  *self,
+                          const uint8_t *report,
+                          size_t         length)
 {
   const BsButtonLayout *layout;
-  const size_t states_length = 14;
-  uint8_t *states;
-  int result;
 
   layout = &self->model_info->button_layout;
 
-  g_assert (states_length < 8192);
-  states = g_alloca (sizeof (uint8_t) * states_length);
-
-  result = hid_read (self->handle, states, states_length);
-
-  if (result == 0)
-    return TRUE;
+  if (length < 14)
+    return;
 
   enum {
     BUTTON_EVENT = 0x00,
     TOUCHSCREEN_EVENT = 0x02,
     DIAL_EVENT = 0x03,
-  } event_type = states[1];
+  } event_type = report[1];
 
   switch (event_type)
     {
     case BUTTON_EVENT:
-      for (uint8_t i = 0; i < layout->n_buttons; i++)
-        {
-          BsButton *button = find_button_at_region (self, "main-button-grid", i);
-          bs_button_set_pressed (button, (gboolean) states[i + 4]);
-        }
+      g_assert (length >= (size_t) layout->n_buttons + 4);
+      dispatch_button_states (self, report + 4);
       break;
 
     case TOUCHSCREEN_EVENT:
@@ -923,12 +2470,12 @@ read_button_states_plus (BsStreamDeck *self)
           SHORT_PRESS = 1,
           LONG_PRESS = 2,
           SWIPE = 3,
-        } touch_event_type = states[4];
+        } touch_event_type = report[4];
         graphene_point_t position;
 
         graphene_point_init (&position,
-                             (states[7] << 8) + states[6],
-                             (states[9] << 8) + states[8]);
+                             (report[7] << 8) + report[6],
+                             (report[9] << 8) + report[8]);
 
         g_debug ("Touchscreen event (%.0fx%.0f)", position.x, position.y);
 
@@ -946,8 +2493,8 @@ read_button_states_plus (BsStreamDeck *self)
             {
               graphene_point_t release_position;
               graphene_point_init (&release_position,
-                                   (states[11] << 8) + states[10],
-                                   (states[13] << 8) + states[12]);
+                                   (report[11] << 8) + report[10],
+                                   (report[13] << 8) + report[12]);
               g_debug ("  Swipe (released position: %.0fx%.0f)", release_position.x, release_position.y);
             }
             break;
@@ -957,21 +2504,21 @@ read_button_states_plus (BsStreamDeck *self)
 
     case DIAL_EVENT:
       {
-        BsDialGridRegion *dial_grid;
-        GListModel *dials;
-
-        dial_grid = BS_DIAL_GRID_REGION (bs_stream_deck_get_region (self, "dial-grid"));
-        dials = bs_dial_grid_region_get_dials (dial_grid);
-
-        g_assert (g_list_model_get_n_items (dials) == 4);
+        g_assert (self->model_info->dial_layout.n_dials == 4);
 
         for (uint8_t i = 0; i < 4; i++)
           {
-            g_autoptr (BsDial) dial = g_list_model_get_item (dials, i);
+            BsDial *dial = self->input_dials[i];
 
-            if (states[4] == 0x01)
+            if (report[4] == 0x01)
               {
-                int rotation = convert_dial_value (states[i + 5]);
+                int rotation;
+
+                /* Idle dials report no rotation */
+                if (report[i + 5] == 0)
+                  continue;
+
+                rotation = convert_dial_value (report[i + 5]);
 
                 g_debug ("  Dial %u rotation: %d", i, rotation);
 
@@ -979,68 +2526,67 @@ read_button_states_plus (BsStreamDeck *self)
               }
             else
               {
-                g_debug ("  Dial %u pressed: %u", i, states[i + 5]);
-                bs_dial_set_pressed (dial, (gboolean) states[i + 5]);
+                if (self->dial_states[i] == report[i + 5])
+                  continue;
+
+                self->dial_states[i] = report[i + 5];
+
+                g_debug ("  Dial %u pressed: %u", i, report[i + 5]);
+                bs_dial_set_pressed (dial, (gboolean) report[i + 5]);
               }
           }
       }
       break;
     }
-
-  return TRUE;
 }
 
 static gboolean
-set_touchscreen_texture_plus (BsStreamDeck   *self,
-                              BsTouchscreen  *touchscreen,
-                              GdkTexture     *texture,
-                              GError        **error)
+set_touchscreen_image_plus (BsStreamDeck   *self,
+                            BsTouchscreen  *touchscreen,
+                            const uint8_t  *image,
+                            size_t          image_size,
+                            GError        **error)
 {
-  g_autofree uint8_t *payload = NULL;
-  g_autofree uint8_t *buffer = NULL;
-  BsDeviceRegion *region;
-  BsRenderer *renderer;
-  const size_t package_size = 1024;
+  const size_t package_size = self->model_info->output_report_size;
   const size_t header_size = 16;
-  uint8_t x, y;
+  uint16_t x, y;
+  uint16_t width, height;
   uint8_t page;
   size_t bytes_remaining;
-  size_t buffer_size;
 
   BS_ENTRY;
 
-  region = bs_touchscreen_get_region (touchscreen);
-  renderer = bs_device_region_get_renderer (region);
-
-  if (!bs_renderer_convert_texture (renderer, texture, (char **) &buffer, &buffer_size, error))
-    BS_RETURN (FALSE);
-
   /* FIXME: we upload the whole texture every time */
   x = 0;
   y = 0;
-
-  payload = g_malloc (package_size * sizeof (uint8_t));
-  payload[0] = 0x02;
-  payload[1] = 0x0c;
-  payload[2] = x & 0xff;
-  payload[3] = x >> 8;
-  payload[4] = y & 0xff;
-  payload[5] = y >> 8;
-  payload[6] = (bs_touchscreen_get_width (touchscreen) & 0xff);
-  payload[7] = (bs_touchscreen_get_width (touchscreen) >> 8) & 0xff;
-  payload[8] = (bs_touchscreen_get_height (touchscreen) & 0xff);
-  payload[9] = (bs_touchscreen_get_height (touchscreen) >> 8) & 0xff;
+  width = bs_touchscreen_get_width (touchscreen);
+  height = bs_touchscreen_get_height (touchscreen);
 
   page = 0;
-  bytes_remaining = buffer_size;
+  bytes_remaining = image_size;
   while (bytes_remaining > 0)
     {
+      IoRequest *request;
+      uint8_t *payload;
       size_t padding_size;
       size_t chunk_size;
       size_t bytes_sent;
 
       chunk_size = MIN (bytes_remaining, package_size - header_size);
 
+      request = acquire_io_request (self, BS_HID_REPORT_OUTPUT, package_size);
+      request->key = get_touchscreen_image_key (self);
+      payload = request->data;
+      payload[0] = 0x02;
+      payload[1] = 0x0c;
+      payload[2] = x & 0xff;
+      payload[3] = x >> 8;
+      payload[4] = y & 0xff;
+      payload[5] = y >> 8;
+      payload[6] = width & 0xff;
+      payload[7] = width >> 8;
+      payload[8] = height & 0xff;
+      payload[9] = height >> 8;
       payload[10] = chunk_size == bytes_remaining ? 1 : 0;
       payload[11] = page & 0xff;
       payload[12] = page >> 8;
@@ -1049,13 +2595,13 @@ set_touchscreen_texture_plus (BsStreamDeck   *self,
       payload[15] = 0;
 
       bytes_sent = page * (package_size - header_size);
-      memcpy (payload + header_size, buffer + bytes_sent, chunk_size);
+      memcpy (payload + header_size, image + bytes_sent, chunk_size);
 
       padding_size = package_size - header_size - chunk_size;
       if (padding_size > 0)
         memset (payload + header_size + chunk_size, 0, padding_size);
 
-      hid_write (self->handle, payload, package_size * sizeof (uint8_t));
+      submit_io_request (self, request);
 
       bytes_remaining -= chunk_size;
       page++;
@@ -1072,7 +2618,8 @@ static const StreamDeckModelInfo models_vtable[] = {
      */
     .name = N_("Stream Deck Mini"),
     .icon_name = "input-dialpad-symbolic",
-    .features = BS_STREAM_DECK_FEATURE_BUTTONS,
+    .features = BS_STREAM_DECK_FEATURE_BUTTONS |
+                BS_STREAM_DECK_FEATURE_BUTTON_IMAGES,
     .button_layout = {
       .n_buttons = 6,
       .columns = 3,
@@ -1083,12 +2630,13 @@ static const StreamDeckModelInfo models_vtable[] = {
         .flags = BS_RENDERER_FLAG_FLIP_Y | BS_RENDERER_FLAG_ROTATE_90,
       },
     },
+    .output_report_size = 1024,
     .reset = reset_mini_original,
     .get_serial_number = get_serial_number_mini_original,
     .get_firmware_version = get_firmware_version_mini_original,
-    .set_brightness = set_brightness_mini_original,
-    .set_button_texture = set_button_texture_mini,
-    .read_button_states = read_button_states_mini,
+    .build_brightness_report = build_brightness_report_mini_original,
+    .set_button_image = set_button_image_mini,
+    .handle_input_report = handle_input_report_mini,
   },
   {
     .product_id = STREAMDECK_MINI_V2_PRODUCT_ID,
@@ -1097,7 +2645,8 @@ static const StreamDeckModelInfo models_vtable[] = {
      */
     .name = N_("Stream Deck Mini"),
     .icon_name = "input-dialpad-symbolic",
-    .features = BS_STREAM_DECK_FEATURE_BUTTONS,
+    .features = BS_STREAM_DECK_FEATURE_BUTTONS |
+                BS_STREAM_DECK_FEATURE_BUTTON_IMAGES,
     .button_layout = {
       .n_buttons = 6,
       .columns = 3,
@@ -1108,12 +2657,13 @@ static const StreamDeckModelInfo models_vtable[] = {
         .flags = BS_RENDERER_FLAG_FLIP_Y | BS_RENDERER_FLAG_ROTATE_90,
       },
     },
+    .output_report_size = 1024,
     .reset = reset_mini_original,
     .get_serial_number = get_serial_number_mini_original,
     .get_firmware_version = get_firmware_version_mini_original,
-    .set_brightness = set_brightness_mini_original,
-    .set_button_texture = set_button_texture_mini,
-    .read_button_states = read_button_states_mini,
+    .build_brightness_report = build_brightness_report_mini_original,
+    .set_button_image = set_button_image_mini,
+    .handle_input_report = handle_input_report_mini,
   },
   {
     .product_id = STREAMDECK_ORIGINAL_PRODUCT_ID,
@@ -1122,7 +2672,8 @@ static const StreamDeckModelInfo models_vtable[] = {
      */
     .name = N_("Stream Deck"),
     .icon_name = "input-dialpad-symbolic",
-    .features = BS_STREAM_DECK_FEATURE_BUTTONS,
+    .features = BS_STREAM_DECK_FEATURE_BUTTONS |
+                BS_STREAM_DECK_FEATURE_BUTTON_IMAGES,
     .button_layout = {
       .n_buttons = 15,
       .columns = 5,
@@ -1133,12 +2684,13 @@ static const StreamDeckModelInfo models_vtable[] = {
         .flags = BS_RENDERER_FLAG_FLIP_X | BS_RENDERER_FLAG_FLIP_Y,
       },
     },
+    .output_report_size = 8191,
     .reset = reset_mini_original,
     .get_serial_number = get_serial_number_mini_original,
     .get_firmware_version = get_firmware_version_mini_original,
-    .set_brightness = set_brightness_mini_original,
-    .set_button_texture = set_button_texture_original,
-    .read_button_states = read_button_states_original,
+    .build_brightness_report = build_brightness_report_mini_original,
+    .set_button_image = set_button_image_original,
+    .handle_input_report = handle_input_report_original,
   },
   {
     .product_id = STREAMDECK_ORIGINAL_V2_PRODUCT_ID,
@@ -1147,7 +2699,8 @@ static const StreamDeckModelInfo models_vtable[] = {
      */
     .name = N_("Stream Deck"),
     .icon_name = "input-dialpad-symbolic",
-    .features = BS_STREAM_DECK_FEATURE_BUTTONS,
+    .features = BS_STREAM_DECK_FEATURE_BUTTONS |
+                BS_STREAM_DECK_FEATURE_BUTTON_IMAGES,
     .button_layout = {
       .n_buttons = 15,
       .columns = 5,
@@ -1158,12 +2711,13 @@ static const StreamDeckModelInfo models_vtable[] = {
         .flags = BS_RENDERER_FLAG_FLIP_X | BS_RENDERER_FLAG_FLIP_Y,
       },
     },
+    .output_report_size = 1024,
     .reset = reset_gen2,
     .get_serial_number = get_serial_number_gen2,
     .get_firmware_version = get_firmware_version_gen2,
-    .set_brightness = set_brightness_gen2,
-    .set_button_texture = set_button_texture_gen2,
-    .read_button_states = read_button_states_gen2,
+    .build_brightness_report = build_brightness_report_gen2,
+    .set_button_image = set_button_image_gen2,
+    .handle_input_report = handle_input_report_gen2,
   },
   {
     .product_id = STREAMDECK_XL_PRODUCT_ID,
@@ -1172,7 +2726,8 @@ static const StreamDeckModelInfo models_vtable[] = {
      */
     .name = N_("Stream Deck XL"),
     .icon_name = "input-dialpad-symbolic",
-    .features = BS_STREAM_DECK_FEATURE_BUTTONS,
+    .features = BS_STREAM_DECK_FEATURE_BUTTONS |
+                BS_STREAM_DECK_FEATURE_BUTTON_IMAGES,
     .button_layout = {
       .n_buttons = 32,
       .columns = 8,
@@ -1183,12 +2738,13 @@ static const StreamDeckModelInfo models_vtable[] = {
         .flags = BS_RENDERER_FLAG_FLIP_X | BS_RENDERER_FLAG_FLIP_Y,
       },
     },
+    .output_report_size = 1024,
     .reset = reset_gen2,
     .get_serial_number = get_serial_number_gen2,
     .get_firmware_version = get_firmware_version_gen2,
-    .set_brightness = set_brightness_gen2,
-    .set_button_texture = set_button_texture_gen2,
-    .read_button_states = read_button_states_gen2,
+    .build_brightness_report = build_brightness_report_gen2,
+    .set_button_image = set_button_image_gen2,
+    .handle_input_report = handle_input_report_gen2,
   },
   {
     .product_id = STREAMDECK_XL_V2_PRODUCT_ID,
@@ -1197,7 +2753,8 @@ static const StreamDeckModelInfo models_vtable[] = {
      */
     .name = N_("Stream Deck XL"),
     .icon_name = "input-dialpad-symbolic",
-    .features = BS_STREAM_DECK_FEATURE_BUTTONS,
+    .features = BS_STREAM_DECK_FEATURE_BUTTONS |
+                BS_STREAM_DECK_FEATURE_BUTTON_IMAGES,
     .button_layout = {
       .n_buttons = 32,
       .columns = 8,
@@ -1208,12 +2765,13 @@ static const StreamDeckModelInfo models_vtable[] = {
         .flags = BS_RENDERER_FLAG_FLIP_X | BS_RENDERER_FLAG_FLIP_Y,
       },
     },
+    .output_report_size = 1024,
     .reset = reset_gen2,
     .get_serial_number = get_serial_number_gen2,
     .get_firmware_version = get_firmware_version_gen2,
-    .set_brightness = set_brightness_gen2,
-    .set_button_texture = set_button_texture_gen2,
-    .read_button_states = read_button_states_gen2,
+    .build_brightness_report = build_brightness_report_gen2,
+    .set_button_image = set_button_image_gen2,
+    .handle_input_report = handle_input_report_gen2,
   },
   {
     .product_id = STREAMDECK_MK2_PRODUCT_ID,
@@ -1222,7 +2780,8 @@ static const StreamDeckModelInfo models_vtable[] = {
      */
     .name = N_("Stream Deck MK.2"),
     .icon_name = "input-dialpad-symbolic",
-    .features = BS_STREAM_DECK_FEATURE_BUTTONS,
+    .features = BS_STREAM_DECK_FEATURE_BUTTONS |
+                BS_STREAM_DECK_FEATURE_BUTTON_IMAGES,
     .button_layout = {
       .n_buttons = 15,
       .columns = 5,
@@ -1233,12 +2792,13 @@ static const StreamDeckModelInfo models_vtable[] = {
         .flags = BS_RENDERER_FLAG_FLIP_X | BS_RENDERER_FLAG_FLIP_Y,
       },
     },
+    .output_report_size = 1024,
     .reset = reset_gen2,
     .get_serial_number = get_serial_number_gen2,
     .get_firmware_version = get_firmware_version_gen2,
-    .set_brightness = set_brightness_gen2,
-    .set_button_texture = set_button_texture_gen2,
-    .read_button_states = read_button_states_gen2,
+    .build_brightness_report = build_brightness_report_gen2,
+    .set_button_image = set_button_image_gen2,
+    .handle_input_report = handle_input_report_gen2,
   },
   {
     .product_id = STREAMDECK_PEDAL_PRODUCT_ID,
@@ -1261,9 +2821,9 @@ static const StreamDeckModelInfo models_vtable[] = {
     .reset = reset_pedal,
     .get_serial_number = get_serial_number_gen2,
     .get_firmware_version = get_firmware_version_gen2,
-    .set_brightness = set_brightness_pedal,
-    .set_button_texture = set_button_texture_pedal,
-    .read_button_states = read_button_states_gen2,
+    .build_brightness_report = build_brightness_report_pedal,
+    .set_button_image = set_button_image_pedal,
+    .handle_input_report = handle_input_report_gen2,
   },
   {
     .product_id = STREAMDECK_PLUS_PRODUCT_ID,
@@ -1273,6 +2833,7 @@ static const StreamDeckModelInfo models_vtable[] = {
     .name = N_("Stream Deck +"),
     .icon_name = "input-dialpad-symbolic",
     .features = BS_STREAM_DECK_FEATURE_BUTTONS |
+                BS_STREAM_DECK_FEATURE_BUTTON_IMAGES |
                 BS_STREAM_DECK_FEATURE_TOUCHSCREEN |
                 BS_STREAM_DECK_FEATURE_DIALS,
     .button_layout = {
@@ -1298,13 +2859,14 @@ static const StreamDeckModelInfo models_vtable[] = {
         .flags = BS_RENDERER_FLAG_NONE,
       },
     },
+    .output_report_size = 1024,
     .reset = reset_gen2,
     .get_serial_number = get_serial_number_gen2,
     .get_firmware_version = get_firmware_version_gen2,
-    .set_brightness = set_brightness_gen2,
-    .set_button_texture = set_button_texture_gen2,
-    .set_touchscreen_texture = set_touchscreen_texture_plus,
-    .read_button_states = read_button_states_plus,
+    .build_brightness_report = build_brightness_report_gen2,
+    .set_button_image = set_button_image_gen2,
+    .set_touchscreen_image = set_touchscreen_image_plus,
+    .handle_input_report = handle_input_report_plus,
   },
   {
     .product_id = STREAMDECK_NEO_PRODUCT_ID,
@@ -1313,7 +2875,8 @@ static const StreamDeckModelInfo models_vtable[] = {
      */
     .name = N_("Stream Deck Neo"),
     .icon_name = "input-dialpad-symbolic",
-    .features = BS_STREAM_DECK_FEATURE_BUTTONS,
+    .features = BS_STREAM_DECK_FEATURE_BUTTONS |
+                BS_STREAM_DECK_FEATURE_BUTTON_IMAGES,
     .button_layout = {
       .n_buttons = 8,
       .columns = 4,
@@ -1324,12 +2887,13 @@ static const StreamDeckModelInfo models_vtable[] = {
         .flags = BS_RENDERER_FLAG_FLIP_X | BS_RENDERER_FLAG_FLIP_Y,
       },
     },
+    .output_report_size = 1024,
     .reset = reset_gen2,
     .get_serial_number = get_serial_number_gen2,
     .get_firmware_version = get_firmware_version_gen2,
-    .set_brightness = set_brightness_gen2,
-    .set_button_texture = set_button_texture_gen2,
-    .read_button_states = read_button_states_gen2,
+    .build_brightness_report = build_brightness_report_gen2,
+    .set_button_image = set_button_image_gen2,
+    .handle_input_report = handle_input_report_gen2,
   },
 };
 
@@ -1356,25 +2920,29 @@ get_firmware_version_fake (BsStreamDeck *self)
   return g_strdup ("feaneron-hangar-xl-firmware-version");
 }
 
-static void
-set_brightness_fake (BsStreamDeck *self,
-                     double        brightness)
+static size_t
+build_brightness_report_fake (BsStreamDeck *self,
+                              double        brightness,
+                              uint8_t      *report)
 {
+  return 0;
 }
 
 static gboolean
-set_button_texture_fake (BsStreamDeck  *self,
-                         BsButton      *button,
-                         GdkTexture    *texture,
-                         GError       **error)
+set_button_image_fake (BsStreamDeck   *self,
+                       BsButton       *button,
+                       const uint8_t  *image,
+                       size_t          image_size,
+                       GError        **error)
 {
   return TRUE;
 }
 
-static gboolean
-read_button_states_fake (BsStreamDeck *self)
+static void
+handle_input_report_fake (BsStreamDeck  *self,
+                          const uint8_t *report,
+                          size_t         length)
 {
-  return TRUE;
 }
 
 static const StreamDeckModelInfo fake_models_vtable[] = {
@@ -1382,7 +2950,8 @@ static const StreamDeckModelInfo fake_models_vtable[] = {
     .product_id = 0x0001,
     .name = N_("Feaneron Hangar Original"),
     .icon_name = "input-dialpad-symbolic",
-    .features = BS_STREAM_DECK_FEATURE_BUTTONS,
+    .features = BS_STREAM_DECK_FEATURE_BUTTONS |
+                BS_STREAM_DECK_FEATURE_BUTTON_IMAGES,
     .button_layout = {
       .n_buttons = 15,
       .columns = 5,
@@ -1396,15 +2965,16 @@ static const StreamDeckModelInfo fake_models_vtable[] = {
     .reset = reset_fake,
     .get_serial_number = get_serial_number_fake,
     .get_firmware_version = get_firmware_version_fake,
-    .set_brightness = set_brightness_fake,
-    .set_button_texture = set_button_texture_fake,
-    .read_button_states = read_button_states_fake,
+    .build_brightness_report = build_brightness_report_fake,
+    .set_button_image = set_button_image_fake,
+    .handle_input_report = handle_input_report_fake,
   },
   {
     .product_id = 0x0001,
     .name = N_("Feaneron Hangar XL"),
     .icon_name = "input-dialpad-symbolic",
-    .features = BS_STREAM_DECK_FEATURE_BUTTONS,
+    .features = BS_STREAM_DECK_FEATURE_BUTTONS |
+                BS_STREAM_DECK_FEATURE_BUTTON_IMAGES,
     .button_layout = {
       .n_buttons = 32,
       .columns = 8,
@@ -1418,78 +2988,122 @@ static const StreamDeckModelInfo fake_models_vtable[] = {
     .reset = reset_fake,
     .get_serial_number = get_serial_number_fake,
     .get_firmware_version = get_firmware_version_fake,
-    .set_brightness = set_brightness_fake,
-    .set_button_texture = set_button_texture_fake,
-    .read_button_states = read_button_states_fake,
+    .build_brightness_report = build_brightness_report_fake,
+    .set_button_image = set_button_image_fake,
+    .handle_input_report = handle_input_report_fake,
   },
 };
 
 /*
- * GSource
+ * Input
  */
 
-static gboolean
-stream_deck_source_dispatch (GSource     *source,
-                             GSourceFunc  callback,
-                             gpointer     user_data)
-{
-  StreamDeckSource *stream_deck_source = (StreamDeckSource *)source;
-  BsStreamDeck *self = stream_deck_source->stream_deck;
-  gint64 current_time;
-  gint64 expiration;
+static void
+on_input_report_cb (const uint8_t *report,
+                    size_t         length,
+                    int64_t        timestamp,
+                    gpointer       user_data)
+{
+  BsStreamDeck *self = BS_STREAM_DECK (user_data);
+  int64_t latency;
+  int64_t begin;
+
+  begin = BS_PROFILER_CURRENT_TIME;
+
+  notify_activity (self);
+
+  if (length > 0)
+    self->model_info->handle_input_report (self, report, length);
+
+  /* From arrival, including the wait for the main loop, until actions were triggered */
+  latency = MAX (g_get_monotonic_time () - timestamp, 0);
 
-  self->model_info->read_button_states (self);
+  self->stats.n_input_reports++;
+  self->stats.total_input_latency_us += latency;
+  self->stats.max_input_latency_us = MAX (self->stats.max_input_latency_us, latency);
+  add_to_histogram (self->stats.input_latency_histogram, latency);
 
-  current_time = g_source_get_time (source);
-  expiration = current_time + (guint64) POLL_RATE_MS * 1000;
-  g_source_set_ready_time (source, expiration);
+  BS_PROFILER_ADD_MARK (begin, "Input report", "serial=%s length=%zu", self->serial_number, length);
+}
 
-  return TRUE;
+static void
+start_input (BsStreamDeck *self)
+{
+  bs_hid_transport_set_input_func (self->transport, on_input_report_cb, self);
+  bs_hid_transport_start (self->transport);
 }
 
-GSourceFuncs stream_deck_source_funcs =
+static void
+stop_input (BsStreamDeck *self)
 {
-  NULL, /* prepare */
-  NULL, /* check */
-  stream_deck_source_dispatch,
-  NULL, NULL, NULL,
-};
+  bs_hid_transport_stop (self->transport);
+  bs_hid_transport_set_input_func (self->transport, NULL, NULL);
+}
 
-static GSource *
-stream_deck_source_new (BsStreamDeck *self)
+/*
+ * Setting BOATSWAIN_HID_RECORD_DIR records the reports exchanged with each
+ * device to a file in that directory, named after its bus and address.
+ * These recordings can be played back with BOATSWAIN_HID_REPLAY.
+ */
+static BsHidTransport *
+maybe_record_transport (BsStreamDeck   *self,
+                        BsHidTransport *transport)
 {
-  StreamDeckSource *stream_deck_source;
-  GSource *source;
+  g_autoptr (BsHidTransport) recorder = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autoptr (GFile) file = NULL;
+  g_autofree char *filename = NULL;
+  const char *record_dir;
 
-  source = g_source_new (&stream_deck_source_funcs, sizeof (StreamDeckSource));
-  stream_deck_source = (StreamDeckSource *)source;
-  stream_deck_source->stream_deck = self;
+  record_dir = g_getenv ("BOATSWAIN_HID_RECORD_DIR");
+  if (!record_dir)
+    return transport;
 
-  g_source_set_ready_time (source, g_get_monotonic_time ());
+  filename = g_strdup_printf ("%03u-%03u.bshid",
+                              g_usb_device_get_bus (self->device),
+                              g_usb_device_get_address (self->device));
+  file = g_file_new_build_filename (record_dir, filename, NULL);
 
-  return source;
+  recorder = bs_hid_recorder_new (transport, self->model_info->product_id, file, &error);
+  if (!recorder)
+    {
+      g_warning ("Failed to record %s: %s", filename, error->message);
+      return transport;
+    }
+
+  g_debug ("Recording HID reports to %s", g_file_peek_path (file));
+
+  g_object_unref (transport);
+  return g_steal_pointer (&recorder);
 }
 
 
 /*
- * GInitable interface
+ * Initialization
  */
 
+/*
+ * Opens the device and reads its identifiers. This blocks on USB round
+ * trips, and may run in a thread.
+ */
 static gboolean
-bs_stream_deck_initable_init (GInitable     *initable,
-                              GCancellable  *cancellable,
-                              GError       **error)
+open_device (BsStreamDeck  *self,
+             GError       **error)
 {
-  BsStreamDeck *self = BS_STREAM_DECK (initable);
-  unsigned int row = 0;
-
   BS_ENTRY;
 
+  /* Devices created with a transport already know their model */
+  if (self->transport)
+    BS_GOTO (out);
+
   /* Short-circuit fake devices here */
   if (self->fake)
     {
       static int fake_index = 0;
-      self->model_info = &fake_models_vtable[fake_index++ % G_N_ELEMENTS (fake_models_vtable)];
+      int index = g_atomic_int_add (&fake_index, 1);
+
+      self->model_info = &fake_models_vtable[index % G_N_ELEMENTS (fake_models_vtable)];
+      self->transport = bs_hid_transport_new_null ();
       BS_GOTO (out);
     }
 
@@ -1526,28 +3140,62 @@ bs_stream_deck_initable_init (GInitable     *initable,
       BS_RETURN (FALSE);
     }
 
-  self->handle = hid_open (g_usb_device_get_vid (self->device),
-                           g_usb_device_get_pid (self->device),
-                           NULL);
-
-  if (!self->handle)
-    {
-      g_set_error (error,
-                   G_IO_ERROR,
-                   G_IO_ERROR_FAILED,
-                   "Failed to open Stream Deck device");
-      BS_RETURN (FALSE);
-    }
+  self->transport = bs_usb_transport_new (self->device, error);
 
-  hid_set_nonblocking (self->handle, TRUE);
+  if (!self->transport)
+    BS_RETURN (FALSE);
 
-  self->poll_source = stream_deck_source_new (self);
+  self->transport = maybe_record_transport (self, self->transport);
 
 out:
   self->serial_number = self->model_info->get_serial_number (self);
   self->firmware_version = self->model_info->get_firmware_version (self);
+
+  BS_RETURN (TRUE);
+}
+
+/* Creates the regions of an opened device. Must run in the main thread. */
+static void
+setup_device (BsStreamDeck *self)
+{
+  unsigned int row = 0;
+
+  BS_ENTRY;
+
   self->icon = g_themed_icon_new (self->model_info->icon_name);
 
+  self->settings = g_settings_new ("com.feaneron.Boatswain");
+  g_signal_connect_object (self->settings,
+                           "changed::brightness-update-rate",
+                           G_CALLBACK (update_brightness_rate),
+                           self,
+                           G_CONNECT_SWAPPED);
+  g_signal_connect_object (self->settings,
+                           "changed::idle-dim-timeout",
+                           G_CALLBACK (schedule_idle_dim),
+                           self,
+                           G_CONNECT_SWAPPED);
+  g_signal_connect_object (self->settings,
+                           "changed::upload-frame-rate",
+                           G_CALLBACK (update_upload_budget),
+                           self,
+                           G_CONNECT_SWAPPED);
+  g_signal_connect_object (self->settings,
+                           "changed::upload-byte-rate",
+                           G_CALLBACK (update_upload_budget),
+                           self,
+                           G_CONNECT_SWAPPED);
+  update_brightness_rate (self);
+  update_upload_budget (self);
+
+  self->n_key_images = self->model_info->button_layout.n_buttons;
+  if (self->model_info->features & BS_STREAM_DECK_FEATURE_TOUCHSCREEN)
+    self->n_key_images++;
+  self->key_images = g_new0 (KeyImage, self->n_key_images);
+  self->animation_caches = g_new0 (AnimationCache, self->model_info->button_layout.n_buttons);
+
+  preallocate_io_requests (self);
+
   /* All Elgato Stream Decks have one button grid */
   g_assert (self->model_info->features & BS_STREAM_DECK_FEATURE_BUTTONS);
 
@@ -1591,8 +3239,32 @@ out:
       g_list_store_append (self->regions, dial_grid);
     }
 
+  build_input_dispatch_tables (self, self->model_info->handle_input_report == handle_input_report_original);
+
   self->initialized = TRUE;
 
+  BS_EXIT;
+}
+
+
+/*
+ * GInitable interface
+ */
+
+static gboolean
+bs_stream_deck_initable_init (GInitable     *initable,
+                              GCancellable  *cancellable,
+                              GError       **error)
+{
+  BsStreamDeck *self = BS_STREAM_DECK (initable);
+
+  BS_ENTRY;
+
+  if (!open_device (self, error))
+    BS_RETURN (FALSE);
+
+  setup_device (self);
+
   BS_RETURN (TRUE);
 }
 
@@ -1602,6 +3274,83 @@ g_initable_iface_init (GInitableIface *iface)
   iface->init = bs_stream_deck_initable_init;
 }
 
+
+/*
+ * GAsyncInitable interface
+ */
+
+static void
+open_device_in_thread_cb (GTask        *task,
+                          gpointer      source_object,
+                          gpointer      task_data,
+                          GCancellable *cancellable)
+{
+  g_autoptr (GError) error = NULL;
+
+  if (!open_device (BS_STREAM_DECK (source_object), &error))
+    g_task_return_error (task, g_steal_pointer (&error));
+  else
+    g_task_return_boolean (task, TRUE);
+}
+
+static void
+on_device_opened_cb (GObject      *source_object,
+                     GAsyncResult *result,
+                     gpointer      user_data)
+{
+  g_autoptr (GError) error = NULL;
+  g_autoptr (GTask) task = user_data;
+
+  if (!g_task_propagate_boolean (G_TASK (result), &error))
+    {
+      g_task_return_error (task, g_steal_pointer (&error));
+      return;
+    }
+
+  setup_device (BS_STREAM_DECK (source_object));
+
+  g_task_return_boolean (task, TRUE);
+}
+
+static void
+bs_stream_deck_async_initable_init_async (GAsyncInitable      *initable,
+                                          int                  io_priority,
+                                          GCancellable        *cancellable,
+                                          GAsyncReadyCallback  callback,
+                                          gpointer             user_data)
+{
+  g_autoptr (GTask) open_task = NULL;
+  g_autoptr (GTask) task = NULL;
+
+  task = g_task_new (initable, cancellable, callback, user_data);
+  g_task_set_static_name (task, "bs_stream_deck_async_initable_init_async");
+  g_task_set_source_tag (task, bs_stream_deck_async_initable_init_async);
+  g_task_set_priority (task, io_priority);
+
+  /* Only opening the device blocks; regions are created back here */
+  open_task = g_task_new (initable, cancellable, on_device_opened_cb, g_steal_pointer (&task));
+  g_task_set_priority (open_task, io_priority);
+  g_task_run_in_thread (open_task, open_device_in_thread_cb);
+}
+
+static gboolean
+bs_stream_deck_async_initable_init_finish (GAsyncInitable  *initable,
+                                           GAsyncResult    *result,
+                                           GError         **error)
+{
+  g_assert (g_task_is_valid (result, initable));
+  g_assert (g_task_get_source_tag (G_TASK (result)) == bs_stream_deck_async_initable_init_async);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+static void
+g_async_initable_iface_init (GAsyncInitableIface *iface)
+{
+  iface->init_async = bs_stream_deck_async_initable_init_async;
+  iface->init_finish = bs_stream_deck_async_initable_init_finish;
+}
+
 /*
  * GObject overrides
  */
@@ -1619,16 +3368,47 @@ bs_stream_deck_finalize (GObject *object)
       bs_stream_deck_reset (self);
     }
 
-  if (self->device)
-    g_usb_device_close (self->device, NULL);
+  /* Stopping the I/O thread flushes pending requests, including the reset */
+  stop_brightness_updates (self);
+  stop_io_thread (self);
+
+  if (self->transport)
+    stop_input (self);
+
+  /* In-flight input transfers may still hold the device open until they complete */
+  g_clear_object (&self->transport);
 
-  if (self->poll_source)
-    g_source_destroy (self->poll_source);
-  g_clear_pointer (&self->poll_source, g_source_unref);
+  io_request_list_clear (&self->io_requests);
+  io_request_list_clear (&self->free_io_requests);
+  g_cond_clear (&self->io_cond);
+  g_mutex_clear (&self->io_lock);
 
   g_clear_handle_id (&self->save_timeout_id, g_source_remove);
+  g_clear_handle_id (&self->idle_dim_timeout_id, g_source_remove);
+  g_clear_object (&self->settings);
+  g_clear_handle_id (&self->flush_uploads_id, g_source_remove);
+  g_clear_pointer (&self->pending_uploads, g_ptr_array_unref);
+  g_clear_pointer (&self->flushing_uploads, g_ptr_array_unref);
+  g_clear_pointer (&self->idle_upload_batches, g_ptr_array_unref);
+  g_clear_pointer (&self->idle_upload_tasks, g_ptr_array_unref);
+  /* Batches hold a reference, so no task is pending anymore */
+  g_thread_pool_free (g_steal_pointer (&self->upload_thread_pool), FALSE, TRUE);
+  g_clear_pointer (&self->key_images, g_free);
+  if (self->animation_caches)
+    {
+      for (size_t i = 0; i < self->model_info->button_layout.n_buttons; i++)
+        animation_cache_clear (&self->animation_caches[i]);
+      g_clear_pointer (&self->animation_caches, g_free);
+    }
+  g_clear_pointer (&self->input_buttons, g_free);
+  g_clear_pointer (&self->button_states, g_free);
+  g_clear_pointer (&self->input_dials, g_free);
+  g_clear_pointer (&self->dial_states, g_free);
+  g_mutex_clear (&self->upload_lock);
+  g_mutex_clear (&self->animation_lock);
+  g_mutex_clear (&self->budget_lock);
+  g_mutex_clear (&self->write_lock);
   g_clear_pointer (&self->serial_number, g_free);
-  g_clear_pointer (&self->handle, hid_close);
   g_queue_free_full (self->active_pages, g_object_unref);
   g_clear_object (&self->regions);
   g_clear_object (&self->device);
@@ -1758,6 +3538,21 @@ bs_stream_deck_init (BsStreamDeck *self)
   self->profiles = g_list_store_new (BS_TYPE_PROFILE);
   self->regions = g_list_store_new (BS_TYPE_DEVICE_REGION);
   self->active_pages = g_queue_new ();
+  self->pending_uploads = g_ptr_array_new_with_free_func (g_object_unref);
+  self->flushing_uploads = g_ptr_array_new_with_free_func (g_object_unref);
+  self->idle_upload_batches = g_ptr_array_new_with_free_func ((GDestroyNotify) upload_batch_free);
+  self->idle_upload_tasks = g_ptr_array_new_with_free_func (g_free);
+  self->upload_thread_pool = g_thread_pool_new (run_upload_task_func,
+                                                NULL,
+                                                CLAMP (g_get_num_processors (), 1, MAX_UPLOAD_THREADS),
+                                                FALSE,
+                                                NULL);
+  g_mutex_init (&self->upload_lock);
+  g_mutex_init (&self->animation_lock);
+  g_mutex_init (&self->budget_lock);
+  g_mutex_init (&self->write_lock);
+  g_mutex_init (&self->io_lock);
+  g_cond_init (&self->io_cond);
 }
 
 BsStreamDeck *
@@ -1771,6 +3566,175 @@ bs_stream_deck_new (GUsbDevice  *gusb_device,
                          NULL);
 }
 
+/**
+ * bs_stream_deck_new_async:
+ * @gusb_device: a #GUsbDevice
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: callback to call when the device is ready
+ * @user_data: user data for @callback
+ *
+ * Asynchronously creates a #BsStreamDeck for @gusb_device. The USB
+ * round trips of opening the device happen in a thread, so that several
+ * devices can be brought up concurrently.
+ */
+void
+bs_stream_deck_new_async (GUsbDevice          *gusb_device,
+                          GCancellable        *cancellable,
+                          GAsyncReadyCallback  callback,
+                          gpointer             user_data)
+{
+  g_async_initable_new_async (BS_TYPE_STREAM_DECK,
+                              G_PRIORITY_DEFAULT,
+                              cancellable,
+                              callback,
+                              user_data,
+                              "device", gusb_device,
+                              NULL);
+}
+
+/**
+ * bs_stream_deck_new_finish:
+ * @result: a #GAsyncResult provided to callback
+ * @error: a location for a #GError, or %NULL
+ *
+ * Finishes creating a #BsStreamDeck started with bs_stream_deck_new_async().
+ *
+ * Returns: (transfer full)(nullable): a #BsStreamDeck, or %NULL
+ */
+BsStreamDeck *
+bs_stream_deck_new_finish (GAsyncResult  *result,
+                           GError       **error)
+{
+  g_autoptr (GObject) source_object = NULL;
+  GObject *object;
+
+  source_object = g_async_result_get_source_object (result);
+  object = g_async_initable_new_finish (G_ASYNC_INITABLE (source_object), result, error);
+
+  return object ? BS_STREAM_DECK (object) : NULL;
+}
+
+/**
+ * bs_stream_deck_get_n_models:
+ *
+ * Retrieves the number of supported Stream Deck models.
+ *
+ * Returns: the number of models
+ */
+unsigned int
+bs_stream_deck_get_n_models (void)
+{
+  return G_N_ELEMENTS (models_vtable);
+}
+
+/**
+ * bs_stream_deck_get_model_product_id:
+ * @model_index: index of the model, below bs_stream_deck_get_n_models()
+ *
+ * Retrieves the USB product id of a supported Stream Deck model.
+ *
+ * Returns: the USB product id
+ */
+uint16_t
+bs_stream_deck_get_model_product_id (unsigned int model_index)
+{
+  g_return_val_if_fail (model_index < G_N_ELEMENTS (models_vtable), 0);
+
+  return models_vtable[model_index].product_id;
+}
+
+/**
+ * bs_stream_deck_get_model_has_button_images:
+ * @model_index: index of the model, below bs_stream_deck_get_n_models()
+ *
+ * Retrieves whether the buttons of a supported Stream Deck model show
+ * images. The Stream Deck Pedal, for example, has buttons but no display.
+ *
+ * Returns: whether buttons of the model show images
+ */
+gboolean
+bs_stream_deck_get_model_has_button_images (unsigned int model_index)
+{
+  g_return_val_if_fail (model_index < G_N_ELEMENTS (models_vtable), FALSE);
+
+  return (models_vtable[model_index].features & BS_STREAM_DECK_FEATURE_BUTTON_IMAGES) != 0;
+}
+
+/**
+ * bs_stream_deck_get_max_button_size:
+ *
+ * Retrieves the largest width or height of button images among all
+ * supported Stream Deck models. Images larger than that are never
+ * shown at their full size on any device.
+ *
+ * Returns: the largest button image size, in pixels
+ */
+uint32_t
+bs_stream_deck_get_max_button_size (void)
+{
+  uint32_t max_size = 0;
+
+  for (size_t i = 0; i < G_N_ELEMENTS (models_vtable); i++)
+    {
+      const BsImageInfo *image_info = &models_vtable[i].button_layout.image_info;
+
+      max_size = MAX (max_size, MAX (image_info->width, image_info->height));
+    }
+
+  return max_size;
+}
+
+/**
+ * bs_stream_deck_new_with_transport:
+ * @transport: a #BsHidTransport
+ * @product_id: USB product id of the model to create
+ * @error: a location for a #GError, or %NULL
+ *
+ * Creates a #BsStreamDeck of the given model that talks to @transport
+ * instead of a USB device, such as a null transport for benchmarks, or
+ * a replay of a recording. Profiles of these devices are not saved.
+ *
+ * Returns: (transfer full)(nullable): a #BsStreamDeck, or %NULL
+ */
+BsStreamDeck *
+bs_stream_deck_new_with_transport (BsHidTransport  *transport,
+                                   uint16_t         product_id,
+                                   GError         **error)
+{
+  g_autoptr (BsStreamDeck) self = NULL;
+  const StreamDeckModelInfo *model_info = NULL;
+
+  g_return_val_if_fail (BS_IS_HID_TRANSPORT (transport), NULL);
+
+  for (size_t i = 0; i < G_N_ELEMENTS (models_vtable); i++)
+    {
+      if (models_vtable[i].product_id == product_id)
+        {
+          model_info = &models_vtable[i];
+          break;
+        }
+    }
+
+  if (!model_info)
+    {
+      g_set_error (error,
+                   BS_STREAM_DECK_ERROR,
+                   BS_STREAM_DECK_ERROR_UNRECOGNIZED,
+                   "Not a recognized Stream Deck device");
+      return NULL;
+    }
+
+  self = g_object_new (BS_TYPE_STREAM_DECK, NULL);
+  self->model_info = model_info;
+  self->transport = g_object_ref (transport);
+  self->ephemeral = TRUE;
+
+  if (!g_initable_init (G_INITABLE (self), NULL, error))
+    return NULL;
+
+  return g_steal_pointer (&self);
+}
+
 BsStreamDeck *
 bs_stream_deck_new_fake (GError **error)
 {
@@ -1788,6 +3752,9 @@ bs_stream_deck_reset (BsStreamDeck *self)
   g_return_if_fail (self->model_info->reset != NULL);
 
   self->model_info->reset (self);
+
+  /* Resetting clears the screen */
+  forget_uploaded_images (self);
 }
 
 GUsbDevice *
@@ -1851,7 +3818,8 @@ bs_stream_deck_get_brightness (BsStreamDeck *self)
  * @self: a #BsStreamDeck
  * @brightness: a double between and including 0.0 and 1.0
  *
- * Sets the brightness of @self to @brightness.
+ * Sets the brightness of @self to @brightness. The device is updated
+ * asynchronously, and successive calls may be coalesced.
  */
 void
 bs_stream_deck_set_brightness (BsStreamDeck *self,
@@ -1859,17 +3827,54 @@ bs_stream_deck_set_brightness (BsStreamDeck *self,
 {
   g_return_if_fail (BS_IS_STREAM_DECK (self));
   g_return_if_fail (brightness >= 0.0 && brightness <= 1.0);
-  g_return_if_fail (self->model_info->set_brightness != NULL);
+  g_return_if_fail (self->model_info->build_brightness_report != NULL);
 
   if (G_APPROX_VALUE (self->brightness, brightness, FLT_EPSILON))
     return;
 
   self->brightness = brightness;
-  self->model_info->set_brightness (self, brightness);
+
+  /* Coalesced and rate-limited by the I/O thread */
+  self->dimmed = FALSE;
+  fade_device_brightness (self, brightness, 0);
+  notify_activity (self);
 
   g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_BRIGHTNESS]);
 }
 
+/**
+ * bs_stream_deck_write_button_image:
+ * @self: a #BsStreamDeck
+ * @button: a #BsButton of @self
+ * @image: (array length=image_size): an encoded image
+ * @image_size: the size of @image
+ * @error: a location for a #GError, or %NULL
+ *
+ * Packetizes and writes @image to @button right away, bypassing the upload
+ * queue and the encoded image cache. This is meant for benchmarks.
+ *
+ * Returns: whether writing succeeded
+ */
+gboolean
+bs_stream_deck_write_button_image (BsStreamDeck   *self,
+                                   BsButton       *button,
+                                   const uint8_t  *image,
+                                   size_t          image_size,
+                                   GError        **error)
+{
+  gboolean success;
+
+  g_return_val_if_fail (BS_IS_STREAM_DECK (self), FALSE);
+  g_return_val_if_fail (BS_IS_BUTTON (button), FALSE);
+  g_return_val_if_fail (bs_button_get_stream_deck (button) == self, FALSE);
+
+  g_mutex_lock (&self->write_lock);
+  success = self->model_info->set_button_image (self, button, image, image_size, error);
+  g_mutex_unlock (&self->write_lock);
+
+  return success;
+}
+
 GListModel *
 bs_stream_deck_get_regions (BsStreamDeck *self)
 {
@@ -1904,52 +3909,109 @@ bs_stream_deck_is_initialized (BsStreamDeck *self)
   return self->initialized;
 }
 
-gboolean
-bs_stream_deck_upload_button (BsStreamDeck  *self,
-                              BsButton      *button,
-                              GError       **error)
+void
+bs_stream_deck_queue_button_upload (BsStreamDeck *self,
+                                    BsButton     *button)
 {
-  g_autoptr (GdkTexture) texture = NULL;
-  BsDeviceRegion *region;
-  BsRenderer *renderer;
-  BsIcon *icon;
+  g_return_if_fail (BS_IS_STREAM_DECK (self));
+  g_return_if_fail (BS_IS_BUTTON (button));
 
-  g_return_val_if_fail (BS_IS_STREAM_DECK (self), FALSE);
-  g_return_val_if_fail (self->model_info->set_button_texture != NULL, FALSE);
+  BS_PROFILER_ADD_MARK (BS_PROFILER_CURRENT_TIME,
+                        "Icon invalidated",
+                        "serial=%s key=%u",
+                        self->serial_number,
+                        bs_button_get_position (button));
+
+  queue_upload (self, button);
+}
 
-  icon = bs_button_get_icon (button);
-  region = bs_button_get_region (button);
-  renderer = bs_device_region_get_renderer (region);
-  texture = bs_renderer_compose_icon (renderer, icon, error);
+void
+bs_stream_deck_queue_touchscreen_upload (BsStreamDeck  *self,
+                                         BsTouchscreen *touchscreen)
+{
+  g_return_if_fail (BS_IS_STREAM_DECK (self));
+  g_return_if_fail (BS_IS_TOUCHSCREEN (touchscreen));
 
-  if (!texture)
-    return FALSE;
+  BS_PROFILER_ADD_MARK (BS_PROFILER_CURRENT_TIME,
+                        "Icon invalidated",
+                        "serial=%s touchscreen",
+                        self->serial_number);
 
-  return self->model_info->set_button_texture (self, button, texture, error);
+  queue_upload (self, touchscreen);
 }
 
-gboolean
-bs_stream_deck_upload_touchscreen (BsStreamDeck   *self,
-                                   BsTouchscreen  *touchscreen,
-                                   GError        **error)
+/**
+ * bs_stream_deck_get_stats:
+ * @self: a #BsStreamDeck
+ * @stats: (out caller-allocates): return location for the statistics
+ *
+ * Retrieves runtime statistics of @self.
+ */
+void
+bs_stream_deck_get_stats (BsStreamDeck      *self,
+                          BsStreamDeckStats *stats)
 {
-  g_autoptr (GdkTexture) texture = NULL;
-  BsTouchscreenContent *content;
-  BsDeviceRegion *region;
-  BsRenderer *renderer;
+  g_return_if_fail (BS_IS_STREAM_DECK (self));
+  g_return_if_fail (stats != NULL);
+
+  g_mutex_lock (&self->upload_lock);
+  g_mutex_lock (&self->animation_lock);
+  g_mutex_lock (&self->io_lock);
+  *stats = self->stats;
+  g_mutex_unlock (&self->io_lock);
+  g_mutex_unlock (&self->animation_lock);
+  g_mutex_unlock (&self->upload_lock);
+}
 
-  g_return_val_if_fail (BS_IS_STREAM_DECK (self), FALSE);
-  g_return_val_if_fail (self->model_info->set_button_texture != NULL, FALSE);
+/**
+ * bs_stream_deck_get_n_keys:
+ * @self: a #BsStreamDeck
+ *
+ * Retrieves the number of images @self uploads separately: one per button,
+ * followed by the touchscreen.
+ *
+ * Returns: the number of keys of @self
+ */
+size_t
+bs_stream_deck_get_n_keys (BsStreamDeck *self)
+{
+  g_return_val_if_fail (BS_IS_STREAM_DECK (self), 0);
+
+  return self->n_key_images;
+}
+
+/**
+ * bs_stream_deck_get_key_frame_rate:
+ * @self: a #BsStreamDeck
+ * @key: index of the key
+ *
+ * Retrieves how many images per second were written to @key recently.
+ * Unchanged images are not counted.
+ *
+ * Returns: the effective frame rate of @key
+ */
+double
+bs_stream_deck_get_key_frame_rate (BsStreamDeck *self,
+                                   size_t        key)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+  KeyImage *key_image;
+  int64_t elapsed;
+
+  g_return_val_if_fail (BS_IS_STREAM_DECK (self), 0.0);
+  g_return_val_if_fail (key < self->n_key_images, 0.0);
 
-  content = bs_touchscreen_get_content (touchscreen);
-  region = bs_touchscreen_get_region (touchscreen);
-  renderer = bs_device_region_get_renderer (region);
-  texture = bs_renderer_compose_touchscreen_content (renderer, content, error);
+  locker = g_mutex_locker_new (&self->budget_lock);
 
-  if (!texture)
-    return FALSE;
+  key_image = &self->key_images[key];
+  elapsed = g_get_monotonic_time () - key_image->window_start;
 
-  return self->model_info->set_touchscreen_texture (self, touchscreen, texture, error);
+  if (elapsed >= 2 * FRAME_RATE_WINDOW_US)
+    return 0.0;
+  else if (elapsed >= FRAME_RATE_WINDOW_US)
+    return key_image->n_window_frames * (double) G_USEC_PER_SEC / elapsed;
+  else
+    return key_image->frame_rate;
 }
 
 GListModel *
@@ -2055,7 +4117,15 @@ bs_stream_deck_load (BsStreamDeck *self)
   g_return_if_fail (!self->loaded);
 
   if (!self->fake)
-    g_source_attach (self->poll_source, NULL);
+    {
+      start_input (self);
+      start_io_thread (self);
+      start_brightness_updates (self);
+
+      /* Being plugged in counts as activity, so untouched devices dim too */
+      self->last_activity_time = g_get_monotonic_time ();
+      schedule_idle_dim (self);
+    }
 
   load_profiles (self);
 
@@ -0,0 +1,283 @@
+/* bs-thumbnail.c
+ *
+ * Copyright 2022 Georges Basile Stavracas Neto <georges.stavracas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define G_LOG_DOMAIN "Thumbnail"
+
+#include "bs-thumbnail.h"
+
+#include <errno.h>
+#include <glib/gstdio.h>
+#include <math.h>
+
+/*
+ * Custom icons are often photos or artwork many times larger than any key,
+ * and used to be decoded on the main thread, and scaled down on every
+ * compose. Images are now decoded in a thread, scaled down once to fit the
+ * requested size, and the result is saved as a PNG in the cache directory,
+ * keyed by a hash of the contents of the original file and the size. Later
+ * loads of the same image only decode the small PNG.
+ *
+ * Images that already fit are used as they are, and not cached.
+ */
+
+typedef struct
+{
+  GFile *file;
+  int size;
+} LoadData;
+
+
+/*
+ * Auxiliary methods
+ */
+
+static void
+load_data_free (gpointer data)
+{
+  LoadData *load_data = data;
+
+  g_clear_object (&load_data->file);
+  g_free (load_data);
+}
+
+static char *
+get_cache_path (GBytes *bytes,
+                int     size)
+{
+  g_autofree char *checksum = NULL;
+  g_autofree char *filename = NULL;
+
+  checksum = g_compute_checksum_for_bytes (G_CHECKSUM_SHA256, bytes);
+  filename = g_strdup_printf ("%s-%d.png", checksum, size);
+
+  return g_build_filename (g_get_user_cache_dir (), "boatswain", "thumbnails", filename, NULL);
+}
+
+static GdkTexture *
+downscale_texture (GdkTexture *texture,
+                   int         size)
+{
+  g_autoptr (GBytes) bytes = NULL;
+  cairo_surface_t *source;
+  cairo_surface_t *surface;
+  cairo_t *cr;
+  double scale;
+  int scaled_height;
+  int scaled_width;
+  int height;
+  int stride;
+  int width;
+
+  width = gdk_texture_get_width (texture);
+  height = gdk_texture_get_height (texture);
+  scale = MIN ((double) size / width, (double) size / height);
+  scaled_width = MAX (1, (int) round (width * scale));
+  scaled_height = MAX (1, (int) round (height * scale));
+
+  /* Cairo's ARGB32 is GDK_MEMORY_DEFAULT, which is what downloads produce */
+  source = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
+  gdk_texture_download (texture,
+                        cairo_image_surface_get_data (source),
+                        cairo_image_surface_get_stride (source));
+  cairo_surface_mark_dirty (source);
+
+  surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, scaled_width, scaled_height);
+
+  cr = cairo_create (surface);
+  cairo_scale (cr, scale, scale);
+  cairo_set_source_surface (cr, source, 0, 0);
+  cairo_pattern_set_filter (cairo_get_source (cr), CAIRO_FILTER_GOOD);
+  cairo_paint (cr);
+  cairo_destroy (cr);
+
+  cairo_surface_destroy (source);
+  cairo_surface_flush (surface);
+
+  if (cairo_surface_status (surface) != CAIRO_STATUS_SUCCESS)
+    {
+      cairo_surface_destroy (surface);
+      return NULL;
+    }
+
+  stride = cairo_image_surface_get_stride (surface);
+  bytes = g_bytes_new_with_free_func (cairo_image_surface_get_data (surface),
+                                      (size_t) stride * scaled_height,
+                                      (GDestroyNotify) cairo_surface_destroy,
+                                      surface);
+
+  return gdk_memory_texture_new (scaled_width, scaled_height, GDK_MEMORY_DEFAULT, bytes, stride);
+}
+
+static void
+save_thumbnail (GdkTexture *texture,
+                const char *cache_path)
+{
+  g_autoptr (GError) error = NULL;
+  g_autoptr (GBytes) png = NULL;
+  g_autofree char *dirname = NULL;
+
+  dirname = g_path_get_dirname (cache_path);
+
+  if (g_mkdir_with_parents (dirname, 0755) != 0)
+    {
+      g_warning ("Error creating thumbnail directory %s: %s", dirname, g_strerror (errno));
+      return;
+    }
+
+  png = gdk_texture_save_to_png_bytes (texture);
+
+  if (!g_file_set_contents (cache_path,
+                            g_bytes_get_data (png, NULL),
+                            g_bytes_get_size (png),
+                            &error))
+    {
+      g_warning ("Error saving thumbnail: %s", error->message);
+    }
+}
+
+static void
+load_thumbnail_in_thread_cb (GTask        *task,
+                             gpointer      source_object,
+                             gpointer      task_data,
+                             GCancellable *cancellable)
+{
+  g_autoptr (GdkTexture) thumbnail = NULL;
+  g_autoptr (GdkTexture) texture = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autoptr (GBytes) bytes = NULL;
+  g_autofree char *cache_path = NULL;
+  LoadData *load_data;
+
+  load_data = task_data;
+
+  bytes = g_file_load_bytes (load_data->file, cancellable, NULL, &error);
+  if (!bytes)
+    {
+      g_task_return_error (task, g_steal_pointer (&error));
+      return;
+    }
+
+  cache_path = get_cache_path (bytes, load_data->size);
+
+  if (g_file_test (cache_path, G_FILE_TEST_IS_REGULAR))
+    {
+      thumbnail = gdk_texture_new_from_filename (cache_path, &error);
+
+      if (thumbnail)
+        {
+          g_task_return_pointer (task, g_steal_pointer (&thumbnail), g_object_unref);
+          return;
+        }
+
+      g_warning ("Error loading thumbnail %s, regenerating it: %s", cache_path, error->message);
+      g_clear_error (&error);
+    }
+
+  if (g_task_return_error_if_cancelled (task))
+    return;
+
+  texture = gdk_texture_new_from_bytes (bytes, &error);
+  if (!texture)
+    {
+      g_task_return_error (task, g_steal_pointer (&error));
+      return;
+    }
+
+  if (gdk_texture_get_width (texture) <= load_data->size &&
+      gdk_texture_get_height (texture) <= load_data->size)
+    {
+      g_task_return_pointer (task, g_steal_pointer (&texture), g_object_unref);
+      return;
+    }
+
+  thumbnail = downscale_texture (texture, load_data->size);
+  if (!thumbnail)
+    {
+      /* Better a large icon than none */
+      g_warning ("Error scaling down image, using it at full size");
+      g_task_return_pointer (task, g_steal_pointer (&texture), g_object_unref);
+      return;
+    }
+
+  save_thumbnail (thumbnail, cache_path);
+
+  g_task_return_pointer (task, g_steal_pointer (&thumbnail), g_object_unref);
+}
+
+
+/*
+ * Public API
+ */
+
+/**
+ * bs_thumbnail_load_async:
+ * @file: a #GFile with an image
+ * @size: the largest width and height of the thumbnail, in pixels
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: callback to call when the thumbnail is loaded
+ * @user_data: data to pass to @callback
+ *
+ * Loads the image in @file in a thread, scaled down to fit @size while
+ * keeping its aspect ratio. Scaled images are cached, and reused while
+ * the contents of @file do not change.
+ */
+void
+bs_thumbnail_load_async (GFile               *file,
+                         int                  size,
+                         GCancellable        *cancellable,
+                         GAsyncReadyCallback  callback,
+                         gpointer             user_data)
+{
+  g_autoptr (GTask) task = NULL;
+  LoadData *load_data;
+
+  g_return_if_fail (G_IS_FILE (file));
+  g_return_if_fail (size > 0);
+  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  load_data = g_new0 (LoadData, 1);
+  load_data->file = g_object_ref (file);
+  load_data->size = size;
+
+  task = g_task_new (NULL, cancellable, callback, user_data);
+  g_task_set_static_name (task, "bs_thumbnail_load_async");
+  g_task_set_source_tag (task, bs_thumbnail_load_async);
+  g_task_set_task_data (task, load_data, load_data_free);
+  g_task_run_in_thread (task, load_thumbnail_in_thread_cb);
+}
+
+/**
+ * bs_thumbnail_load_finish:
+ * @result: a #GAsyncResult
+ * @error: (nullable): return location for a #GError
+ *
+ * Finishes an operation started with bs_thumbnail_load_async().
+ *
+ * Returns: (transfer full) (nullable): a #GdkTexture, or %NULL
+ */
+GdkTexture *
+bs_thumbnail_load_finish (GAsyncResult  *result,
+                          GError       **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+  g_return_val_if_fail (g_task_get_source_tag (G_TASK (result)) == bs_thumbnail_load_async, NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
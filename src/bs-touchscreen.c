@@ -139,7 +139,6 @@ static void
 on_contents_invalidated_cb (GdkPaintable  *paintable,
                             BsTouchscreen *self)
 {
-  g_autoptr (GError) error = NULL;
   BsStreamDeck *stream_deck;
 
   stream_deck = bs_device_region_get_stream_deck (self->region);
@@ -147,10 +146,7 @@ on_contents_invalidated_cb (GdkPaintable  *paintable,
   if (!bs_stream_deck_is_initialized (stream_deck))
     return;
 
-  bs_stream_deck_upload_touchscreen (stream_deck, self, &error);
-
-  if (error)
-    g_warning ("Error updating Stream Deck touchscreen: %s", error->message);
+  bs_stream_deck_queue_touchscreen_upload (stream_deck, self);
 }
 
 BsTouchscreen *
@@ -0,0 +1,394 @@
+/* bs-trace.c
+ *
+ * Copyright 2022 Georges Basile Stavracas Neto <georges.stavracas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define G_LOG_DOMAIN "Trace"
+
+#include "bs-trace.h"
+
+#include <errno.h>
+#include <glib/gstdio.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+# include <sys/prctl.h>
+#endif
+
+/* Must be a power of two */
+#define N_EVENTS_PER_THREAD 16384
+#define THREAD_NAME_LENGTH 16
+
+/*
+ * Each thread records events into its own ring buffer, so recording never
+ * takes a lock, nor formats anything: it stores a few pointers and a
+ * timestamp, and publishes the event by bumping head. Dumping copies the
+ * buffers while threads keep recording, and discards the events that might
+ * have been overwritten meanwhile, like a seqlock.
+ *
+ * Buffers are never freed. When a thread exits, its buffer is retired, and
+ * kept around for dumps until a new thread takes it over.
+ */
+
+typedef struct
+{
+  int64_t timestamp;
+  const char *domain;
+  const char *function;
+  const char *detail;
+  uint64_t argument;
+  uint32_t line;
+  uint32_t type;
+} TraceEvent;
+
+typedef struct
+{
+  _Atomic uint64_t head;
+  unsigned int thread_id;
+  char thread_name[THREAD_NAME_LENGTH];
+  gboolean retired;
+  TraceEvent events[N_EVENTS_PER_THREAD];
+} ThreadBuffer;
+
+static void retire_thread_buffer (gpointer data);
+
+static GPrivate thread_buffer = G_PRIVATE_INIT (retire_thread_buffer);
+
+/* Protects buffers, and the fields of buffers other than head and events */
+static GMutex buffers_lock;
+static GPtrArray *buffers = NULL;
+static unsigned int next_thread_id = 1;
+
+
+/*
+ * Auxiliary methods
+ */
+
+static void
+retire_thread_buffer (gpointer data)
+{
+  ThreadBuffer *buffer = data;
+
+  g_mutex_lock (&buffers_lock);
+  buffer->retired = TRUE;
+  g_mutex_unlock (&buffers_lock);
+}
+
+static ThreadBuffer *
+acquire_thread_buffer (void)
+{
+  ThreadBuffer *buffer = NULL;
+
+  g_mutex_lock (&buffers_lock);
+
+  if (!buffers)
+    buffers = g_ptr_array_new ();
+
+  for (size_t i = 0; i < buffers->len; i++)
+    {
+      ThreadBuffer *candidate = g_ptr_array_index (buffers, i);
+
+      if (candidate->retired)
+        {
+          buffer = candidate;
+          break;
+        }
+    }
+
+  if (!buffer)
+    {
+      buffer = g_new0 (ThreadBuffer, 1);
+      g_ptr_array_add (buffers, buffer);
+    }
+
+  atomic_store_explicit (&buffer->head, 0, memory_order_relaxed);
+  buffer->thread_id = next_thread_id++;
+  buffer->retired = FALSE;
+
+#ifdef __linux__
+  if (prctl (PR_GET_NAME, buffer->thread_name, 0, 0, 0) != 0)
+#endif
+    g_snprintf (buffer->thread_name, sizeof (buffer->thread_name), "Thread %u", buffer->thread_id);
+
+  g_mutex_unlock (&buffers_lock);
+
+  g_private_set (&thread_buffer, buffer);
+
+  return buffer;
+}
+
+/* Copies the events that are still intact, and returns how many there are */
+static size_t
+copy_thread_buffer (ThreadBuffer *buffer,
+                    TraceEvent   *events)
+{
+  uint64_t first;
+  uint64_t head;
+  uint64_t end;
+  size_t n_events = 0;
+
+  end = atomic_load_explicit (&buffer->head, memory_order_acquire);
+  first = end > N_EVENTS_PER_THREAD ? end - N_EVENTS_PER_THREAD : 0;
+
+  for (uint64_t i = first; i < end; i++)
+    events[i - first] = buffer->events[i & (N_EVENTS_PER_THREAD - 1)];
+
+  atomic_thread_fence (memory_order_acquire);
+  head = atomic_load_explicit (&buffer->head, memory_order_relaxed);
+
+  /* The event being written when head was read back overwrites the oldest one */
+  if (head + 1 > first + N_EVENTS_PER_THREAD)
+    {
+      uint64_t overwritten = MIN (head + 1 - N_EVENTS_PER_THREAD - first, end - first);
+
+      memmove (events, events + overwritten, (end - first - overwritten) * sizeof (TraceEvent));
+      n_events = end - first - overwritten;
+    }
+  else
+    {
+      n_events = end - first;
+    }
+
+  return n_events;
+}
+
+static void
+append_json_string (GString    *string,
+                    const char *value)
+{
+  g_string_append_c (string, '"');
+
+  for (const char *c = value ? value : ""; *c; c++)
+    {
+      switch (*c)
+        {
+        case '"':
+        case '\\':
+          g_string_append_c (string, '\\');
+          g_string_append_c (string, *c);
+          break;
+
+        default:
+          if ((unsigned char) *c < 0x20)
+            g_string_append_printf (string, "\\u%04x", *c);
+          else
+            g_string_append_c (string, *c);
+          break;
+        }
+    }
+
+  g_string_append_c (string, '"');
+}
+
+static void
+append_event (GString          *json,
+              const TraceEvent *event,
+              int               pid,
+              unsigned int      thread_id)
+{
+  const char *name;
+  char phase;
+
+  switch (event->type)
+    {
+    case BS_TRACE_EVENT_ENTRY:
+      phase = 'B';
+      name = event->function;
+      break;
+
+    case BS_TRACE_EVENT_EXIT:
+      phase = 'E';
+      name = event->function;
+      break;
+
+    case BS_TRACE_EVENT_MARK:
+      phase = 'i';
+      name = event->detail;
+      break;
+
+    case BS_TRACE_EVENT_GOTO:
+    case BS_TRACE_EVENT_PROBE:
+    default:
+      phase = 'i';
+      name = event->function;
+      break;
+    }
+
+  g_string_append (json, ",\n{\"name\":");
+  append_json_string (json, name);
+  g_string_append (json, ",\"cat\":");
+  append_json_string (json, event->domain);
+  g_string_append_printf (json,
+                          ",\"ph\":\"%c\",\"ts\":%" G_GINT64_FORMAT ",\"pid\":%d,\"tid\":%u",
+                          phase,
+                          event->timestamp,
+                          pid,
+                          thread_id);
+
+  if (phase == 'i')
+    g_string_append (json, ",\"s\":\"t\"");
+
+  g_string_append (json, ",\"args\":{\"function\":");
+  append_json_string (json, event->function);
+  g_string_append_printf (json, ",\"line\":%u", event->line);
+
+  if (event->type == BS_TRACE_EVENT_GOTO)
+    {
+      g_string_append (json, ",\"label\":");
+      append_json_string (json, event->detail);
+    }
+  else if (event->type == BS_TRACE_EVENT_MARK)
+    {
+      g_string_append_printf (json, ",\"value\":%" G_GUINT64_FORMAT, event->argument);
+    }
+
+  g_string_append (json, "}}");
+}
+
+
+/*
+ * Public API
+ */
+
+void
+bs_trace_record (BsTraceEventType  type,
+                 const char       *domain,
+                 const char       *function,
+                 const char       *detail,
+                 uint32_t          line,
+                 uint64_t          argument)
+{
+  ThreadBuffer *buffer = g_private_get (&thread_buffer);
+  TraceEvent *event;
+  uint64_t head;
+
+  if (G_UNLIKELY (!buffer))
+    buffer = acquire_thread_buffer ();
+
+  /* Only this thread writes to the buffer */
+  head = atomic_load_explicit (&buffer->head, memory_order_relaxed);
+  event = &buffer->events[head & (N_EVENTS_PER_THREAD - 1)];
+
+  event->timestamp = g_get_monotonic_time ();
+  event->domain = domain;
+  event->function = function;
+  event->detail = detail;
+  event->argument = argument;
+  event->line = line;
+  event->type = type;
+
+  atomic_store_explicit (&buffer->head, head + 1, memory_order_release);
+}
+
+/**
+ * bs_trace_dump:
+ * @path: the file to write to
+ * @error: a location for a #GError, or %NULL
+ *
+ * Writes the recorded events of all threads to @path, in the JSON format
+ * of Chrome traces, which Perfetto and chrome://tracing can open.
+ * Threads keep recording while dumping.
+ *
+ * Returns: whether the trace was written
+ */
+gboolean
+bs_trace_dump (const char  *path,
+               GError     **error)
+{
+  g_autoptr (GString) json = NULL;
+  g_autofree TraceEvent *events = NULL;
+  g_autofree char *dirname = NULL;
+  int pid;
+
+  g_return_val_if_fail (path != NULL, FALSE);
+
+  json = g_string_new ("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  events = g_new (TraceEvent, N_EVENTS_PER_THREAD);
+  pid = getpid ();
+
+  /* Starts the list, so that every event can be prefixed with a comma */
+  g_string_append_printf (json,
+                          "\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s\"}}",
+                          pid,
+                          "boatswain");
+
+  g_mutex_lock (&buffers_lock);
+
+  for (size_t i = 0; buffers && i < buffers->len; i++)
+    {
+      ThreadBuffer *buffer = g_ptr_array_index (buffers, i);
+      size_t n_events;
+
+      g_string_append_printf (json,
+                              ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":",
+                              pid,
+                              buffer->thread_id);
+      append_json_string (json, buffer->thread_name);
+      g_string_append (json, "}}");
+
+      n_events = copy_thread_buffer (buffer, events);
+
+      for (size_t j = 0; j < n_events; j++)
+        append_event (json, &events[j], pid, buffer->thread_id);
+    }
+
+  g_mutex_unlock (&buffers_lock);
+
+  g_string_append (json, "\n]}\n");
+
+  dirname = g_path_get_dirname (path);
+  if (g_mkdir_with_parents (dirname, 0755) != 0)
+    {
+      int saved_errno = errno;
+
+      g_set_error (error,
+                   G_FILE_ERROR,
+                   g_file_error_from_errno (saved_errno),
+                   "Failed to create %s: %s",
+                   dirname,
+                   g_strerror (saved_errno));
+      return FALSE;
+    }
+
+  return g_file_set_contents (path, json->str, json->len, error);
+}
+
+/**
+ * bs_trace_get_default_path:
+ *
+ * Retrieves where traces are dumped to. That is the BOATSWAIN_TRACE_FILE
+ * environment variable if set, or a file in the user cache directory.
+ *
+ * Returns: (transfer full): the path to dump traces to
+ */
+char *
+bs_trace_get_default_path (void)
+{
+  g_autofree char *filename = NULL;
+  const char *trace_file;
+
+  trace_file = g_getenv ("BOATSWAIN_TRACE_FILE");
+  if (trace_file && *trace_file)
+    return g_strdup (trace_file);
+
+  filename = g_strdup_printf ("trace-%d.json", getpid ());
+
+  return g_build_filename (g_get_user_cache_dir (), "boatswain", filename, NULL);
+}
@@ -0,0 +1,53 @@
+/* bs-trace.h
+ *
+ * Copyright 2022 Georges Basile Stavracas Neto <georges.stavracas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <glib.h>
+#include <stdint.h>
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+  BS_TRACE_EVENT_ENTRY,
+  BS_TRACE_EVENT_EXIT,
+  BS_TRACE_EVENT_GOTO,
+  BS_TRACE_EVENT_PROBE,
+  BS_TRACE_EVENT_MARK,
+} BsTraceEventType;
+
+/*
+ * All strings must be static, since only their pointers are recorded, and
+ * are only read back when dumping.
+ */
+void bs_trace_record (BsTraceEventType  type,
+                      const char       *domain,
+                      const char       *function,
+                      const char       *detail,
+                      uint32_t          line,
+                      uint64_t          argument);
+
+gboolean bs_trace_dump (const char  *path,
+                        GError     **error);
+
+char * bs_trace_get_default_path (void);
+
+G_END_DECLS
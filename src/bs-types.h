@@ -40,6 +40,7 @@ typedef struct _BsDeviceRegion BsDeviceRegion;
 typedef struct _BsDial BsDial;
 typedef struct _BsEmptyAction BsEmptyAction;
 typedef struct _BsIcon BsIcon;
+typedef struct _BsImageEncoder BsImageEncoder;
 typedef struct _BsImageInfo BsImageInfo;
 typedef struct _BsPage BsPage;
 typedef struct _BsPageItem BsPageItem;
@@ -0,0 +1,526 @@
+/* bs-usb-transport.c
+ *
+ * Copyright 2022 Georges Basile Stavracas Neto <georges.stavracas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define G_LOG_DOMAIN "USB Transport"
+
+#include "bs-usb-transport.h"
+
+#include <string.h>
+
+#define USB_TIMEOUT_MS 1000
+#define N_INPUT_TRANSFERS 4
+
+#define HID_REPORT_TYPE_FEATURE 0x03
+#define HID_REQUEST_GET_REPORT 0x01
+#define HID_REQUEST_SET_REPORT 0x09
+
+typedef struct
+{
+  BsUsbTransport *transport;
+  GCancellable *cancellable;
+  uint8_t data[];
+} InputTransfer;
+
+typedef struct
+{
+  BsUsbTransport *transport;
+  int64_t timestamp;
+  size_t length;
+  uint8_t data[];
+} ReceivedReport;
+
+struct _BsUsbTransport
+{
+  BsHidTransport parent_instance;
+
+  /* The claimed HID interface */
+  GUsbDevice *device;
+  uint8_t interface_number;
+  uint8_t input_endpoint;
+  uint8_t output_endpoint;
+  uint16_t input_packet_size;
+
+  /*
+   * Input reports are read with asynchronous interrupt transfers, which
+   * are all serviced by the libusb event thread of the GUsb context, and
+   * complete in the input thread shared by all transports. That thread
+   * stamps each report with its arrival time, resubmits the transfer, and
+   * hands the report to the main thread, so that the time reports wait for
+   * the main loop counts as input latency. Nothing wakes up while the
+   * device is idle. In-flight transfers keep the transport alive, since
+   * they complete after being cancelled.
+   */
+  GCancellable *input_cancellable;
+  int running;
+};
+
+G_DEFINE_FINAL_TYPE (BsUsbTransport, bs_usb_transport, BS_TYPE_HID_TRANSPORT)
+
+
+/*
+ * Auxiliary methods
+ */
+
+static gboolean
+find_hid_endpoints (BsUsbTransport  *self,
+                    GError         **error)
+{
+  g_autoptr (GPtrArray) interfaces = NULL;
+
+  interfaces = g_usb_device_get_interfaces (self->device, error);
+  if (!interfaces)
+    return FALSE;
+
+  for (size_t i = 0; i < interfaces->len; i++)
+    {
+      g_autoptr (GPtrArray) endpoints = NULL;
+      GUsbInterface *interface = g_ptr_array_index (interfaces, i);
+      gboolean has_input = FALSE;
+      gboolean has_output = FALSE;
+
+      if (g_usb_interface_get_class (interface) != G_USB_DEVICE_CLASS_HID)
+        continue;
+
+      endpoints = g_usb_interface_get_endpoints (interface);
+      for (size_t j = 0; endpoints && j < endpoints->len; j++)
+        {
+          GUsbEndpoint *endpoint = g_ptr_array_index (endpoints, j);
+
+          switch (g_usb_endpoint_get_direction (endpoint))
+            {
+            case G_USB_DEVICE_DIRECTION_DEVICE_TO_HOST:
+              self->input_endpoint = g_usb_endpoint_get_address (endpoint);
+              self->input_packet_size = g_usb_endpoint_get_maximum_packet_size (endpoint);
+              has_input = TRUE;
+              break;
+
+            case G_USB_DEVICE_DIRECTION_HOST_TO_DEVICE:
+              self->output_endpoint = g_usb_endpoint_get_address (endpoint);
+              has_output = TRUE;
+              break;
+            }
+        }
+
+      if (has_input && has_output)
+        {
+          self->interface_number = g_usb_interface_get_number (interface);
+          return TRUE;
+        }
+    }
+
+  g_set_error (error,
+               G_IO_ERROR,
+               G_IO_ERROR_NOT_FOUND,
+               "No HID interface with input and output endpoints");
+  return FALSE;
+}
+
+static gpointer
+input_thread_func (gpointer data)
+{
+  GMainContext *context = data;
+  GMainLoop *loop;
+
+  /* GUsb completes transfers in the thread-default context of the caller */
+  g_main_context_push_thread_default (context);
+
+  /* Runs for as long as the application does */
+  loop = g_main_loop_new (context, FALSE);
+  g_main_loop_run (loop);
+
+  return NULL;
+}
+
+static GMainContext *
+get_input_context (void)
+{
+  static GMainContext *input_context = NULL;
+
+  if (g_once_init_enter (&input_context))
+    {
+      GMainContext *context = g_main_context_new ();
+
+      g_thread_unref (g_thread_new ("Boatswain USB input", input_thread_func, context));
+
+      g_once_init_leave (&input_context, context);
+    }
+
+  return input_context;
+}
+
+static gboolean
+release_transport_cb (gpointer user_data)
+{
+  g_object_unref (user_data);
+  return G_SOURCE_REMOVE;
+}
+
+/* The transport is finalized, and the device closed, in the main thread */
+static void
+input_transfer_free (InputTransfer *transfer)
+{
+  g_main_context_invoke (NULL, release_transport_cb, g_steal_pointer (&transfer->transport));
+  g_clear_object (&transfer->cancellable);
+  g_free (transfer);
+}
+
+static gboolean
+deliver_input_report_cb (gpointer user_data)
+{
+  ReceivedReport *report = user_data;
+  BsUsbTransport *self = report->transport;
+
+  if (g_atomic_int_get (&self->running))
+    bs_hid_transport_push_input_report (BS_HID_TRANSPORT (self), report->data, report->length, report->timestamp);
+
+  g_clear_object (&report->transport);
+  g_free (report);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void submit_input_transfer (InputTransfer *transfer);
+
+/* Runs in the input thread */
+static void
+on_input_transfer_finished_cb (GObject      *source_object,
+                               GAsyncResult *result,
+                               gpointer      user_data)
+{
+  g_autoptr (GError) error = NULL;
+  InputTransfer *transfer = user_data;
+  BsUsbTransport *self = transfer->transport;
+  gssize length;
+
+  length = g_usb_device_interrupt_transfer_finish (G_USB_DEVICE (source_object), result, &error);
+
+  if (!g_atomic_int_get (&self->running) ||
+      g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED) ||
+      g_error_matches (error, G_USB_DEVICE_ERROR, G_USB_DEVICE_ERROR_CANCELLED) ||
+      g_error_matches (error, G_USB_DEVICE_ERROR, G_USB_DEVICE_ERROR_NO_DEVICE))
+    {
+      input_transfer_free (transfer);
+      return;
+    }
+
+  /* Other failures are transient, and the transfer stays in flight */
+  if (length < 0)
+    g_warning ("Failed to read from Stream Deck: %s", error->message);
+  else if (length > 0)
+    {
+      ReceivedReport *report;
+
+      report = g_malloc (sizeof (ReceivedReport) + length * sizeof (uint8_t));
+      report->transport = g_object_ref (self);
+      report->timestamp = g_get_monotonic_time ();
+      report->length = length;
+      memcpy (report->data, transfer->data, length);
+
+      g_main_context_invoke (NULL, deliver_input_report_cb, report);
+    }
+
+  /* Back in flight right away, without waiting for the main thread */
+  submit_input_transfer (transfer);
+}
+
+/* Runs in the input thread, so that transfers complete there */
+static void
+submit_input_transfer (InputTransfer *transfer)
+{
+  BsUsbTransport *self = transfer->transport;
+
+  g_usb_device_interrupt_transfer_async (self->device,
+                                         self->input_endpoint,
+                                         transfer->data,
+                                         self->input_packet_size,
+                                         0,
+                                         transfer->cancellable,
+                                         on_input_transfer_finished_cb,
+                                         transfer);
+}
+
+static gboolean
+start_input_transfer_cb (gpointer user_data)
+{
+  submit_input_transfer (user_data);
+  return G_SOURCE_REMOVE;
+}
+
+
+/*
+ * BsHidTransport overrides
+ */
+
+static gboolean
+bs_usb_transport_get_feature_report (BsHidTransport  *transport,
+                                     uint8_t         *data,
+                                     size_t           length,
+                                     GError         **error)
+{
+  BsUsbTransport *self = BS_USB_TRANSPORT (transport);
+
+  return g_usb_device_control_transfer (self->device,
+                                        G_USB_DEVICE_DIRECTION_DEVICE_TO_HOST,
+                                        G_USB_DEVICE_REQUEST_TYPE_CLASS,
+                                        G_USB_DEVICE_RECIPIENT_INTERFACE,
+                                        HID_REQUEST_GET_REPORT,
+                                        HID_REPORT_TYPE_FEATURE << 8 | data[0],
+                                        self->interface_number,
+                                        data,
+                                        length,
+                                        NULL,
+                                        USB_TIMEOUT_MS,
+                                        NULL,
+                                        error);
+}
+
+static gboolean
+bs_usb_transport_send_report (BsHidTransport   *transport,
+                              BsHidReportType   type,
+                              const uint8_t    *data,
+                              size_t            length,
+                              GError          **error)
+{
+  BsUsbTransport *self = BS_USB_TRANSPORT (transport);
+
+  switch (type)
+    {
+    case BS_HID_REPORT_OUTPUT:
+      return g_usb_device_interrupt_transfer (self->device,
+                                              self->output_endpoint,
+                                              (uint8_t *) data,
+                                              length,
+                                              NULL,
+                                              USB_TIMEOUT_MS,
+                                              NULL,
+                                              error);
+
+    case BS_HID_REPORT_FEATURE:
+      return g_usb_device_control_transfer (self->device,
+                                            G_USB_DEVICE_DIRECTION_HOST_TO_DEVICE,
+                                            G_USB_DEVICE_REQUEST_TYPE_CLASS,
+                                            G_USB_DEVICE_RECIPIENT_INTERFACE,
+                                            HID_REQUEST_SET_REPORT,
+                                            HID_REPORT_TYPE_FEATURE << 8 | data[0],
+                                            self->interface_number,
+                                            (uint8_t *) data,
+                                            length,
+                                            NULL,
+                                            USB_TIMEOUT_MS,
+                                            NULL,
+                                            error);
+
+    case BS_HID_REPORT_INPUT:
+    default:
+      g_assert_not_reached ();
+    }
+}
+
+static void
+bs_usb_transport_send_report_async (BsHidTransport      *transport,
+                                    BsHidReportType      type,
+                                    const uint8_t       *data,
+                                    size_t               length,
+                                    GAsyncReadyCallback  callback,
+                                    gpointer             user_data)
+{
+  BsUsbTransport *self = BS_USB_TRANSPORT (transport);
+
+  /* Completions go straight to the caller, without an intermediate task */
+  switch (type)
+    {
+    case BS_HID_REPORT_OUTPUT:
+      g_usb_device_interrupt_transfer_async (self->device,
+                                             self->output_endpoint,
+                                             (uint8_t *) data,
+                                             length,
+                                             USB_TIMEOUT_MS,
+                                             NULL,
+                                             callback,
+                                             user_data);
+      break;
+
+    case BS_HID_REPORT_FEATURE:
+      g_usb_device_control_transfer_async (self->device,
+                                           G_USB_DEVICE_DIRECTION_HOST_TO_DEVICE,
+                                           G_USB_DEVICE_REQUEST_TYPE_CLASS,
+                                           G_USB_DEVICE_RECIPIENT_INTERFACE,
+                                           HID_REQUEST_SET_REPORT,
+                                           HID_REPORT_TYPE_FEATURE << 8 | data[0],
+                                           self->interface_number,
+                                           (uint8_t *) data,
+                                           length,
+                                           USB_TIMEOUT_MS,
+                                           NULL,
+                                           callback,
+                                           user_data);
+      break;
+
+    case BS_HID_REPORT_INPUT:
+    default:
+      g_assert_not_reached ();
+    }
+}
+
+static gboolean
+bs_usb_transport_send_report_finish (BsHidTransport   *transport,
+                                     BsHidReportType   type,
+                                     GAsyncResult     *result,
+                                     GError          **error)
+{
+  BsUsbTransport *self = BS_USB_TRANSPORT (transport);
+
+  switch (type)
+    {
+    case BS_HID_REPORT_OUTPUT:
+      return g_usb_device_interrupt_transfer_finish (self->device, result, error) >= 0;
+
+    case BS_HID_REPORT_FEATURE:
+      return g_usb_device_control_transfer_finish (self->device, result, error) >= 0;
+
+    case BS_HID_REPORT_INPUT:
+    default:
+      g_assert_not_reached ();
+    }
+}
+
+/*
+ * Keeps a few transfers in flight, so that reports arriving while the main
+ * thread is busy are not dropped. Transfers on the same endpoint complete,
+ * and are handled, in order.
+ */
+static void
+bs_usb_transport_start (BsHidTransport *transport)
+{
+  BsUsbTransport *self = BS_USB_TRANSPORT (transport);
+
+  g_assert (!g_atomic_int_get (&self->running));
+
+  g_atomic_int_set (&self->running, TRUE);
+  self->input_cancellable = g_cancellable_new ();
+
+  for (size_t i = 0; i < N_INPUT_TRANSFERS; i++)
+    {
+      InputTransfer *transfer;
+
+      transfer = g_malloc0 (sizeof (InputTransfer) + self->input_packet_size * sizeof (uint8_t));
+      transfer->transport = g_object_ref (self);
+      transfer->cancellable = g_object_ref (self->input_cancellable);
+
+      g_main_context_invoke (get_input_context (), start_input_transfer_cb, transfer);
+    }
+}
+
+static void
+bs_usb_transport_stop (BsHidTransport *transport)
+{
+  BsUsbTransport *self = BS_USB_TRANSPORT (transport);
+
+  if (!g_atomic_int_get (&self->running))
+    return;
+
+  /* Transfers free themselves once the cancellation completes */
+  g_atomic_int_set (&self->running, FALSE);
+  g_cancellable_cancel (self->input_cancellable);
+  g_clear_object (&self->input_cancellable);
+}
+
+
+/*
+ * GObject overrides
+ */
+
+static void
+bs_usb_transport_finalize (GObject *object)
+{
+  BsUsbTransport *self = (BsUsbTransport *)object;
+
+  if (self->device)
+    {
+      g_usb_device_release_interface (self->device,
+                                      self->interface_number,
+                                      G_USB_DEVICE_CLAIM_INTERFACE_BIND_KERNEL_DRIVER,
+                                      NULL);
+      g_usb_device_close (self->device, NULL);
+    }
+
+  g_clear_object (&self->input_cancellable);
+  g_clear_object (&self->device);
+
+  G_OBJECT_CLASS (bs_usb_transport_parent_class)->finalize (object);
+}
+
+static void
+bs_usb_transport_class_init (BsUsbTransportClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  BsHidTransportClass *transport_class = BS_HID_TRANSPORT_CLASS (klass);
+
+  object_class->finalize = bs_usb_transport_finalize;
+
+  transport_class->get_feature_report = bs_usb_transport_get_feature_report;
+  transport_class->send_report = bs_usb_transport_send_report;
+  transport_class->send_report_async = bs_usb_transport_send_report_async;
+  transport_class->send_report_finish = bs_usb_transport_send_report_finish;
+  transport_class->start = bs_usb_transport_start;
+  transport_class->stop = bs_usb_transport_stop;
+}
+
+static void
+bs_usb_transport_init (BsUsbTransport *self)
+{
+}
+
+/**
+ * bs_usb_transport_new:
+ * @device: a #GUsbDevice
+ * @error: a location for a #GError, or %NULL
+ *
+ * Opens @device, and claims its HID interface. This blocks on USB round
+ * trips, and may run in a thread.
+ *
+ * Returns: (transfer full)(nullable): a #BsHidTransport, or %NULL
+ */
+BsHidTransport *
+bs_usb_transport_new (GUsbDevice  *device,
+                      GError     **error)
+{
+  g_autoptr (BsUsbTransport) self = NULL;
+
+  g_return_val_if_fail (G_USB_IS_DEVICE (device), NULL);
+
+  if (!g_usb_device_open (device, error))
+    return NULL;
+
+  /* From here on, finalizing the transport closes the device */
+  self = g_object_new (BS_TYPE_USB_TRANSPORT, NULL);
+  self->device = g_object_ref (device);
+
+  if (!find_hid_endpoints (self, error))
+    return NULL;
+
+  if (!g_usb_device_claim_interface (device,
+                                     self->interface_number,
+                                     G_USB_DEVICE_CLAIM_INTERFACE_BIND_KERNEL_DRIVER,
+                                     error))
+    return NULL;
+
+  return BS_HID_TRANSPORT (g_steal_pointer (&self));
+}
@@ -0,0 +1,35 @@
+/* bs-usb-transport.h
+ *
+ * Copyright 2022 Georges Basile Stavracas Neto <georges.stavracas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include "bs-hid-transport.h"
+
+#include <gusb.h>
+
+G_BEGIN_DECLS
+
+#define BS_TYPE_USB_TRANSPORT (bs_usb_transport_get_type())
+G_DECLARE_FINAL_TYPE (BsUsbTransport, bs_usb_transport, BS, USB_TRANSPORT, BsHidTransport)
+
+BsHidTransport * bs_usb_transport_new (GUsbDevice  *device,
+                                       GError     **error);
+
+G_END_DECLS
@@ -20,6 +20,7 @@
 
 #define G_LOG_DOMAIN "OBS Studio"
 
+#include "bs-profiler.h"
 #include "obs-connection.h"
 #include "obs-scene.h"
 #include "obs-source.h"
@@ -727,8 +728,10 @@ on_websocket_client_message_cb (SoupWebsocketConnection *websocket_client,
   JsonObject *root_object;
   const char *data;
   const char *uuid;
+  int64_t begin;
   size_t length;
 
+  begin = BS_PROFILER_CURRENT_TIME;
   data = g_bytes_get_data (message, &length);
 
   parser = json_parser_new ();
@@ -764,6 +767,13 @@ on_websocket_client_message_cb (SoupWebsocketConnection *websocket_client,
     {
       parse_event (self, root_object);
     }
+
+  BS_PROFILER_ADD_MARK (begin,
+                        "OBS message",
+                        "%s %s bytes=%zu",
+                        uuid ? "response" : "event",
+                        uuid ?: json_object_get_string_member_with_default (root_object, "update-type", ""),
+                        length);
 }
 
 static void